@@ -0,0 +1,419 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#include "pyembed.h"
+#include "pyembed_zygote.h"
+#include "pyembed_process_pool.h"
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <boost/format.hpp>
+
+#ifndef _WIN32
+#   include <spawn.h>
+#   include <sys/wait.h>
+extern char** environ;
+#endif
+
+// 计算执行 action 若干次的平均耗时(微秒)
+template<class F>
+double measure(int rounds, F&& action)
+{
+    auto started = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i)
+        action();
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    return std::chrono::duration<double, std::micro>(elapsed).count() / rounds;
+}
+
+void report(const char* name, double us, double baseline)
+{
+    std::cout << boost::format("%-28s %12.2f us %8.2fx\n") % name % us % (us / baseline);
+}
+
+int main(int argc, char* argv[])
+{
+    pyembed::get().init();
+
+#ifndef _WIN32
+    // zygote须在创建其他线程前启动
+    auto folder = std::filesystem::temp_directory_path();
+    pyembed_zygote::options zygote_options;
+    zygote_options.socket_path = folder / "pyembed_benchmark.sock";
+    zygote_options.preload = { "json" };
+    pyembed_zygote zygote(pyembed::get(), zygote_options);
+
+    pyembed_process_pool::options pool_options;
+    pool_options.workers = 8;
+    pool_options.prelude =
+        "def workload():\n"
+        "    total = 0\n"
+        "    for i in range(20000):\n"
+        "        total += i % 7\n"
+        "    return total\n";
+    pyembed_process_pool processes(pyembed::get(), pool_options);
+#endif
+
+    const int rounds = 50;
+    const std::string workload =
+        "total = 0\n"
+        "for i in range(20000):\n"
+        "    total += i % 7\n";
+
+    // 执行限制的开销
+    {
+        std::cout << "limits overhead:\n";
+        double baseline = measure(rounds, [&] { pyembed::get().exec(workload); });
+        report("none", baseline, baseline);
+
+        pyembed::pylimits timeout;
+        timeout.timeout = std::chrono::milliseconds(10000);
+        report("timeout", measure(rounds, [&] { 
+            pyembed::get().exec(workload, {}, timeout); }), baseline);
+
+        pyembed::pylimits cpu;
+        cpu.max_cpu_time = std::chrono::milliseconds(10000);
+        report("max_cpu_time", measure(rounds, [&] { 
+            pyembed::get().exec(workload, {}, cpu); }), baseline);
+
+        pyembed::pylimits instructions;
+        instructions.max_instructions = 100000000;
+        report("max_instructions", measure(rounds, [&] { 
+            pyembed::get().exec(workload, {}, instructions); }), baseline);
+    }
+
+    // 逐条计算与批量计算
+    {
+        std::cout << "\nbatch evaluation (per record):\n";
+        const size_t count = 10000;
+        std::vector<int64_t> quantity(count);
+        std::vector<double> price(count), total(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            quantity[i] = i % 13;
+            price[i] = 0.5 * (i % 7);
+        }
+
+        const std::string expression = "quantity * price if quantity > 3 else 0.0";
+        double baseline = measure(1, [&] {
+            for (size_t i = 0; i < count; ++i)
+            {
+                pyembed::get().global()["quantity"] = quantity[i];
+                pyembed::get().global()["price"] = price[i];
+                total[i] = boost::python::extract<double>(pyembed::get().eval(expression));
+            }
+        }) / count;
+        report("eval", baseline, baseline);
+
+        report("eval_batch", measure(1, [&] {
+            pyembed::get().eval_batch(expression, {
+                    pyembed::column("quantity", quantity.data()),
+                    pyembed::column("price", price.data()) },
+                count, pyembed::output(total.data()));
+        }) / count, baseline);
+    }
+
+    // 命名空间的读写
+    {
+        std::cout << "\nnamespace access (read + write):\n";
+        const int count = 100000;
+        auto& space = pyembed::get().global();
+        space["counter"] = 0;
+
+        double baseline = measure(count, [&] {
+            int value = boost::python::extract<int>(space["counter"]);
+            space["counter"] = value + 1;
+        });
+        report("dict[\"name\"]", baseline, baseline);
+
+        report("PYEMBED_KEY(\"name\")", measure(count, [&] {
+            int value = boost::python::extract<int>(pyembed::getitem(space, PYEMBED_KEY("counter")));
+            pyembed::setitem(space, PYEMBED_KEY("counter"), value + 1);
+        }), baseline);
+    }
+
+    // 解释器与原生求值树
+    {
+        std::cout << "\nexpression evaluation:\n";
+        const int count = 100000;
+        const std::string expression = "(a * 3 + b) % 7 < 4 and not c if a > 0 else b - 1";
+        pyembed::get().global()["a"] = 12;
+        pyembed::get().global()["b"] = 2.5;
+        pyembed::get().global()["c"] = false;
+
+        double baseline = measure(count, [&] { pyembed::get().eval(expression); });
+        report("eval", baseline, baseline);
+
+        auto compiled = pyembed::get().compile_expr(expression);
+        report("eval(compiled, native)", measure(count, [&] { 
+            pyembed::get().eval(compiled); }), baseline);
+
+        // 变量不是 int/float/bool 时回退到解释器，仍然省去了编译
+        pyembed::get().global()["c"] = boost::python::list();
+        report("eval(compiled, fallback)", measure(count, [&] { 
+            pyembed::get().eval(compiled); }), baseline);
+    }
+
+    // 非Python线程反复获取GIL
+    {
+        std::cout << "\ngil acquire (non-Python thread):\n";
+        const int count = 100000;
+        pyembed::gil_release unlock;
+
+        double baseline = 0.0;
+        std::thread([&] {
+            baseline = measure(count, [&] {
+                PyGILState_STATE gstate = PyGILState_Ensure();
+                PyGILState_Release(gstate);
+            });
+        }).join();
+        report("PyGILState_Ensure/Release", baseline, baseline);
+
+        double cached = 0.0;
+        std::thread([&] {
+            cached = measure(count, [&] { pyembed::gil_acquire gil; });
+        }).join();
+        report("gil_acquire", cached, baseline);
+
+        pyembed::set_gil_profiling(true);
+        double profiled = 0.0;
+        std::thread([&] {
+            profiled = measure(count, [&] { pyembed::gil_acquire gil("benchmark"); });
+        }).join();
+        pyembed::set_gil_profiling(false);
+        report("gil_acquire (profiled)", profiled, baseline);
+    }
+
+    // 并行执行：自由线程构建中随线程数扩展，启用GIL时各线程串行执行
+    {
+#ifdef Py_GIL_DISABLED
+        std::cout << "\nparallel exec (free-threaded, wall time):\n";
+#else
+        std::cout << "\nparallel exec (GIL, wall time):\n";
+#endif
+        const int jobs = 16;
+        std::vector<pyembed::context> contexts;
+        for (int i = 0; i < 8; ++i)
+            contexts.push_back(pyembed::get().create_context("parallel#" + std::to_string(i)));
+
+        auto run = [&](int threads) {
+            pyembed::gil_release unlock;
+            return measure(1, [&] {
+                std::vector<std::thread> workers;
+                for (int t = 0; t < threads; ++t)
+                {
+                    workers.emplace_back([&, t] {
+                        pyembed::gil_acquire gil;
+                        for (int i = t; i < jobs; i += threads)
+                            pyembed::get().exec(contexts[t], workload);
+                    });
+                }
+                for (auto& worker : workers)
+                    worker.join();
+            });
+        };
+
+        double baseline = run(1);
+        report("1 thread", baseline, baseline);
+        for (int threads : { 2, 4, 8 })
+            report((std::to_string(threads) + " threads").c_str(), run(threads), baseline);
+
+        // 争用报告：各线程的等待时间与持有时间
+        pyembed::reset_gil_report();
+        pyembed::set_gil_profiling(true);
+        run(4);
+        pyembed::set_gil_profiling(false);
+        std::cout << "\n" << pyembed::gil_report().format();
+
+        for (const auto& ctx : contexts)
+            pyembed::get().remove_context(ctx->name);
+    }
+
+#ifndef _WIN32
+    // perf 分析支持：Python函数之间的调用经由跳板，不再内联
+    {
+        std::cout << "\nperf profiling (function calls):\n";
+        auto& embed = pyembed::get();
+        embed.exec(
+            "def step(x):\n"
+            "    return x + 1\n"
+            "def calls():\n"
+            "    t = 0\n"
+            "    for i in range(100000):\n"
+            "        t = step(t)\n");
+
+        double baseline = measure(rounds, [&] { embed.eval("calls()"); });
+        report("off", baseline, baseline);
+        if (embed.set_perf_profiling(true))
+        {
+            report("on", measure(rounds, [&] { embed.eval("calls()"); }), baseline);
+            embed.set_perf_profiling(false);
+        }
+    }
+
+    // 时间线追踪：每个入口记录一个区间，记录Python函数调用时每次调用读取一次时钟
+    {
+        std::cout << "\ntracing:\n";
+        auto& embed = pyembed::get();
+        auto path = std::filesystem::temp_directory_path() / "pyembed_benchmark_trace.json";
+        pyembed::trace_options options;
+        options.path = path;
+
+        double baseline = measure(rounds * 1000, [&] { embed.eval("1"); });
+        report("eval (off)", baseline, baseline);
+        pyembed::start_tracing(options);
+        report("eval (traced)", measure(rounds * 1000, [&] { embed.eval("1"); }), baseline);
+        pyembed::stop_tracing();
+
+        baseline = measure(rounds, [&] { embed.eval("calls()"); });
+        report("function calls (off)", baseline, baseline);
+        options.python_calls = true;
+        pyembed::start_tracing(options);
+        report("function calls (traced)", measure(rounds, [&] { embed.eval("calls()"); }), baseline);
+        pyembed::stop_tracing();
+        std::filesystem::remove(path);
+    }
+
+    // 看门狗：每个调用记录开始时间，由时间轮周期性地检查
+    {
+        std::cout << "\nwatchdog:\n";
+        auto& embed = pyembed::get();
+        double baseline = measure(rounds * 1000, [&] { embed.eval("1"); });
+        report("eval (off)", baseline, baseline);
+        embed.set_watchdog(std::chrono::seconds(10));
+        report("eval (watchdog)", measure(rounds * 1000, [&] { embed.eval("1"); }), baseline);
+        embed.set_watchdog(std::chrono::milliseconds(0));
+    }
+
+    // 回收暂停：请求期间自动回收，与请求期间禁用回收、在请求之间回收
+    {
+        std::cout << "\ngc pauses (per request, excluding collections between requests):\n";
+        auto& embed = pyembed::get();
+        const int requests = 200;
+        const std::string request =
+            "cache.append([{'i': i} for i in range(500)])\n"
+            "for i in range(200):\n"
+            "    a = []; a.append(a)\n";
+
+        // 返回每个请求的平均与最长耗时
+        auto run = [&](bool between) {
+            embed.exec("cache = []");
+            embed.gc_collect();
+            embed.reset_gc_report();
+            double total = 0.0, longest = 0.0;
+            for (int i = 0; i < requests; ++i)
+            {
+                {
+                    std::unique_ptr<pyembed::gc_suspend> suspend;
+                    if (between)
+                        suspend.reset(new pyembed::gc_suspend);
+                    double elapsed = measure(1, [&] { embed.exec(request); });
+                    total += elapsed;
+                    longest = std::max(longest, elapsed);
+                }
+                if (between)
+                    embed.gc_collect(0);
+            }
+            return std::make_pair(total / requests, longest);
+        };
+
+        embed.set_gc_profiling(true);
+        auto automatic = run(false);
+        std::string pauses = embed.gc_report().format();
+        auto between = run(true);
+        report("automatic (mean)", automatic.first, automatic.first);
+        report("between requests (mean)", between.first, automatic.first);
+        report("automatic (max)", automatic.second, automatic.second);
+        report("between requests (max)", between.second, automatic.second);
+        std::cout << "automatic " << pauses << "between requests " << embed.gc_report().format();
+        embed.set_gc_profiling(false);
+        embed.exec("del cache");
+    }
+
+    // 多进程：请求与结果经由共享内存传递，随工作进程数扩展
+    {
+        std::cout << "\nprocess pool (wall time):\n";
+        const int jobs = 32;
+        pyembed::get().exec(pool_options.prelude);
+        double baseline = measure(1, [&] {
+            for (int i = 0; i < jobs; ++i)
+                pyembed::get().eval("workload()");
+        });
+        report("in-process", baseline, baseline);
+
+        pyembed::gil_release unlock;
+        for (int threads : { 1, 2, 4, 8 })
+        {
+            double elapsed = measure(1, [&] {
+                std::vector<std::thread> workers;
+                for (int t = 0; t < threads; ++t)
+                {
+                    workers.emplace_back([&, t] {
+                        pyembed::gil_acquire gil;
+                        for (int i = t; i < jobs; i += threads)
+                            processes.call("workload");
+                    });
+                }
+                for (auto& worker : workers)
+                    worker.join();
+            });
+            report((std::to_string(threads) + " workers").c_str(), elapsed, baseline);
+        }
+
+        double trivial = 0.0;
+        std::thread([&] {
+            pyembed::gil_acquire gil;
+            trivial = measure(1000, [&] { processes.eval("1"); });
+        }).join();
+        report("round trip", trivial, trivial);
+    }
+
+    // 隔离执行：新进程初始化解释器与由zygote fork子进程
+    {
+        std::cout << "\nisolated script (per job):\n";
+        const int count = 20;
+        auto script = folder / "pyembed_benchmark.py";
+        std::ofstream(script) << "import json\nresult = json.dumps([1, 2, 3])\n";
+
+        double baseline = measure(count, [&] {
+            std::string path = script.string();
+            char* argv[] = { (char*)"python3", (char*)path.c_str(), nullptr };
+            pid_t pid = 0;
+            if (posix_spawnp(&pid, "python3", nullptr, nullptr, argv, environ) == 0)
+                waitpid(pid, nullptr, 0);
+        });
+        report("spawn python3", baseline, baseline);
+
+        pyembed_zygote::job task;
+        task.script = script;
+        report("zygote fork", measure(count, [&] {
+            zygote.run(task);
+        }), baseline);
+        std::filesystem::remove(script);
+    }
+#endif
+
+    return 0;
+}
@@ -5,9 +5,24 @@
 
 #include <boost/python.hpp>
 #include <boost/detail/lightweight_test.hpp>
+#include <thread>
+#include <atomic>
+#include <csignal>
+#include <fstream>
+#ifdef __linux__
+#   include <unistd.h>
+#endif
+#ifndef _WIN32
+#   include <sys/stat.h>
+#endif
 #include <iostream>
 #include <filesystem>
 #include "pyembed.h"
+#include "pyembed_pool.h"
+#include "pyembed_column.h"
+#include "pyembed_stream.h"
+#include "pyembed_zygote.h"
+#include "pyembed_process_pool.h"
 
 namespace python = boost::python;
 
@@ -57,14 +72,61 @@ public:
     void throwException() {
         throw std::runtime_error("runtime_error");
     }
+
+    void throwOutOfRange() {
+        throw std::out_of_range("out_of_range");
+    }
 };
 
 BOOST_PYTHON_MODULE(TestCppException)
 {
     using namespace boost::python;
     class_<TestCppException>("TestCppException", init<>())
-        .def("throwException", &TestCppException::throwException);
+        .def("throwException", &TestCppException::throwException)
+        .def("throwOutOfRange", &TestCppException::throwOutOfRange);
+}
+
+// 重定向标准流，并记录重定向接口被调用时是否持有GIL
+class pyembed_sink : public pyembed
+{
+public:
+    pyembed_sink(const std::type_info& type)
+        : pyembed(type)
+    {}
+
+    std::atomic<int> gil_held{ -1 };
+
+    std::string readline_stdin(int size = -1) override
+    {
+        gil_held = PyGILState_Check();
+        return "pyembed\n";
+    }
+
+    void write_stdout(const std::string& str) override
+    {
+        gil_held = PyGILState_Check();
+        std::cout << str;
+    }
+
+    void write_stderr(const std::string& str) override
+    {
+        gil_held = PyGILState_Check();
+        std::cerr << str;
+    }
+};
+
+#ifndef _WIN32
+// 持有GIL阻塞在C代码中，返回前检查看门狗是否已写入 fd
+static int  watchdog_fd = -1;
+static bool watchdog_fired = false;
+
+static void hold_gil(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    struct stat st;
+    watchdog_fired = fstat(watchdog_fd, &st) == 0 && st.st_size > 0;
 }
+#endif
 
 int main(int argc, char** argv)
 {
@@ -73,7 +135,7 @@ int main(int argc, char** argv)
     std::string script = (floder / "script.py").string();
 
     // Register the module with the interpreter
-    pyembed::get().append_inittab({
+    pyembed::get<pyembed_sink>().append_inittab({
         {"embedded_hello", PyInit_embedded_hello},
         {"TestCppException", PyInit_TestCppException},
     });
@@ -81,6 +143,61 @@ int main(int argc, char** argv)
     // Initialize the interpreter
     pyembed::get().init();
 
+#ifndef _WIN32
+    // zygote: 在创建其他线程前启动，每个作业在独立的子进程中执行
+    {
+        auto script = std::filesystem::temp_directory_path() / "pyembed_zygote.py";
+        std::ofstream(script) << 
+            "import sys\n"
+            "print('argv', sys.argv[1:])\n"
+            "result = answer\n"
+            "if sys.argv[1:] == ['crash']:\n"
+            "    import os; os.abort()\n";
+
+        pyembed_zygote::options opts;
+        opts.socket_path = std::filesystem::temp_directory_path() / "pyembed_embedding.sock";
+        opts.prelude = "answer = 42";
+        pyembed_zygote zygote(pyembed::get(), opts);
+
+        auto done = zygote.run({ script, { "x" } });
+        BOOST_TEST(done.exit_code == 0 && done.signal == 0);
+        BOOST_TEST(done.out == "argv ['x']\n");
+        BOOST_TEST(done.result == "42");
+
+        auto crashed = zygote.run({ script, { "crash" } });
+        BOOST_TEST(crashed.exit_code == -1 && crashed.signal == SIGABRT);
+        BOOST_TEST(!pyembed::get().local().has_key("answer"));
+        std::filesystem::remove(script);
+    }
+
+    // process pool: 崩溃的工作进程被重新创建，异常在当前进程中重新抛出
+    {
+        pyembed_process_pool::options opts;
+        opts.workers = 2;
+        opts.prelude = "import os\ndef scale(x, factor=2):\n    return x * factor\n";
+        pyembed_process_pool pool(pyembed::get(), opts);
+
+        BOOST_TEST(python::extract<int>(pool.eval("6 * 7")) == 42);
+        python::dict kwargs;
+        kwargs["factor"] = 3;
+        BOOST_TEST(python::extract<int>(pool.call("scale", python::make_tuple(14), kwargs)) == 42);
+        BOOST_TEST(python::extract<std::string>(pool.call("json.dumps", python::make_tuple(python::list())))() == "[]");
+
+        std::string error;
+        auto describe = [&](const pyembed::pyerror& pyerr) {
+            error = python::extract<std::string>(pyerr.pytype.attr("__name__"));
+            return true;
+        };
+        pool.eval("1 / 0", describe);
+        BOOST_TEST(error == "ZeroDivisionError");
+        pool.exec("os._exit(3)", describe);
+        BOOST_TEST(error == "RuntimeError");
+
+        BOOST_TEST(python::extract<int>(pool.eval("6 * 7")) == 42);
+        BOOST_TEST(pool.stats().failed == 2);
+    }
+#endif
+
     // eval
     {
         auto result = pyembed::get().eval("'abcdefg'.upper()");
@@ -137,6 +254,19 @@ int main(int argc, char** argv)
         );
     }
 
+    // exception translator
+    {
+        pyembed::get().register_exception_translator<std::out_of_range>(PyExc_IndexError);
+        pyembed::get().exec(
+            "try:                               \n"
+            "    cppObj.throwOutOfRange()       \n"
+            "except IndexError as e:            \n"
+            "    translated = str(e)            \n");
+
+        std::string translated = python::extract<std::string>(pyembed::get().local()["translated"]);
+        BOOST_TEST(translated == "out_of_range");
+    }
+
     // exec
     {
         pyembed::get().exec(
@@ -154,11 +284,771 @@ int main(int argc, char** argv)
         BOOST_TEST(python::extract<int>(pyembed::get().local()["number"]) == 42);
     }
 
+    // interned keys
+    {
+        auto& local = pyembed::get().local();
+        pyembed::setitem(local, PYEMBED_KEY("answer"), 42);
+        BOOST_TEST(python::extract<int>(pyembed::getitem(local, PYEMBED_KEY("answer"))) == 42);
+        BOOST_TEST(pyembed::getitem(local, PYEMBED_KEY("missing"), python::object()).is_none());
+    }
+
+    // stream
+    {
+        int64_t total = 0;
+        size_t count = 0;
+        auto rows = pyembed::get().eval("((i, str(i)) for i in range(1000))");
+        for (const auto& row : pystream<std::tuple<int64_t, std::string>>(rows, 64))
+        {
+            total += std::get<0>(row);
+            count += std::get<1>(row) == std::to_string(std::get<0>(row));
+        }
+        BOOST_TEST(total == 499500);
+        BOOST_TEST(count == 1000);
+    }
+
+    // gil
+    {
+        auto before = pyembed::gil_stats();
+        pyembed::set_gil_profiling(true);
+        std::atomic<int> total{ 0 };
+        {
+            pyembed::gil_release unlock;
+            std::vector<std::thread> workers;
+            for (int t = 0; t < 4; ++t)
+            {
+                workers.emplace_back([&] {
+                    for (int i = 0; i < 100; ++i)
+                    {
+                        pyembed::gil_acquire gil;
+                        total += python::extract<int>(pyembed::get().eval("6 * 7"))();
+                    }
+                });
+            }
+            for (auto& worker : workers)
+                worker.join();
+        }
+        auto after = pyembed::gil_stats();
+        BOOST_TEST(total == 4 * 100 * 42);
+        BOOST_TEST(after.acquires - before.acquires == 400);
+        BOOST_TEST(after.threads - before.threads == 4);
+        BOOST_TEST(PyGILState_Check());
+
+        // 每个工作线程获取GIL 100 次，eval 入口调用 400 次
+        pyembed::set_gil_profiling(false);
+        auto contention = pyembed::gil_report();
+        size_t sampled = 0;
+        for (const auto& item : contention.threads)
+            sampled += item.wait.count == 100;
+        BOOST_TEST(sampled == 4);
+        auto eval = std::find_if(contention.entries.begin(), contention.entries.end(),
+            [](const pyembed::gil_profile& item) { return item.name == "eval"; });
+        BOOST_TEST(eval != contention.entries.end() && eval->hold.count == 400);
+        BOOST_TEST(!contention.top.empty() && contention.top.front().hold_ns >= contention.top.back().hold_ns);
+    }
+
+    // gc: 阈值、冻结、暂停作用域与回收暂停统计
+    {
+        auto& embed = pyembed::get();
+        embed.reset_gc_report();
+        embed.set_gc_profiling(true);
+        embed.set_gc_thresholds(100);
+        auto report = embed.gc_report();
+        BOOST_TEST(report.generations[0].threshold == 100);
+
+        const char* garbage =
+            "for i in range(2000):  \n"
+            "    a = []; a.append(a)\n";
+        {
+            pyembed::gc_suspend suspend;
+            auto before = embed.gc_report();
+            BOOST_TEST(!before.enabled);
+            embed.exec(garbage);
+            BOOST_TEST(embed.gc_report().generations[0].pause.count == before.generations[0].pause.count);
+        }
+        BOOST_TEST(embed.gc_report().enabled);
+        embed.gc_collect(0);
+        embed.reset_gc_report();
+        embed.exec(garbage);
+
+        report = embed.gc_report();
+        BOOST_TEST(report.generations[0].pause.count > 0);
+        BOOST_TEST(report.generations[0].collected + report.generations[1].collected > 1000);
+        BOOST_TEST(embed.gc_freeze() > 0);
+        BOOST_TEST(embed.gc_report().frozen > 0);
+
+        embed.gc_unfreeze();
+        embed.set_gc_profiling(false);
+        embed.set_gc_thresholds(700);
+    }
+
+#ifdef __linux__
+    // perf: 执行过的Python函数出现在 /tmp/perf-{pid}.map 中，重新启用后依然保留
+    {
+        BOOST_TEST(pyembed::get().set_perf_profiling(true));
+        pyembed::get().exec(
+            "def perf_probe():   \n"
+            "    return 42       \n"
+            "perf_probe()        \n");
+        pyembed::get().set_perf_profiling(false);
+
+        // 重新启用后，已分配跳板的函数依然出现在映射文件中
+        BOOST_TEST(pyembed::get().set_perf_profiling(true));
+        pyembed::get().exec("perf_probe()");
+        pyembed::get().set_perf_profiling(false);
+
+        std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+        std::ifstream map(path);
+        std::string line;
+        bool found = false;
+        while (std::getline(map, line))
+            found |= line.find("py::perf_probe:") != std::string::npos;
+        BOOST_TEST(found);
+        map.close();
+        std::filesystem::remove(path);
+    }
+#endif
+
+    // trace: 入口、编译、GIL等待与Python函数调用写入 Chrome Trace Event 文件
+    {
+        auto path = std::filesystem::temp_directory_path() / "pyembed_trace.json";
+        pyembed::trace_options options;
+        options.path = path;
+        options.python_calls = true;
+        options.call_threshold = std::chrono::microseconds(0);
+        BOOST_TEST(pyembed::start_tracing(options));
+        BOOST_TEST(!pyembed::start_tracing(options));
+        {
+            pyembed::trace_scope span("app", "request");
+            pyembed::get().exec(
+                "def traced_probe():   \n"
+                "    return 42         \n"
+                "traced_probe()        \n");
+            pyembed::get().compile_expr("1 + 2");
+        }
+        {
+            pyembed::gil_release unlock;
+            std::thread([] {
+                pyembed::gil_acquire gil;
+                pyembed::get().eval("traced_probe()");
+            }).join();
+        }
+        BOOST_TEST(pyembed::flush_trace() > 0);
+        pyembed::stop_tracing();
+        BOOST_TEST(pyembed::flush_trace() == 0);
+
+        auto& space = pyembed::get().global();
+        space["trace_path"] = path.u8string();
+        pyembed::get().exec(
+            "import json                                                 \n"
+            "trace_events = json.load(open(trace_path))                  \n"
+            "trace_names = {e['name'].split(' ')[0] for e in trace_events}\n");
+        for (const char* name : { "request", "exec", "eval", "compile", "gil_wait", "traced_probe" })
+            BOOST_TEST(python::extract<bool>(pyembed::get().eval("'" + std::string(name) + "' in trace_names"))());
+        std::filesystem::remove(path);
+    }
+
+#ifndef _WIN32
+    // stacks: 不获取GIL输出各线程的调用栈，看门狗在调用超时后自动输出
+    {
+        std::FILE* file = std::tmpfile();
+        pyembed::get().exec(
+            "import time                 \n"
+            "def stuck_probe(seconds):   \n"
+            "    time.sleep(seconds)     \n");
+        pyembed::get().set_watchdog(std::chrono::milliseconds(50), fileno(file));
+        {
+            pyembed::gil_release unlock;
+            std::thread worker([] {
+                pyembed::gil_acquire gil;
+                pyembed::get().eval("stuck_probe(0.3)");
+            });
+            std::this_thread::sleep_for(std::chrono::milliseconds(150));
+            pyembed::dump_python_stacks(fileno(file));
+            worker.join();
+        }
+        pyembed::get().set_watchdog(std::chrono::milliseconds(0));
+
+        std::string content(4096, '\0');
+        std::rewind(file);
+        content.resize(std::fread(&content[0], 1, content.size(), file));
+        std::fclose(file);
+        BOOST_TEST(content.find("pyembed watchdog") != std::string::npos);
+        BOOST_TEST(content.find("stuck_probe") != content.rfind("stuck_probe"));
+
+        // 调用持有GIL超过期限，等待GIL的异常注入不能推迟看门狗
+        file = std::tmpfile();
+        watchdog_fd = fileno(file);
+        pyembed::get().local()["hold_gil"] = python::make_function(&hold_gil);
+        pyembed::get().set_watchdog(std::chrono::milliseconds(50), watchdog_fd);
+        {
+            pyembed::gil_release unlock;
+            std::thread worker([] {
+                pyembed::gil_acquire gil;
+                pyembed::pylimits limits;
+                limits.timeout = std::chrono::milliseconds(20);
+                try
+                {
+                    pyembed::get().exec("hold_gil(300)", {}, limits);
+                }
+                catch (const pyembed::timeout_error&)
+                {
+                }
+            });
+            worker.join();
+        }
+        pyembed::get().set_watchdog(std::chrono::milliseconds(0));
+        pyembed::get().local()["hold_gil"].del();
+        std::fclose(file);
+        BOOST_TEST(watchdog_fired);
+    }
+#endif
+
+    // context
+    {
+        pyembed::get().set_preamble(
+            "def double(x):     \n"
+            "    return x * 2   \n"
+            "def size(x):       \n"
+            "    return len(x)  \n");
+
+        auto tenant0 = pyembed::get().create_context("tenant0");
+        auto tenant1 = pyembed::get().create_context("tenant1");
+        pyembed::get().exec(tenant0, "value = double(21)");
+        pyembed::get().exec(tenant1, "value = 'tenant1'");
+
+        BOOST_TEST(python::extract<int>(tenant0->space["value"]) == 42);
+        BOOST_TEST(python::extract<std::string>(tenant1->space["value"])() == "tenant1");
+        BOOST_TEST(pyembed::get().get_context("tenant0") == tenant0);
+
+        // 修改内建层仅影响本上下文
+        pyembed::get().exec(tenant0, "__builtins__['len'] = None\n__builtins__['double'] = None");
+        BOOST_TEST(python::extract<int>(pyembed::get().eval(tenant1, "len([1, 2])")) == 2);
+        BOOST_TEST(python::extract<int>(pyembed::get().eval(tenant1, "double(2)")) == 4);
+        BOOST_TEST(python::extract<int>(pyembed::get().eval(tenant1, "size([1, 2, 3])")) == 3);
+        BOOST_TEST(python::extract<bool>(pyembed::get().eval(tenant0, "len is None"))());
+        pyembed::get().exec(tenant0, "__builtins__.update(__import__('builtins').__dict__)");
+
+        pyembed::get().remove_context("tenant1");
+        BOOST_TEST(pyembed::get().get_context("tenant1") == nullptr);
+
+        // snapshot & restore
+        pyembed::get().snapshot(tenant0);
+        pyembed::get().exec(tenant0, "value = 0\ntemporary = 1");
+        BOOST_TEST(pyembed::get().restore(tenant0));
+        BOOST_TEST(python::extract<int>(tenant0->space["value"]) == 42);
+        BOOST_TEST(!tenant0->space.has_key("temporary"));
+    }
+
+    // pool: 归还时恢复模板快照，按需扩容至上限，耗尽时等待
+    {
+        pyembed_pool::options options;
+        options.name = "pool_test";
+        options.prelude = "counter = 0\n";
+        options.min_size = 1;
+        options.max_size = 3;
+        options.idle_timeout = std::chrono::milliseconds(200);
+        pyembed_pool pool(pyembed::get(), options);
+        BOOST_TEST(pool.stats().size == 1);
+
+        {
+            auto lease = pool.checkout();
+            pyembed::get().exec(lease.get(), "counter += 1\nscratch = 1");
+            BOOST_TEST(python::extract<int>(lease->space["counter"]) == 1);
+        }
+        {
+            auto lease = pool.checkout();
+            BOOST_TEST(python::extract<int>(lease->space["counter"]) == 0);
+            BOOST_TEST(!lease->space.has_key("scratch"));
+        }
+
+        auto first = pool.checkout();
+        auto second = pool.checkout();
+        auto third = pool.checkout();
+        BOOST_TEST(pool.stats().size == 3);
+        BOOST_TEST(pool.stats().idle == 0);
+        const pyembed::context returned = third.get();
+        {
+            pyembed::gil_release unlock;
+            std::thread waiter([&] {
+                pyembed::gil_acquire gil;
+                auto lease = pool.checkout();
+                BOOST_TEST(lease.get() == returned);
+            });
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            {
+                pyembed::gil_acquire gil;
+                third = pyembed_pool::lease();
+            }
+            waiter.join();
+        }
+        BOOST_TEST(pool.stats().waits == 1);
+        BOOST_TEST(pool.stats().wait_total_ns > 0);
+
+        // 空闲超过 idle_timeout 后释放超出常驻数量的上下文
+        first = pyembed_pool::lease();
+        second = pyembed_pool::lease();
+        pool.shrink();
+        BOOST_TEST(pool.stats().size == 3);
+        BOOST_TEST(pool.stats().idle == 3);
+        {
+            pyembed::gil_release unlock;
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        }
+        pool.shrink();
+        BOOST_TEST(pool.stats().size == 1);
+
+        // 第二个上下文的模板代码失败，已创建的上下文及其预热动作被移除，回收时不再重放
+        bool threw = false;
+        try
+        {
+            options.name = "pool_broken";
+            options.min_size = 2;
+            options.prelude =
+                "import sys                                                     \n"
+                "sys.pool_builds = getattr(sys, 'pool_builds', 0) + 1           \n"
+                "if sys.pool_builds == 2: raise ValueError('broken prelude')    \n";
+            pyembed_pool broken(pyembed::get(), options);
+        }
+        catch (const std::runtime_error&)
+        {
+            threw = true;
+        }
+        BOOST_TEST(threw);
+        pyembed::get().recycle();
+        BOOST_TEST(python::extract<int>(python::import("sys").attr("pool_builds")) == 2);
+        python::import("sys").attr("__dict__")["pool_builds"].del();
+    }
+
+    // pool: 同名(默认名称)的池拥有各自的上下文，销毁其中一个不影响另一个
+    {
+        pyembed_pool::options options;
+        options.prelude = "owner = 'first'\n";
+        pyembed_pool first(pyembed::get(), options);
+        auto lease = first.checkout();
+        {
+            options.prelude = "owner = 'second'\n";
+            pyembed_pool second(pyembed::get(), options);
+            auto other = second.checkout();
+            BOOST_TEST(lease.get() != other.get());
+            BOOST_TEST(python::extract<std::string>(other->space["owner"])() == "second");
+        }
+        BOOST_TEST(pyembed::get().get_context(lease->name) == lease.get());
+        BOOST_TEST(python::extract<std::string>(lease->space["owner"])() == "first");
+    }
+
+    // timeout
+    {
+        pyembed::pylimits limits;
+        limits.timeout = std::chrono::milliseconds(50);
+
+        bool expired = false;
+        try
+        {
+            pyembed::get().exec("while True: pass", {}, limits);
+        }
+        catch (const pyembed::timeout_error&)
+        {
+            expired = true;
+        }
+        BOOST_TEST(expired);
+        BOOST_TEST(python::extract<int>(pyembed::get().eval("6 * 7", {}, limits)) == 42);
+    }
+
+    // watch_file: 文件变更后重新编译，编译失败时保留旧版本
+    {
+        auto path = std::filesystem::temp_directory_path() / "pyembed_watched.py";
+        std::ofstream(path) << "watched = 1\n";
+
+        std::string reported;
+        auto compiled = pyembed::get().watch_file(path, [&](const pyembed::pyerror& pyerr) {
+            reported = pyerr.format_exception();
+            return true;
+        });
+        BOOST_TEST(compiled && compiled->version() == 1);
+        pyembed::get().exec_file(compiled);
+        BOOST_TEST(python::extract<int>(pyembed::get().eval("watched")) == 1);
+
+        // 等待后台线程重新编译
+        auto wait_for = [&](const std::function<bool()>& done) {
+            pyembed::gil_release unlock;
+            for (int i = 0; i < 300 && !done(); ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        };
+
+        std::ofstream(path) << "watched = 2\n";
+        wait_for([&] { return compiled->version() == 2; });
+        BOOST_TEST(compiled->version() == 2);
+        pyembed::get().exec_file(compiled);
+        BOOST_TEST(python::extract<int>(pyembed::get().eval("watched")) == 2);
+
+        std::ofstream(path) << "watched = (\n";
+        wait_for([&] { return !compiled->last_error().empty(); });
+        BOOST_TEST(compiled->last_error().find("SyntaxError") != std::string::npos);
+        BOOST_TEST(reported == compiled->last_error());
+        BOOST_TEST(compiled->version() == 2);
+        pyembed::get().exec("watched = 0");
+        pyembed::get().exec_file(compiled);
+        BOOST_TEST(python::extract<int>(pyembed::get().eval("watched")) == 2);
+
+        pyembed::get().unwatch_file(compiled);
+        std::filesystem::remove(path);
+    }
+
+    // budget: 指令预算与CPU时间预算终止死循环，预算内的调用不受影响
+    {
+        auto exhausted = [](const pyembed::pylimits& limits) {
+            try
+            {
+                pyembed::get().exec("while True: pass", {}, limits);
+            }
+            catch (const pyembed::budget_error&)
+            {
+                return true;
+            }
+            return false;
+        };
+
+        pyembed::pylimits instructions;
+        instructions.max_instructions = 100000;
+        BOOST_TEST(exhausted(instructions));
+        BOOST_TEST(python::extract<int>(pyembed::get().eval("sum(range(100))", {}, instructions)) == 4950);
+
+        pyembed::pylimits cpu;
+        cpu.max_cpu_time = std::chrono::milliseconds(50);
+        BOOST_TEST(exhausted(cpu));
+        BOOST_TEST(python::extract<int>(pyembed::get().eval("sum(range(100))", {}, cpu)) == 4950);
+
+        // 脚本拦截预算异常后依然被终止
+        bool stopped = false;
+        try
+        {
+            pyembed::get().exec(
+                "while True:                    \n"
+                "    try:                       \n"
+                "        while True: pass       \n"
+                "    except BaseException:      \n"
+                "        pass                   \n", {}, instructions);
+        }
+        catch (const pyembed::budget_error&)
+        {
+            stopped = true;
+        }
+        BOOST_TEST(stopped);
+    }
+
+    // column: 零拷贝地暴露列，空值来自有效位图，字符串列经由字典解码，结果列经由缓冲区协议传回
+    {
+        auto owner = std::make_shared<std::vector<int64_t>>(std::vector<int64_t>{ 10, 20, 30, 40 });
+        const uint8_t validity[] = { 0x0b };   // 第3个元素为空
+        const int32_t codes[] = { 1, 0, 1, 1 };
+        const std::vector<std::string> dictionary = { "x", "y" };
+
+        pycolumn amount;
+        amount.data = owner->data();
+        amount.length = owner->size();
+        amount.validity = validity;
+        amount.owner = owner;
+
+        pycolumn tag;
+        tag.type = pyembed::pyvalue_type::string;
+        tag.data = codes;
+        tag.length = 4;
+        tag.dictionary = &dictionary;
+
+        auto ctx = pyembed::get().create_context("column");
+        ctx->space["t"] = pycolumn::table({ { "amount", amount }, { "tag", tag } });
+        auto eval = [&](const char* text) {
+            return python::extract<std::string>(python::str(pyembed::get().eval(ctx, text)))();
+        };
+
+        BOOST_TEST_EQ(eval("len(t['amount'])"), "4");
+        BOOST_TEST_EQ(eval("(t['amount'][0], t['amount'][-1])"), "(10, 40)");
+        BOOST_TEST_EQ(eval("list(t['amount'])"), "[10, 20, None, 40]");
+        BOOST_TEST_EQ(eval("t['amount'].null_count"), "1");
+        BOOST_TEST_EQ(eval("list(t['tag'])"), "['y', 'x', 'y', 'y']");
+        BOOST_TEST_EQ(eval("t['tag'].dictionary"), "('x', 'y')");
+
+        // memoryview 直接引用C++的缓冲区
+        pycolumn_buffer buffer;
+        buffer.acquire(pyembed::get().eval(ctx, "memoryview(t['amount'])"));
+        BOOST_TEST(buffer.column().data == owner->data());
+        BOOST_TEST_EQ(buffer.column().length, 4u);
+        BOOST_TEST(!buffer.column().validity);
+
+        // 列对象保留有效位图
+        buffer.acquire(pyembed::get().eval(ctx, "t['amount']"));
+        BOOST_TEST(buffer.column().data == owner->data());
+        BOOST_TEST(!buffer.column().valid(2));
+
+        // Python 计算的结果列
+        buffer.acquire(pyembed::get().eval(ctx,
+            "__import__('array').array('d', [v * 0.5 for v in t['amount'] if v is not None])"));
+        BOOST_TEST(buffer.column().type == pyembed::pyvalue_type::float64);
+        BOOST_TEST_EQ(buffer.column().length, 3u);
+        BOOST_TEST_EQ(static_cast<const double*>(buffer.column().data)[2], 20.0);
+        buffer.release();
+
+        // 不支持的元素格式
+        std::string message;
+        try
+        {
+            buffer.acquire(pyembed::get().eval(ctx, "__import__('array').array('i', [1])"));
+        }
+        catch (const python::error_already_set&)
+        {
+            PyObject* exc_type, * exc_value, * exc_traceback;
+            PyErr_Fetch(&exc_type, &exc_value, &exc_traceback);
+            message = python::extract<std::string>(python::str(python::object(python::handle<>(exc_value))));
+            Py_XDECREF(exc_type);
+            Py_XDECREF(exc_traceback);
+        }
+        BOOST_TEST_EQ(message, "unsupported buffer format 'i' for a column");
+
+        ctx->space.clear();
+        pyembed::get().remove_context("column");
+    }
+
+    // batch: 列式输入与结构体字段输入逐条求值，异常时返回已完成的记录数
+    {
+        struct order { int64_t qty; double price; std::string sku; };
+        const order orders[] = { { 2, 1.5, "a" }, { 3, 2.0, "b" }, { 0, 9.0, "c" }, { 4, 0.5, "d" } };
+        const int64_t discount[] = { 0, 1, 2, 3 };
+
+        double totals[4] = {};
+        size_t done = pyembed::get().eval_batch(
+            "qty * price - off",
+            { pyembed::field("qty", orders, &order::qty),
+              pyembed::field("price", orders, &order::price),
+              pyembed::column("off", discount) },
+            4, pyembed::output(totals));
+        BOOST_TEST_EQ(done, 4u);
+        BOOST_TEST_EQ(totals[0], 3.0);
+        BOOST_TEST_EQ(totals[1], 5.0);
+        BOOST_TEST_EQ(totals[2], -2.0);
+        BOOST_TEST_EQ(totals[3], -1.0);
+
+        std::string labels[4];
+        pyembed::get().exec("def label(sku, qty):\n    return sku * int(qty)");
+        done = pyembed::get().call_batch(
+            pyembed::get().global()["label"],
+            { pyembed::field("sku", orders, &order::sku),
+              pyembed::field("qty", orders, &order::qty) },
+            4, pyembed::output(labels));
+        BOOST_TEST_EQ(done, 4u);
+        BOOST_TEST_EQ(labels[0], "aa");
+        BOOST_TEST_EQ(labels[2], "");
+        BOOST_TEST_EQ(labels[3], "dddd");
+
+        // 第3条记录除零，处理器终止批次，返回值为出错记录的下标
+        std::string raised;
+        auto capture = [&](const pyembed::pyerror& pyerr) {
+            raised = python::extract<std::string>(pyerr.pytype.attr("__name__"));
+            return true;
+        };
+        double ratios[4] = {};
+        done = pyembed::get().eval_batch(
+            "price / qty", { pyembed::field("qty", orders, &order::qty), pyembed::field("price", orders, &order::price) },
+            4, pyembed::output(ratios), capture);
+        BOOST_TEST_EQ(done, 2u);
+        BOOST_TEST_EQ(raised, "ZeroDivisionError");
+        BOOST_TEST_EQ(ratios[1], 2.0 / 3.0);
+        BOOST_TEST_EQ(ratios[2], 0.0);
+
+        // 表达式结果与输出类型不符
+        raised.clear();
+        int64_t counts[4] = {};
+        done = pyembed::get().eval_batch(
+            "sku", { pyembed::field("sku", orders, &order::sku) }, 4, pyembed::output(counts), capture);
+        BOOST_TEST_EQ(done, 0u);
+        BOOST_TEST_EQ(raised, "TypeError");
+    }
+
+    // compile_expr: 原生求值与解释器的结果一致
+    {
+        const char* expressions[] = {
+            "a + b * 2 - c",
+            "a / b", "a // b", "a % b", "-a // 4", "-a % 4", "f // -0.75", "f % -0.75",
+            "a ** 2", "b ** -1", "f ** 0.5", "-f ** 2",
+            "t + t", "-t", "not a", "a and f", "c or t", "c or a and f",
+            "0 < a <= 10 < b * 10", "a == 5.0", "t == 1", "f != f",
+            "a if f > 1 else b", "(a - b) * 1e308 * 10",
+            "x * 2", "a * 9223372036854775807", "a / c", "-(-9223372036854775807 - 1)",
+        };
+
+        auto ctx = pyembed::get().create_context("expression");
+        pyembed::get().exec(ctx, "a, b, c, f, t, x = 5, -3, 0, 2.25, True, [1]");
+        auto repr = python::import("builtins").attr("repr");
+
+        for (const char* text : expressions)
+        {
+            auto compiled = pyembed::get().compile_expr(text);
+            BOOST_TEST(compiled);
+
+            std::string expected, actual;
+            auto describe = [&](std::string& out) {
+                return [&](const pyembed::pyerror& pyerr) {
+                    out = python::extract<std::string>(pyerr.pytype.attr("__name__"));
+                    return true;
+                };
+            };
+
+            auto value = pyembed::get().eval(ctx, text, describe(expected));
+            if (expected.empty())
+                expected = python::extract<std::string>(repr(value));
+
+            value = pyembed::get().eval(ctx, compiled, describe(actual));
+            if (actual.empty())
+                actual = python::extract<std::string>(repr(value));
+
+            BOOST_TEST_EQ(expected, actual);
+        }
+
+        BOOST_TEST(pyembed::get().compile_expr("a + b")->native());
+        BOOST_TEST(!pyembed::get().compile_expr("len(x)")->native());
+        pyembed::get().remove_context("expression");
+    }
+
     // exec_test_error
     {
         auto result = pyembed::get().exec("print(unknown) \n");
     }
 
+    // redirect: 默认在释放GIL的状态下调用重定向接口，关闭后持有GIL
+    {
+        auto& sink = pyembed::get<pyembed_sink>();
+        pyembed::get().exec("import sys\nsys.stdout.write('redirect\\n')");
+        BOOST_TEST(sink.gil_held == 0);
+        pyembed::get().exec("sys.stderr.write('redirect\\n')");
+        BOOST_TEST(sink.gil_held == 0);
+        BOOST_TEST(python::extract<std::string>(pyembed::get().eval("sys.stdin.readline()"))() == "pyembed\n");
+        BOOST_TEST(sink.gil_held == 0);
+
+        pyembed::get().set_redirect_gil_release(false);
+        pyembed::get().exec("sys.stdout.write('redirect\\n')");
+        BOOST_TEST(sink.gil_held == 1);
+        pyembed::get().exec("sys.stderr.write('redirect\\n')");
+        BOOST_TEST(sink.gil_held == 1);
+        pyembed::get().eval("sys.stdin.readline()");
+        BOOST_TEST(sink.gil_held == 1);
+        pyembed::get().set_redirect_gil_release(true);
+    }
+
+    // recycle: 命名空间与初始化后导入的模块被清除，预热动作被重放
+    {
+        auto tenant = pyembed::get().create_context("recycled");
+        pyembed::get().add_warmup(tenant, [](const pyembed::context& ctx) {
+            pyembed::get().exec(ctx, "import fractions\nhalf = fractions.Fraction(1, 2)");
+        });
+        pyembed::get().exec(tenant, "import fractions\nhalf = fractions.Fraction(1, 2)\nfractions.junk = 1\nscratch = 1");
+
+        auto result = pyembed::get().recycle();
+        BOOST_TEST(result.modules > 0);
+        BOOST_TEST(python::extract<bool>(pyembed::get().eval(tenant, "half == 0.5"))());
+        BOOST_TEST(!python::extract<bool>(pyembed::get().eval(tenant, "hasattr(fractions, 'junk')"))());
+        BOOST_TEST(!tenant->space.has_key("scratch"));
+        BOOST_TEST(python::extract<int>(pyembed::get().eval(tenant, "double(21)")) == 42);
+        pyembed::get().remove_context("recycled");
+
+        // 含有扩展子模块的包整体保留，纯Python的包被清除
+        auto packages = std::filesystem::temp_directory_path() / "pyembed_recycle";
+        std::filesystem::create_directories(packages / "hostpkg");
+        std::filesystem::create_directories(packages / "purepkg");
+        std::ofstream(packages / "hostpkg" / "__init__.py") << "from . import _json, helper\n";
+        std::ofstream(packages / "hostpkg" / "helper.py") << "value = 1\n";
+        std::ofstream(packages / "purepkg" / "__init__.py") << "value = 1\n";
+        std::string native = python::extract<std::string>(pyembed::get().eval(
+            "__import__('importlib.util').util.find_spec('_json').origin"));
+        if (native.size() > 3 && native.substr(native.size() - 3) == ".so")
+        {
+            // 扩展模块的初始化函数由文件名决定，因此保留原文件名
+            std::filesystem::copy_file(native, packages / "hostpkg" / std::filesystem::path(native).filename());
+
+            python::object sys = python::import("sys");
+            sys.attr("path").attr("insert")(0, packages.string());
+            python::object host = python::import("hostpkg");
+            python::import("purepkg");
+
+            pyembed::get().recycle();
+            python::dict modules = python::extract<python::dict>(sys.attr("modules"));
+            BOOST_TEST(modules.get("hostpkg") == host);
+            BOOST_TEST(modules.has_key("hostpkg._json"));
+            BOOST_TEST(modules.has_key("hostpkg.helper"));
+            BOOST_TEST(!modules.has_key("purepkg"));
+            sys.attr("path").attr("remove")(packages.string());
+        }
+        std::filesystem::remove_all(packages);
+
+        // 借出池中的上下文期间推迟自动回收
+        pyembed::pyrecycle_policy policy;
+        policy.max_jobs = 1;
+        pyembed::get().set_recycle_policy(policy);
+        {
+            pyembed_pool::options opts;
+            opts.name = "recycle-pool";
+            opts.prelude = "seed = 1";
+            pyembed_pool pool(pyembed::get(), opts);
+
+            auto leased = pool.checkout();
+            pyembed::get().exec(leased.get(), "x = seed + 1");
+            pyembed::get().exec("marker = 1");
+            BOOST_TEST(python::extract<int>(pyembed::get().eval(leased.get(), "x")) == 2);
+            BOOST_TEST(pyembed::get().global().has_key("marker"));
+            leased = pyembed_pool::lease();
+
+            pyembed::get().eval("0");
+            BOOST_TEST(!pyembed::get().global().has_key("marker"));
+            leased = pool.checkout();
+            BOOST_TEST(python::extract<int>(pyembed::get().eval(leased.get(), "seed")) == 1);
+        }
+
+        // 回收后常驻内存仍超出上限时，不在每次采样时反复回收
+        auto sample = [] {
+            pyembed::gil_release unlock;
+            std::this_thread::sleep_for(std::chrono::milliseconds(120));
+        };
+        policy = pyembed::pyrecycle_policy();
+        policy.max_rss = 1;
+        pyembed::get().set_recycle_policy(policy);
+        sample();
+        pyembed::get().exec("marker = 1");
+        BOOST_TEST(!pyembed::get().global().has_key("marker"));
+        pyembed::get().exec("marker = 1");
+        sample();
+        pyembed::get().exec("pass");
+        BOOST_TEST(pyembed::get().global().has_key("marker"));
+        pyembed::get().set_recycle_policy({});
+
+        // 多个线程同时回收，回收释放GIL期间其他线程设置策略、登记预热动作
+        auto racing = pyembed::get().create_context("racing");
+        std::atomic<int> finished{ 0 };
+        {
+            pyembed::gil_release unlock;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < 2; ++i)
+            {
+                threads.emplace_back([&] {
+                    pyembed::gil_acquire gil;
+                    for (int k = 0; k < 5; ++k)
+                        pyembed::get().recycle();
+                    ++finished;
+                });
+            }
+            threads.emplace_back([&] {
+                pyembed::gil_acquire gil;
+                for (int k = 0; k < 200; ++k)
+                {
+                    pyembed::get().set_recycle_policy({});
+                    pyembed::get().add_warmup(racing, [](const pyembed::context&) {});
+                }
+                ++finished;
+            });
+            for (auto& thread : threads)
+                thread.join();
+        }
+        BOOST_TEST(finished == 3);
+        pyembed::get().remove_context("racing");
+    }
+
     // Boost.Python doesn't support Py_Finalize yet.
     // Py_Finalize();
     return boost::report_errors();
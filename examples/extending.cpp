@@ -3,6 +3,8 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
 #include "pyembed.h"
+#include "pyembed_fastcall.h"
+#include "pyembed_struct.h"
 #include <boost/python/class.hpp>
 #include <boost/python/module.hpp>
 #include <boost/python/def.hpp>
@@ -25,6 +27,19 @@ namespace { // Avoid cluttering the global namespace.
   std::string invite(const hello& w) {
     return w.greet() + "! Please come soon!";
   }
+
+  // A plain struct whose fields are read and written from Python.
+  struct location
+  {
+    double latitude = 0;
+    double longitude = 0;
+    std::string label;
+  };
+
+  // A small helper called from tight loops.
+  double scale(double value, int64_t factor) {
+    return value * factor;
+  }
 }
 
 BOOST_PYTHON_MODULE(extending)
@@ -39,6 +54,16 @@ BOOST_PYTHON_MODULE(extending)
     
     // Also add invite() as a regular function to the module.
     def("invite", invite);
+
+    // Bind the hot helper through METH_FASTCALL.
+    def_fast<&scale>("scale");
+
+    // Expose the struct fields as slot-style member descriptors.
+    pystruct<location>::def("location", {
+        pystruct<location>::field<&location::latitude>("latitude"),
+        pystruct<location>::field<&location::longitude>("longitude"),
+        pystruct<location>::field<&location::label>("label"),
+    });
 }
 
 int main(int argc, char* argv[])
@@ -22,6 +22,20 @@ r'''>>> from extending import *
     'Hello from Florida, where the weather is fine'
     >>> invite(hi2)
     'Hello from Florida! Please come soon!'
+
+    >>> scale(1.5, 4)
+    6.0
+    >>> scale(1.5)
+    Traceback (most recent call last):
+    ...
+    TypeError: scale() takes 2 positional arguments but 1 were given
+
+    >>> here = location(36.5, -121.75, label='Monterey')
+    >>> here.latitude, here.longitude, here.label
+    (36.5, -121.75, 'Monterey')
+    >>> here.latitude += 1
+    >>> here.latitude
+    37.5
 '''
 
 def run(args = None):
@@ -54,16 +54,12 @@ public:
     // 并未处理编码转换，因此遇到中文时会出现乱码。
     void write_stdout(const std::string& str) override
     {
-        Py_BEGIN_ALLOW_THREADS
         std::cout << str;
-        Py_END_ALLOW_THREADS
     }
 
     void write_stderr(const std::string& str) override
     {
-        Py_BEGIN_ALLOW_THREADS
         std::cerr << str;
-        Py_END_ALLOW_THREADS
     }
 };
 
@@ -34,6 +34,18 @@
 #endif // PYEMBED_BUILD_SHARED_LIB
 
 
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <typeinfo>
+#include <stdexcept>
+#include <type_traits>
+#include <functional>
 #include <filesystem>
 #include <boost/python.hpp>
 
@@ -48,16 +60,28 @@ class pyembed
 protected:
     PYEMBED_LIB explicit pyembed(const std::type_info& type);
     PYEMBED_LIB static   pyembed* get_ptr();
+    PYEMBED_LIB static   void set_ptr(pyembed* instance);
+    PYEMBED_LIB static   std::mutex& get_mutex();
 
 public:
     //! @brief 用于获得pyembed实例的便捷函数
-    //! @note  1. 线程不安全，应当在进入多线程之前获取实例
+    //! @note  1. 线程安全，实例仅被创建一次(双重检查，已创建后仅有一次原子读取)
     //!        2. 由于GCC不支持在友元声明中加入默认模板参数，所以这里修改为静态方法
     template<class T = pyembed>
     static T& get() {
-        if (T::get_ptr() == nullptr)
-            new T(typeid(T));
-        return static_cast<T&>(*T::get_ptr());
+        pyembed* instance = T::get_ptr();
+        if (instance == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(T::get_mutex());
+            instance = T::get_ptr();
+            if (instance == nullptr)
+            {
+                // 构造完成(包括子类)后才发布，其他线程不会看到未构造完成的实例
+                instance = new T(typeid(T));
+                T::set_ptr(instance);
+            }
+        }
+        return static_cast<T&>(*instance);
     }
 
     PYEMBED_LIB virtual ~pyembed();
@@ -68,13 +92,39 @@ public:
     //! @brief 初始化解释器
     //! @param pyhome 指定Python的家目录，即标准Python库的位置，参考：Py_SetPythonHome()。
     //! @param initsigs 指定是否注册信号处理器，当作为嵌入解释器时，可能不希望执行绪被 Ctrl+C 中断。
+    //! @param perf_profiling 是否开启 perf 分析支持，参考 set_perf_profiling()。
     //! @note 该方法没有返回值，初始化失败是致命错误，将立即终止程序!
-    PYEMBED_LIB void init(const std::filesystem::path& pyhome = "", bool initsigs = true);
+    PYEMBED_LIB void init(
+        const std::filesystem::path& pyhome = "", 
+        bool initsigs = true, 
+        bool perf_profiling = false);
+
+    //! @brief 开启或关闭 Linux perf 分析支持，使 perf 的调用栈中显示Python函数而非 _PyEval_EvalFrameDefault
+    //! @return 返回 perf 分析支持是否处于开启状态
+    //! @note 1. 3.12及以上版本使用解释器的 perf trampoline(sys.activate_stack_trampoline("perf"))。
+    //!       2. 3.9~3.11 版本由 pyembed 为每个执行的代码对象生成原生跳板函数，
+    //!          并写入 /tmp/perf-{pid}.map，fork 出的子进程将写入自己的映射文件。
+    //!       3. 仅支持 Linux(x86-64、AArch64)，不支持时返回false并输出到错误输出。
+    //!       4. 开启后Python函数之间的调用不再内联，调用开销有所增加。
+    PYEMBED_LIB bool set_perf_profiling(bool enabled);
 
     //! @brief 模拟发送SIGINT信号到解释器。
     //! @note 解释器如果没有注册信号处理器则无法被SIGINT信号中断。
     PYEMBED_LIB void interrupt();
 
+    //! @brief 将所有Python线程的调用栈写入文件描述符，格式与 faulthandler.dump_traceback() 相同
+    //! @param fd 文件描述符，如 2(标准错误)
+    //! @note 1. 不获取GIL，由解释器逐帧遍历各线程状态，是异步信号安全的，可在信号处理函数中调用。
+    //!       2. 遍历期间其他线程仍在执行，输出的调用栈可能不完整；每个线程最多输出100帧，最多100个线程。
+    PYEMBED_LIB static void dump_python_stacks(int fd);
+
+    //! @brief 设置看门狗，(最外层的)调用执行超过给定时长时将所有Python线程的调用栈写入 fd
+    //! @param threshold 时长，不大于0时关闭
+    //! @param fd 文件描述符，默认为标准错误
+    //! @note 由独立的线程每隔半个时长检查一次，不获取GIL，因此调用阻塞在持有GIL的C代码中时同样会输出；
+    //!       超时的调用最多输出一次，不中断调用。
+    PYEMBED_LIB void set_watchdog(std::chrono::milliseconds threshold, int fd = 2);
+
     //! @brief 添加初始化时导入解释器的内建模块
     //! @param name 模块名
     //! @param initfunc 模块初始化函数，形式为: PyInit_{name}。
@@ -105,6 +155,59 @@ public:
     PYEMBED_LIB void register_exception_handler(
         const std::function<bool(std::function<void()>)>& handler);
 
+    //! 异常转换表中的条目，参考 register_exception_translator()
+    struct pytranslator
+    {
+        PyObject* pytype = nullptr;     //!< 转换后的Python异常类型
+
+        //! 在catch块中调用，重新抛出当前异常并尝试以注册的类型捕获，成功则输出描述并返回true
+        std::function<bool(std::string& message)> rethrow;
+
+        //! 注册的类型派生自std::exception时，直接由异常对象得到描述，无需重新抛出
+        std::function<std::string(const std::exception& e)> describe;
+    };
+
+    //! @brief 注册C++异常类型到Python异常类型的转换
+    //! @param pytype 转换后的Python异常类型，如 PyExc_ValueError 或 PyErr_NewException() 创建的类型，将被一直持有
+    //! @param message 生成异常描述的函数，为空时使用 std::exception::what()，非std::exception的类型则没有描述
+    //! @note 1. 所有转换器共用一张以异常的动态类型为键的转换表，并作为一个整体加入boost.python的
+    //!          异常处理链，命中时仅需一次查表，不会逐层重新抛出异常。
+    //!       2. 派生类型首次出现时按注册的逆序匹配基类的转换器(即后注册的优先)，结果将被缓存。
+    //!       3. 需持有GIL，通常在 init() 之后、执行脚本之前注册。
+    template<class E>
+    void register_exception_translator(
+        PyObject* pytype,
+        const std::function<std::string(const E&)>& message = {})
+    {
+        auto describe = [message](const E& e) -> std::string {
+            if (message)
+                return message(e);
+            if constexpr (std::is_base_of<std::exception, E>::value)
+                return e.what();
+            return std::string();
+        };
+
+        pytranslator translator;
+        translator.pytype = pytype;
+        translator.rethrow = [describe](std::string& text) -> bool {
+            try { throw; }
+            catch (const E& e) { text = describe(e); return true; }
+            catch (...) { return false; }
+        };
+        if constexpr (std::is_base_of<std::exception, E>::value)
+        {
+            translator.describe = [describe](const std::exception& e) {
+                return describe(dynamic_cast<const E&>(e));
+            };
+        }
+        register_exception_translator(typeid(E), translator);
+    }
+
+    //! @brief 注册异常转换表中的条目，参考 register_exception_translator<E>()
+    PYEMBED_LIB void register_exception_translator(
+        const std::type_info& type,
+        const pytranslator& translator);
+
     struct pyerror
     {
         boost::python::object pytype;       //!< 异常类型     (PyTypeObject*)
@@ -116,25 +219,63 @@ public:
         PYEMBED_LIB std::string format_exception() const;
     };
 
+    //! 调用限制
+    struct pylimits
+    {
+        pylimits() : timeout(0), max_instructions(0), max_cpu_time(0) { }
+
+        //! 超时时间，0表示不限制。
+        //! 超时后将向执行调用的线程注入异常(pyembed.Timeout，派生自BaseException)，
+        //! 不依赖信号处理器，也不会影响其他线程上的调用。
+        //! @note 1. 异常只能在解释器执行字节码时触发，阻塞在C扩展中的调用需等待其返回。
+        //!       2. 到期由时间轮判定，注入由独立的线程获取GIL后完成，停滞的调用不会推迟其他调用的期限。
+        std::chrono::milliseconds timeout;
+
+        //! 可执行的字节码指令数量上限，0表示不限制，超出后抛出 pyembed.BudgetExceeded。
+        //! 通过跟踪钩子(PyEval_SetTrace，3.12+由sys.monitoring实现)逐条计数，结果是确定的，
+        //! 但开启后解释器需要逐条派发跟踪事件，开销参考 examples/benchmark.cpp。
+        uint64_t max_instructions;
+
+        //! 调用线程可消耗的CPU时间上限，0表示不限制，超出后注入 pyembed.BudgetExceeded。
+        //! 由时间轮线程采样调用线程的CPU时钟，仅计算本线程的消耗，没有跟踪钩子的开销。
+        std::chrono::milliseconds max_cpu_time;
+    };
+
+    //! 调用超出 pylimits::timeout 时抛出的异常
+    struct timeout_error : public std::runtime_error
+    {
+        using std::runtime_error::runtime_error;
+    };
+
+    //! 调用超出 pylimits::max_instructions 或 pylimits::max_cpu_time 时抛出的异常
+    struct budget_error : public std::runtime_error
+    {
+        using std::runtime_error::runtime_error;
+    };
+
     //! @brief 计算给定表达式的值并返回结果值
     //! @param expression Python 表达式(utf-8)
     //! @param exception_handler 异常处理器，解释器触发(python)异常时被调用，签名如下：
     //!     bool(const pyembed::pyerror& pyerr);
     //!     返回true表示异常已处理，false将打印到错误输出。
+    //! @param limits 调用限制，超出时抛出异常(pyembed::timeout_error 或 pyembed::budget_error)
     //! @return 返回计算结果值
     PYEMBED_LIB boost::python::object eval(
         const std::string& expression,
-        const std::function<bool(const pyerror&)>& exception_handler = {});
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
 
     //! @brief 执行给定的代码（通常是一组表达式）并返回结果
     //! @param snippets Python 代码片段(utf-8)
     //! @param exception_handler 异常处理器，解释器触发(python)异常时被调用，签名如下：
     //!     bool(const pyembed::pyerror& pyerr);
     //!     返回true表示异常已处理，false将打印到错误输出。
+    //! @param limits 调用限制，超出时抛出异常(pyembed::timeout_error 或 pyembed::budget_error)
     //! @return 返回值总是None
     PYEMBED_LIB boost::python::object exec(
         const std::string& snippets,
-        const std::function<bool(const pyerror&)>& exception_handler = {});
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
 
     //! @brief 执行包含在给定文件中的代码并返回结果
     //! @param script 文件名, 文件不存在则抛出异常(filesystem::filesystem_error)
@@ -142,44 +283,681 @@ public:
     //! @param exception_handler 异常处理器，解释器触发(python)异常时被调用，签名如下：
     //!     bool(const pyembed::pyerror& pyerr);
     //!     返回true表示异常已处理，false将打印到错误输出。
+    //! @param limits 调用限制，超出时抛出异常(pyembed::timeout_error 或 pyembed::budget_error)
     //! @return 返回值总是None
     PYEMBED_LIB boost::python::object exec_file(
         const std::filesystem::path& script,
         const std::vector<std::string>& args = {},
-        const std::function<bool(const pyerror&)>& exception_handler = {});
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
 
     //! @brief 用于执行可能抛出python异常的代码, 如果触发则通过exception_handler处理
     //! @param action 闭包
     //! @param exception_handler 异常处理器，解释器触发(python)异常时被调用，签名如下：
     //!     bool(const pyembed::pyerror& pyerr);
     //!     返回true表示异常已处理，false将打印到错误输出。
+    //! @param limits 调用限制，超出时抛出异常(pyembed::timeout_error 或 pyembed::budget_error)
     PYEMBED_LIB void exec_for(
         const std::function<void()>& action,
-        const std::function<bool(const pyerror&)>& exception_handler = {});
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! 获取GIL的作用域对象，可在任意线程上使用，用于替代 PyGILState_Ensure/Release
+    //!
+    //! 当前线程已持有GIL时为空操作，因此可以嵌套；否则恢复本线程的线程状态(PyThreadState)。
+    //! 非Python创建的线程首次获取时创建线程状态并缓存，直到线程退出才释放，
+    //! 而 PyGILState_Release 在计数归零时即销毁线程状态，下次进入需重新创建。
+    //! @note 1. 需在 init() 后使用。
+    //!       2. pyembed 的公开接口已在内部获取GIL，但返回的 boost::python::object
+    //!          仍需在持有GIL时使用与析构，因此通常在线程函数中先构造该对象。
+    class gil_acquire
+    {
+    public:
+        PYEMBED_LIB gil_acquire();
+
+        //! @param entry 入口名(须为静态字符串)，开启 set_gil_profiling() 后按入口统计等待与持有时间
+        //! @param detail 入口执行的脚本、表达式或可调用对象的描述，用于 gil_contention::top，
+        //!        须在本对象的生命周期内有效，可为空
+        PYEMBED_LIB explicit gil_acquire(const char* entry, const std::string* detail = nullptr);
+        PYEMBED_LIB ~gil_acquire();
+
+        gil_acquire(const gil_acquire&) = delete;
+        gil_acquire& operator=(const gil_acquire&) = delete;
+
+    private:
+        PyThreadState*      _state;     // 由本对象恢复的线程状态，为空表示进入时已持有GIL
+        const char*         _entry;
+        const std::string*  _detail;
+        int64_t             _started;   // 开始持有GIL的时间(纳秒)，0表示未开启统计
+        uint64_t            _released;  // 开始持有时本线程累计释放GIL的时间(纳秒)
+        int64_t             _traced;    // 入口区间的开始时间(纳秒)，0表示未开启追踪
+    };
+
+    //! 释放GIL的作用域对象，用于替代 Py_BEGIN_ALLOW_THREADS/Py_END_ALLOW_THREADS
+    //! 在阻塞操作(I/O、等待等)期间让其他线程执行Python代码，当前线程未持有GIL时为空操作。
+    class gil_release
+    {
+    public:
+        PYEMBED_LIB gil_release();
+        PYEMBED_LIB ~gil_release();
+
+        gil_release(const gil_release&) = delete;
+        gil_release& operator=(const gil_release&) = delete;
+
+    private:
+        PyThreadState* _state;      // 释放前的线程状态，为空表示进入时未持有GIL
+        int64_t        _started;    // 开始释放GIL的时间(纳秒)，0表示未开启统计
+    };
+
+    //! GIL的获取统计(进程内累计)
+    struct gil_statistics
+    {
+        uint64_t acquires;  //!< gil_acquire 实际获取GIL的次数
+        uint64_t nested;    //!< gil_acquire 进入时已持有GIL(空操作)的次数
+        uint64_t releases;  //!< gil_release 实际释放GIL的次数
+        uint64_t threads;   //!< 为非Python线程创建并缓存的线程状态数量
+    };
+
+    //! @brief 获取GIL的获取统计
+    PYEMBED_LIB static gil_statistics gil_stats();
+
+    //! 耗时直方图(纳秒)，按2的幂分桶
+    struct gil_histogram
+    {
+        uint64_t count;         //!< 样本数量
+        uint64_t total_ns;      //!< 累计耗时
+        uint64_t max_ns;        //!< 最长耗时
+        uint64_t buckets[48];   //!< buckets[i] 为耗时在 [2^i, 2^(i+1)) 纳秒内的样本数量
+
+        //! @brief 估算分位数(0~1)，返回所在分桶的上界(纳秒)
+        uint64_t percentile(double p) const {
+            uint64_t rank = uint64_t(p * count), seen = 0;
+            for (int i = 0; i < 48; ++i)
+            {
+                seen += buckets[i];
+                if (seen > rank)
+                    return std::min(uint64_t(1) << (i + 1), max_ns);
+            }
+            return max_ns;
+        }
+    };
+
+    //! 线程或入口的GIL等待/持有时间
+    struct gil_profile
+    {
+        std::string   name;     //!< 线程名("thread {native_id}")或入口名
+        gil_histogram wait;     //!< 获取GIL的等待时间，已持有GIL(嵌套)时不计
+        gil_histogram hold;     //!< 持有GIL的时间，不含其中通过 gil_release 释放的时间
+                                //!< 解释器按 sys.getswitchinterval() 在线程间切换GIL，该部分无法观测，计入持有时间
+    };
+
+    //! 单次持有GIL的记录
+    struct gil_holder
+    {
+        uint64_t    hold_ns;    //!< 持有时间
+        std::string entry;      //!< 入口名
+        std::string detail;     //!< 脚本文件、表达式(首行)或可调用对象
+        std::string thread;     //!< 线程名
+    };
+
+    //! GIL争用报告
+    struct gil_contention
+    {
+        std::vector<gil_profile> threads;   //!< 按线程
+        std::vector<gil_profile> entries;   //!< 按入口
+        std::vector<gil_holder>  top;       //!< 持有GIL最久的调用，按持有时间降序
+
+        //! @brief 格式化为文本，每行一个线程、入口或调用
+        PYEMBED_LIB std::string format() const;
+    };
+
+    //! @brief 开启或关闭GIL争用统计，默认关闭
+    //! @note 开启后每次获取GIL增加两次时钟读取与若干次原子累加，直方图的记录是无锁的。
+    PYEMBED_LIB static void set_gil_profiling(bool enabled);
+
+    //! @brief 获取GIL争用报告
+    PYEMBED_LIB static gil_contention gil_report();
+
+    //! @brief 清空GIL争用统计
+    //! @note 与正在进行的记录并发时，个别样本可能未被清除。
+    PYEMBED_LIB static void reset_gil_report();
+
+    //! @brief 设置各代的回收阈值(gc.set_threshold())，小于0的参数保持不变
+    //! @note 提高第0代的阈值可减少回收次数，但单次回收的暂停时间随之变长。
+    PYEMBED_LIB void set_gc_thresholds(int gen0, int gen1 = -1, int gen2 = -1);
+
+    //! @brief 启用或禁用自动回收(gc.enable()/gc.disable())
+    //! @return 返回之前是否启用
+    PYEMBED_LIB bool set_gc_enabled(bool enabled);
+
+    //! @brief 回收给定代及更年轻的代(gc.collect())
+    //! @return 返回发现的不可达对象数量
+    //! @note 可在请求之间调用，以免请求执行期间触发回收。
+    PYEMBED_LIB size_t gc_collect(int generation = 2);
+
+    //! @brief 冻结当前存活的对象(gc.freeze())，此后的回收不再遍历这些对象
+    //! @param collect 是否在冻结前进行一次完整回收，避免冻结已不可达的对象
+    //! @return 返回被冻结的对象总数(gc.get_freeze_count())
+    //! @note 通常在预热(导入模块、执行预热代码)后调用；在fork前调用还可避免子进程复制共享的内存页。
+    PYEMBED_LIB size_t gc_freeze(bool collect = true);
+
+    //! @brief 解冻被冻结的对象(gc.unfreeze())，它们将被移入最老的一代
+    PYEMBED_LIB void gc_unfreeze();
+
+    //! 在作用域内禁用自动回收，用于延迟敏感的代码段
+    //! @note 可嵌套，也可在多个线程中同时使用，最后一个退出的作用域恢复进入前的状态。
+    //!       作用域内分配的对象会推高各代计数，退出后的首次分配可能立即触发回收，
+    //!       必要时在请求之间调用 gc_collect()。
+    class gc_suspend
+    {
+    public:
+        PYEMBED_LIB gc_suspend();
+        PYEMBED_LIB ~gc_suspend();
+
+        gc_suspend(const gc_suspend&) = delete;
+        gc_suspend& operator=(const gc_suspend&) = delete;
+    };
+
+    //! 一代的回收统计
+    struct gc_generation
+    {
+        int           threshold;        //!< 回收阈值(gc.get_threshold())
+        int           count;            //!< 当前计数(gc.get_count())
+        uint64_t      collected;        //!< 回收的对象数量
+        uint64_t      uncollectable;    //!< 无法回收的对象数量
+        gil_histogram pause;            //!< 每次回收的暂停时间
+    };
+
+    //! 垃圾回收报告，回收数量与暂停时间在开启 set_gc_profiling() 后记录
+    struct gc_statistics
+    {
+        bool          enabled;          //!< 是否启用自动回收
+        size_t        frozen;           //!< 被冻结的对象数量
+        gc_generation generations[3];   //!< 第0、1、2代
+
+        //! @brief 格式化为文本，每行一代
+        PYEMBED_LIB std::string format() const;
+    };
+
+    //! @brief 开启或关闭回收暂停统计，默认关闭
+    //! @note 通过 gc.callbacks 记录每次回收的开始与结束，不影响回收以外的执行。
+    PYEMBED_LIB void set_gc_profiling(bool enabled);
+
+    //! @brief 获取垃圾回收报告
+    PYEMBED_LIB gc_statistics gc_report();
+
+    //! @brief 清空回收暂停统计
+    PYEMBED_LIB void reset_gc_report();
+
+    //! 时间线追踪的选项
+    struct trace_options
+    {
+        std::filesystem::path     path;                 //!< 输出文件，Chrome Trace Event 格式(JSON数组)
+        bool                      gil_waits = true;     //!< 是否记录获取GIL的等待
+        bool                      python_calls = false; //!< 是否记录Python函数调用
+        std::chrono::microseconds call_threshold{ 100 };//!< 仅记录耗时不低于该值的函数调用
+    };
+
+    //! @brief 开始时间线追踪，记录入口(eval/exec/exec_file/调用等)、编译、GIL等待、
+    //!        标准流重定向的输出以及Python函数调用的时间区间
+    //! @return 已在追踪或无法创建输出文件时返回false
+    //! @note 1. 区间记录在各线程独占的缓冲区中(无锁)，由 flush_trace() 或 stop_tracing() 写入文件，
+    //!          可由 chrome://tracing 或 Perfetto 打开。
+    //!       2. 时间戳取自 std::chrono::steady_clock，C++代码中的区间可由 trace_scope 记录到同一时间线。
+    //!       3. Python函数调用通过 PyEval_SetProfile 记录，仅对经由 gil_acquire 进入的线程生效；
+    //!          每次调用都进入记录函数，密集调用短小函数的代码可能慢数倍。
+    PYEMBED_LIB static bool start_tracing(const trace_options& options);
+
+    //! @brief 将已记录的区间写入文件
+    //! @return 返回写入的区间数量
+    PYEMBED_LIB static size_t flush_trace();
+
+    //! @brief 停止追踪，写入剩余的区间并关闭文件
+    PYEMBED_LIB static void stop_tracing();
+
+    //! 记录时间区间的作用域对象，未开启追踪时为空操作
+    class trace_scope
+    {
+    public:
+        //! @param category 分类(须为静态字符串)
+        //! @param name 区间名(须为静态字符串)
+        //! @param detail 区间的描述(取首行)，须在本对象的生命周期内有效，可为空
+        PYEMBED_LIB trace_scope(const char* category, const char* name, const std::string* detail = nullptr);
+        PYEMBED_LIB ~trace_scope();
+
+        trace_scope(const trace_scope&) = delete;
+        trace_scope& operator=(const trace_scope&) = delete;
+
+    private:
+        const char*        _category;
+        const char*        _name;
+        const std::string* _detail;
+        int64_t            _started;    // 0表示未开启追踪
+    };
+
+    //! 批量计算的元素类型
+    enum class pyvalue_type
+    {
+        int64,      //!< int64_t
+        float64,    //!< double
+        boolean,    //!< bool
+        string,     //!< std::string(utf-8)
+    };
+
+    template<class T>
+    static constexpr pyvalue_type pyvalue_type_of()
+    {
+        static_assert(
+            std::is_same<T, int64_t>::value || std::is_same<T, double>::value ||
+            std::is_same<T, bool>::value || std::is_same<T, std::string>::value,
+            "Batch evaluation supports int64_t, double, bool and std::string only");
+
+        if (std::is_same<T, int64_t>::value)
+            return pyvalue_type::int64;
+        if (std::is_same<T, double>::value)
+            return pyvalue_type::float64;
+        if (std::is_same<T, bool>::value)
+            return pyvalue_type::boolean;
+        return pyvalue_type::string;
+    }
+
+    //! 批量计算的输入，可以是列式数组，也可以是结构体数组中的字段
+    struct pyfield
+    {
+        std::string  name;      //!< 变量名
+        pyvalue_type type;      //!< 元素类型
+        const void*  data;      //!< 首个元素的地址
+        size_t       stride;    //!< 相邻元素的间隔(字节)
+    };
+
+    //! 批量计算的输出缓冲区，由调用方预先分配
+    struct pyoutput
+    {
+        pyvalue_type type;      //!< 元素类型
+        void*        data;      //!< 首个元素的地址
+        size_t       stride;    //!< 相邻元素的间隔(字节)
+    };
+
+    //! @brief 以列式数组作为输入
+    template<class T>
+    static pyfield column(const std::string& name, const T* data) {
+        return { name, pyvalue_type_of<T>(), data, sizeof(T) };
+    }
+
+    //! @brief 以结构体数组中的字段作为输入
+    template<class S, class T>
+    static pyfield field(const std::string& name, const S* records, T S::* member) {
+        return { name, pyvalue_type_of<T>(), &(records->*member), sizeof(S) };
+    }
+
+    //! @brief 以数组作为输出
+    template<class T>
+    static pyoutput output(T* data) {
+        return { pyvalue_type_of<T>(), data, sizeof(T) };
+    }
+
+    //! @brief 对count条记录批量计算同一个表达式
+    //! @param expression Python 表达式(utf-8)，仅编译一次，通过 pyfield::name 引用每条记录的字段
+    //! @param fields 输入字段
+    //! @param count 记录数量
+    //! @param output 输出缓冲区，至少容纳count个元素
+    //! @param exception_handler 异常处理器，参考 eval()
+    //! @param limits 调用限制，作用于整个批次
+    //! @return 返回成功计算的记录数量，触发异常时停止计算
+    //! @note 整个批次仅获取一次GIL，并复用同一个局部命名空间，全局命名空间为 global()。
+    PYEMBED_LIB size_t eval_batch(
+        const std::string& expression,
+        const std::vector<pyfield>& fields,
+        size_t count,
+        const pyoutput& output,
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! @brief 对count条记录批量调用同一个可调用对象
+    //! @param callable 可调用对象，每条记录的字段按 fields 的顺序作为位置参数传入
+    //! @return 返回成功计算的记录数量，触发异常时停止计算
+    //! @note 参考 eval_batch()
+    PYEMBED_LIB size_t call_batch(
+        const boost::python::object& callable,
+        const std::vector<pyfield>& fields,
+        size_t count,
+        const pyoutput& output,
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
 
     //! @brief 获得解释器的全局或局部上下文
     //! @return 返回全局上下文的字典对象
     PYEMBED_LIB boost::python::dict& global();
     PYEMBED_LIB boost::python::dict& local();
 
+    //! 驻留的命名空间键，通常经由 PYEMBED_KEY() 在每个调用点缓存
+    //! 字符串对象在首次使用时创建并驻留，其哈希值由字符串对象缓存，此后访问命名空间无需再分配或计算哈希。
+    class pykey
+    {
+    public:
+        //! @note 需持有GIL。
+        explicit pykey(const char* name) : _name(name), _str(PyUnicode_InternFromString(name)) {
+            if (!_str)
+                boost::python::throw_error_already_set();
+        }
+
+        // 与驻留字符串一样有意不释放，因为静态对象析构时不一定持有GIL
+        ~pykey() = default;
+
+        pykey(const pykey&) = delete;
+        pykey& operator=(const pykey&) = delete;
+
+        const char* name() const { return _name; }
+        PyObject* ptr() const { return _str; }
+
+    private:
+        const char* _name;
+        PyObject*   _str;
+    };
+
+    //! @brief 读取命名空间中的变量
+    //! @param space 命名空间，如 global()、local() 或 pycontext::space
+    //! @return 变量不存在时抛出异常(boost::python::error_already_set，KeyError)
+    PYEMBED_LIB static boost::python::object getitem(
+        const boost::python::dict& space,
+        const pykey& key);
+
+    //! @brief 读取命名空间中的变量，不存在时返回 fallback
+    PYEMBED_LIB static boost::python::object getitem(
+        const boost::python::dict& space,
+        const pykey& key,
+        const boost::python::object& fallback);
+
+    //! @brief 写入命名空间中的变量
+    PYEMBED_LIB static void setitem(
+        boost::python::dict& space,
+        const pykey& key,
+        const boost::python::object& value);
+
+    template<class T>
+    static void setitem(boost::python::dict& space, const pykey& key, const T& value) {
+        setitem(space, key, boost::python::object(value));
+    }
+
     //! @brief 清除解释器状态
     //! @note 实际上pyembed仅清除了global与local上下文环境对象。
     PYEMBED_LIB void clean();
 
+    //! 命名执行上下文
+    //! 每个上下文拥有独立的命名空间(同时作为global与local)，
+    //! 所有上下文的内建/预置层(__builtins__)来自同一份模板，每个上下文持有其浅副本，
+    //! 脚本对 __builtins__ 的修改仅影响本上下文。
+    struct pycontext
+    {
+        std::string         name;   //!< 上下文名称
+        boost::python::dict space;  //!< 命名空间
+        boost::python::object image;//!< 命名空间快照，参考 snapshot()
+    };
+    typedef std::shared_ptr<pycontext> context;
+
+    //! @brief 设置所有上下文共享的预置代码(如导入常用模块、定义辅助函数)
+    //! @param snippets Python 代码片段(utf-8)，其定义的名字将合并到共享的内建层中
+    //! @param exception_handler 异常处理器，参考 exec()
+    //! @return 成功返回true，否则false(共享层保持不变)
+    //! @note 新的共享层对已创建的上下文同样生效。
+    PYEMBED_LIB bool set_preamble(
+        const std::string& snippets,
+        const std::function<bool(const pyerror&)>& exception_handler = {});
+
+    //! @brief 创建命名执行上下文
+    //! @param name 上下文名称，若同名上下文已存在则直接返回该上下文
+    //! @return 返回上下文对象
+    //! @note 该方法应该在init()后调用。
+    PYEMBED_LIB context create_context(const std::string& name);
+
+    //! @brief 获取命名执行上下文
+    //! @return 返回上下文对象，不存在则返回nullptr
+    PYEMBED_LIB context get_context(const std::string& name);
+
+    //! @brief 移除命名执行上下文
+    //! @note 已持有该上下文的调用方仍可继续使用，直到其释放。
+    PYEMBED_LIB void remove_context(const std::string& name);
+
+    //! @brief 在给定的上下文中计算表达式，参考 eval()
+    PYEMBED_LIB boost::python::object eval(
+        const context& ctx,
+        const std::string& expression,
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! @brief 在给定的上下文中执行代码，参考 exec()
+    PYEMBED_LIB boost::python::object exec(
+        const context& ctx,
+        const std::string& snippets,
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! @brief 在给定的上下文中执行脚本文件，参考 exec_file()
+    PYEMBED_LIB boost::python::object exec_file(
+        const context& ctx,
+        const std::filesystem::path& script,
+        const std::vector<std::string>& args = {},
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! @brief 清除给定上下文的命名空间，仅保留共享的内建层
+    PYEMBED_LIB void clean(const context& ctx);
+
+    //! @brief 捕获命名空间的快照，通常在完成导入、辅助函数定义等准备工作后调用
+    //! @param ctx 上下文，为空则表示默认的global上下文
+    //! @note 快照为浅拷贝，它记录的是键与值对象的引用。
+    PYEMBED_LIB void snapshot(const context& ctx = nullptr);
+
+    //! @brief 将命名空间重置为快照时的状态，用于替代 clean() 后重新执行准备代码
+    //! @param ctx 上下文，为空则表示默认的global上下文
+    //! @return 成功返回true，没有快照或恢复失败则返回false
+    //! @note 1. 遍历整个命名空间逐项比较键与值的指针，开销为 O(命名空间的大小)而非 O(被修改的键)；
+    //!          只对新增、删除或重新绑定过的键执行写入，因此相比重新执行准备代码仍然廉价。
+    //!       2. 对可变对象(如list、dict、模块属性)的原地修改不会被撤销。
+    PYEMBED_LIB bool restore(const context& ctx = nullptr);
+
+    //! 解释器的回收策略，满足任一条件时在调用结束后自动回收，参考 recycle()
+    struct pyrecycle_policy
+    {
+        size_t                   max_rss = 0;       //!< 常驻内存(RSS)上限(字节)，0表示不限制，每100毫秒最多采样一次；
+                                                    //!< 回收后仍不低于上限时，改为以回收后的常驻内存为基线，增长超过25%才再次回收
+        uint64_t                 max_jobs = 0;      //!< 调用次数上限(仅计最外层调用)，0表示不限制
+        std::chrono::seconds     max_age{ 0 };      //!< 距上次回收(或初始化)的时间上限，0表示不限制
+        std::vector<std::string> keep_modules{ "threading" }; //!< 回收时保留的模块(含其子模块)，含有扩展子模块的包总是保留
+    };
+
+    //! 回收的结果
+    struct pyrecycle_result
+    {
+        size_t modules;         //!< 清除的模块数量
+        size_t rss_before;      //!< 回收前的常驻内存(字节)，无法获取时为0
+        size_t rss_after;       //!< 回收并重放预热动作后的常驻内存(字节)，无法获取时为0
+    };
+
+    //! @brief 设置回收策略，默认不自动回收
+    //! @note 自动回收仅在没有其他调用正在执行时进行，条件满足但有调用正在执行时将推迟到之后的调用结束。
+    PYEMBED_LIB void set_recycle_policy(const pyrecycle_policy& policy);
+
+    //! @brief 推迟自动回收，直到对应的 resume_recycle() 被调用
+    //! @note 可嵌套，用于跨越多次调用持有上下文的场景，如 pyembed_pool 借出上下文期间。
+    PYEMBED_LIB void defer_recycle();
+    PYEMBED_LIB void resume_recycle();
+
+    //! @brief 登记预热动作，每次回收后按登记顺序重放(登记时不执行)
+    //! @param ctx 预热的上下文，为空表示默认上下文；上下文不再被引用后其预热动作随之失效
+    //! @param warmup 预热动作，在持有GIL时以 ctx 作为参数调用，抛出的异常将打印到错误输出
+    PYEMBED_LIB void add_warmup(
+        const context& ctx,
+        const std::function<void(const context&)>& warmup);
+
+    //! @brief 回收解释器：重置所有命名空间，清除初始化后导入的Python模块，执行完整的垃圾回收并
+    //!        将空闲内存归还给操作系统，然后重放 set_preamble() 的预置代码与 add_warmup() 的预热动作
+    //! @return 返回回收的结果
+    //! @note 1. boost.python不支持 Py_Finalize()，也不支持子解释器，因此回收在同一个解释器中进行；
+    //!          内建模块(包括 append_inittab() 注册的模块)与扩展模块无法卸载，将保持导入状态，无需重新注册；
+    //!          含有扩展子模块的包(如numpy)整体保留。
+    //!       2. 已创建的上下文保留(名称与对象不变)，其命名空间被重置，快照被丢弃。
+    //!       3. 应在没有其他调用正在执行时调用，如请求的间隙。
+    //!       4. 多个线程同时调用时依次回收，等待期间释放GIL；在预热动作中调用将被忽略(结果全为0)。
+    PYEMBED_LIB pyrecycle_result recycle();
+
+    //! 预编译的脚本，由 compile_file() 或 watch_file() 创建
+    class pyscript
+    {
+    public:
+        //! 脚本文件(绝对路径)
+        const std::filesystem::path& path() const { return _path; }
+
+        //! 代码对象的版本，每次成功(重新)编译后递增
+        uint64_t version() const { return _version.load(); }
+
+        //! 最近一次编译失败的描述(utf-8)，编译成功后清空
+        std::string last_error() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _error;
+        }
+
+    private:
+        friend class pyembed;
+        friend class pyembed_private;
+
+        std::filesystem::path                   _path;
+        std::shared_ptr<boost::python::object>  _code;      // 通过 std::atomic_load/store 原子替换
+        std::atomic<uint64_t>                   _version{ 0 };
+        std::function<bool(const pyerror&)>     _handler;   // 重新编译失败时的异常处理器
+        mutable std::mutex                      _mutex;
+        std::string                             _error;
+    };
+    typedef std::shared_ptr<pyscript> script;
+
+    //! @brief 预编译脚本文件，避免每次执行时重新编译
+    //! @param file 文件名, 文件不存在则抛出异常(filesystem::filesystem_error)
+    //! @param exception_handler 异常处理器，编译失败(如SyntaxError)时被调用，参考 exec()
+    //! @return 返回脚本对象，编译失败返回nullptr
+    PYEMBED_LIB script compile_file(
+        const std::filesystem::path& file,
+        const std::function<bool(const pyerror&)>& exception_handler = {});
+
+    //! @brief 预编译脚本文件并监视其变更(热重载)
+    //! @param file 文件名, 文件不存在则抛出异常(filesystem::filesystem_error)
+    //! @param exception_handler 异常处理器，编译失败时被调用，参考 exec()
+    //! @return 返回脚本对象，首次编译失败返回nullptr
+    //! @note 1. 文件变更后由后台线程重新编译，仅在编译期间持有GIL，成功后原子地替换代码对象，
+    //!          正在执行旧版本的调用不受影响。
+    //!       2. 重新编译失败时保留旧版本，并在后台线程上调用 exception_handler 报告错误。
+    //!       3. Linux下通过inotify监视，无法使用时(如达到 max_user_instances 的上限)向标准错误输出原因，
+    //!          并改为每500毫秒比较一次文件的修改时间。
+    PYEMBED_LIB script watch_file(
+        const std::filesystem::path& file,
+        const std::function<bool(const pyerror&)>& exception_handler = {});
+
+    //! @brief 停止监视脚本文件的变更
+    PYEMBED_LIB void unwatch_file(const script& compiled);
+
+    //! @brief 执行预编译的脚本，参考 exec_file()
+    PYEMBED_LIB boost::python::object exec_file(
+        const script& compiled,
+        const std::vector<std::string>& args = {},
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! @brief 在给定的上下文中执行预编译的脚本，参考 exec_file()
+    PYEMBED_LIB boost::python::object exec_file(
+        const context& ctx,
+        const script& compiled,
+        const std::vector<std::string>& args = {},
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! 预编译的表达式，由 compile_expr() 创建
+    //!
+    //! 表达式仅由数值/布尔常量、变量、算术(+ - * / // % **)、一元(+ - ~ not)、
+    //! 比较(含链式比较)、布尔(and or)及条件表达式组成时，将被编译为原生求值树，
+    //! 求值时不经过解释器；其余表达式以及无法原生计算的情形(如变量不是 int/float/bool、
+    //! 整数溢出、除零)回退到解释器执行预编译的代码对象，结果与 eval() 一致。
+    class pyexpression
+    {
+    public:
+        //! 表达式文本(utf-8)
+        const std::string& text() const { return _text; }
+
+        //! 表达式是否已被编译为原生求值树
+        bool native() const { return _program != nullptr; }
+
+        //! 回退到解释器的次数
+        uint64_t fallbacks() const { return _fallbacks.load(std::memory_order_relaxed); }
+
+    private:
+        friend class pyembed;
+
+        std::string                                 _text;
+        boost::python::object                       _code;
+        std::shared_ptr<const class pyexpr_program> _program;   // 原生求值树，为空表示仅能由解释器计算
+        mutable std::atomic<uint64_t>               _fallbacks{ 0 };
+    };
+    typedef std::shared_ptr<pyexpression> expression;
+
+    //! @brief 预编译表达式，通过 ast 解析一次并尝试编译为原生求值树
+    //! @param expression Python 表达式(utf-8)
+    //! @param exception_handler 异常处理器，编译失败(如SyntaxError)时被调用，参考 eval()
+    //! @return 返回表达式对象，编译失败返回nullptr
+    PYEMBED_LIB expression compile_expr(
+        const std::string& expression,
+        const std::function<bool(const pyerror&)>& exception_handler = {});
+
+    //! @brief 计算预编译的表达式，参考 eval()
+    //! @note 原生求值时变量依次在 local() 与 global() 中查找。
+    PYEMBED_LIB boost::python::object eval(
+        const expression& compiled,
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! @brief 在给定的上下文中计算预编译的表达式，参考 eval()
+    PYEMBED_LIB boost::python::object eval(
+        const context& ctx,
+        const expression& compiled,
+        const std::function<bool(const pyerror&)>& exception_handler = {},
+        const pylimits& limits = {});
+
+    //! @brief 设置调用重定向接口(readline_stdin/write_stdout/write_stderr)期间是否释放GIL，默认释放
+    //! @param release 为true时，内容已复制为std::string，调用期间释放GIL，
+    //!        缓慢的日志输出或阻塞的标准输入不会使其他Python线程停顿；
+    //!        重定向接口需要访问Python对象时设置为false(或在接口中使用 gil_acquire)。
+    //! @note 释放GIL后，多个Python线程可能同时调用重定向接口，接口须自行保证线程安全。
+    PYEMBED_LIB void set_redirect_gil_release(bool release);
+
     //! @brief sys.stdin.readline()的重定向接口
     //! @param size 要输入的字节数
-    //! @note pyembed默认不会启动重定向机制，除非通过子类化并重写虚函数。
+    //! @note 1. pyembed默认不会启动重定向机制，除非通过子类化并重写虚函数。
+    //!       2. 默认在释放GIL的状态下调用，参考 set_redirect_gil_release()。
     PYEMBED_LIB virtual std::string readline_stdin(int size = -1);
 
     //! @brief sys.stdout.write()的重定向接口
     //! @param str 输出的内容，utf-8编码
-    //! @note pyembed默认不会启动重定向机制，除非通过子类化并重写虚函数。
+    //! @note 1. pyembed默认不会启动重定向机制，除非通过子类化并重写虚函数。
+    //!       2. 默认在释放GIL的状态下调用，参考 set_redirect_gil_release()。
     PYEMBED_LIB virtual void write_stdout(const std::string& str);
 
     //! @brief sys.stderr.write()的重定向接口
     //! @param size 要输入的字节数
-    //! @note pyembed默认不会启动重定向机制，除非通过子类化并重写虚函数。
+    //! @note 1. pyembed默认不会启动重定向机制，除非通过子类化并重写虚函数。
+    //!       2. 默认在释放GIL的状态下调用，参考 set_redirect_gil_release()。
     PYEMBED_LIB virtual void write_stderr(const std::string& str);
 };
 
+//! @brief 声明扩展模块不依赖GIL，在 BOOST_PYTHON_MODULE 中调用
+//! @note 自由线程(free-threaded)构建中，导入未作声明的扩展模块将重新启用GIL；其他构建中为空操作。
+#ifdef Py_GIL_DISABLED
+#   define PYEMBED_MODULE_GIL_NOT_USED() \
+        PyUnstable_Module_SetGIL(boost::python::scope().ptr(), Py_MOD_GIL_NOT_USED)
+#else
+#   define PYEMBED_MODULE_GIL_NOT_USED() ((void)0)
+#endif
+
+//! @brief 在调用点缓存驻留的命名空间键，例如：
+//!     pyembed::setitem(pyembed::get().global(), PYEMBED_KEY("price"), 9.5);
+//! @note 首次执行时创建，需持有GIL。
+#define PYEMBED_KEY(name) \
+    ([]() -> const pyembed::pykey& { static const pyembed::pykey key(name); return key; }())
+
 #endif // pyembed_h__
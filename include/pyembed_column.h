@@ -0,0 +1,103 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#ifndef pyembed_column_h__
+#define pyembed_column_h__
+
+#include "pyembed.h"
+
+//!
+//! 列式数据，在C++与Python之间零拷贝地传递表格数据
+//! 
+//! 暴露给Python的列对象(pyembed.column)直接引用C++的缓冲区，支持 len()、下标、迭代
+//! 以及缓冲区协议(memoryview)，因此不会为每个单元格分配Python对象。
+//! 
+struct pycolumn
+{
+    pyembed::pyvalue_type type = pyembed::pyvalue_type::int64;
+
+    //! 值缓冲区: int64_t / double / bool，字符串列为字典编码的索引(int32_t)
+    const void* data = nullptr;
+
+    //! 元素数量
+    size_t length = 0;
+
+    //! 有效位图(与Arrow一致: 第i个元素对应第 i/8 个字节的第 i%8 位，1表示有效)，为空表示全部有效
+    const uint8_t* validity = nullptr;
+
+    //! 字符串列的字典(utf-8)
+    const std::vector<std::string>* dictionary = nullptr;
+
+    //! 缓冲区的所有者，Python对象存活期间将一直持有，为空则由调用方保证缓冲区的生命周期
+    std::shared_ptr<const void> owner;
+
+    //! @brief 判断第index个元素是否有效
+    bool valid(size_t index) const {
+        return !validity || (validity[index >> 3] >> (index & 7)) & 1;
+    }
+
+    //! @brief 以零拷贝的方式暴露为Python的列对象(pyembed.column)
+    //! @note 需持有GIL。
+    PYEMBED_LIB boost::python::object to_python() const;
+
+    //! @brief 将多个列组合为Python的表格(列名到列对象的字典)
+    //! @note 需持有GIL。
+    PYEMBED_LIB static boost::python::dict table(
+        const std::vector<std::pair<std::string, pycolumn>>& columns);
+};
+
+//!
+//! 从Python获取的列，以零拷贝的方式引用Python对象的缓冲区
+//! 
+//! 支持 pyembed.column 以及任何实现了缓冲区协议的一维C连续对象，
+//! 元素格式须为 'q'/'l'(int64)、'd'(double) 或 '?'(bool)。
+//! 
+//! 只有 pyembed.column 能带回有效位图与字符串字典；Python 计算出的结果列(如 array.array、
+//! numpy 数组)仅携带值缓冲区，因此无法表示空值，字符串列也无法传回。
+//! 
+class pycolumn_buffer
+{
+public:
+    pycolumn_buffer() = default;
+    PYEMBED_LIB ~pycolumn_buffer();
+
+    pycolumn_buffer(const pycolumn_buffer&) = delete;
+    pycolumn_buffer& operator=(const pycolumn_buffer&) = delete;
+
+    //! @brief 获取Python对象的缓冲区
+    //! @note 需持有GIL，失败时抛出异常(boost::python::error_already_set)，
+    //!       通常在 pyembed::exec_for() 中调用。
+    PYEMBED_LIB void acquire(const boost::python::object& obj);
+
+    //! @brief 释放缓冲区
+    //! @note 需持有GIL，析构时将自动释放。
+    PYEMBED_LIB void release();
+
+    const pycolumn& column() const { return _column; }
+
+private:
+    pycolumn              _column;
+    boost::python::object _object;
+    Py_buffer             _view = {};
+    bool                  _acquired = false;
+};
+
+#endif // pyembed_column_h__
@@ -0,0 +1,273 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pyembed_fastcall_h__
+#define pyembed_fastcall_h__
+
+#include "pyembed.h"
+
+#include <tuple>
+#include <limits>
+#include <utility>
+
+//!
+//! METH_FASTCALL 绑定
+//! 
+//! def_fast<&fn>("name") 在编译期展开参数的转换，生成以 METH_FASTCALL 调用的蹦床函数，
+//! 调用时不经过 boost.python 的重载决议与转换器注册表，适用于在循环中被频繁调用的简单函数。
+//! 
+//! 支持的参数类型: 整数、浮点数、bool、std::string(const&)、const char*、
+//!                boost::python::object(const&)、PyObject*(借用引用)
+//! 支持的返回类型: void、上述值类型、boost::python::object、PyObject*(新引用)
+//! 
+//! C++异常与 boost.python 的绑定一样经由异常处理链转换为Python异常，
+//! 参考 pyembed::register_exception_handler() 与 pyembed::register_exception_translator()。
+//! 
+namespace pyfastcall
+{
+    //! 参数转换，失败时设置Python异常并返回false
+    template<class T, class Enable = void>
+    struct arg
+    {
+        static_assert(sizeof(T) == 0, "def_fast: unsupported argument type");
+    };
+
+    template<class T>
+    struct arg<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+    {
+        T value;
+        bool from(PyObject* obj)
+        {
+            if (std::is_signed<T>::value)
+            {
+                long long v = PyLong_AsLongLong(obj);
+                if (v == -1 && PyErr_Occurred())
+                    return false;
+                if (v < (long long)std::numeric_limits<T>::min() || v > (long long)std::numeric_limits<T>::max())
+                {
+                    PyErr_SetString(PyExc_OverflowError, "integer out of range");
+                    return false;
+                }
+                value = T(v);
+            }
+            else
+            {
+                unsigned long long v = PyLong_AsUnsignedLongLong(obj);
+                if (v == (unsigned long long)-1 && PyErr_Occurred())
+                    return false;
+                if (v > (unsigned long long)std::numeric_limits<T>::max())
+                {
+                    PyErr_SetString(PyExc_OverflowError, "integer out of range");
+                    return false;
+                }
+                value = T(v);
+            }
+            return true;
+        }
+        T get() const { return value; }
+    };
+
+    template<class T>
+    struct arg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+    {
+        T value;
+        bool from(PyObject* obj)
+        {
+            double v = PyFloat_AsDouble(obj);
+            if (v == -1.0 && PyErr_Occurred())
+                return false;
+            value = T(v);
+            return true;
+        }
+        T get() const { return value; }
+    };
+
+    template<>
+    struct arg<bool>
+    {
+        bool value;
+        bool from(PyObject* obj)
+        {
+            int v = PyObject_IsTrue(obj);
+            if (v < 0)
+                return false;
+            value = v != 0;
+            return true;
+        }
+        bool get() const { return value; }
+    };
+
+    template<>
+    struct arg<std::string>
+    {
+        std::string value;
+        bool from(PyObject* obj)
+        {
+            Py_ssize_t size = 0;
+            const char* str = PyUnicode_AsUTF8AndSize(obj, &size);
+            if (!str)
+                return false;
+            value.assign(str, size);
+            return true;
+        }
+        const std::string& get() const { return value; }
+    };
+
+    template<>
+    struct arg<const char*>
+    {
+        const char* value;
+        bool from(PyObject* obj)
+        {
+            value = PyUnicode_AsUTF8(obj); // 由字符串对象持有
+            return value != nullptr;
+        }
+        const char* get() const { return value; }
+    };
+
+    template<>
+    struct arg<boost::python::object>
+    {
+        PyObject* value;
+        bool from(PyObject* obj) { value = obj; return true; }
+        boost::python::object get() const {
+            return boost::python::object(boost::python::handle<>(boost::python::borrowed(value)));
+        }
+    };
+
+    template<>
+    struct arg<PyObject*>
+    {
+        PyObject* value;
+        bool from(PyObject* obj) { value = obj; return true; }
+        PyObject* get() const { return value; }
+    };
+
+    //! 返回值转换，返回新引用，失败时返回nullptr
+    template<class T>
+    PyObject* result(const T& value)
+    {
+        if constexpr (std::is_same<T, bool>::value)
+            return PyBool_FromLong(value);
+        else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value)
+            return PyLong_FromLongLong(value);
+        else if constexpr (std::is_integral<T>::value)
+            return PyLong_FromUnsignedLongLong(value);
+        else if constexpr (std::is_floating_point<T>::value)
+            return PyFloat_FromDouble(value);
+        else if constexpr (std::is_same<T, std::string>::value)
+            return PyUnicode_FromStringAndSize(value.data(), value.size());
+        else if constexpr (std::is_same<T, const char*>::value)
+            return PyUnicode_FromString(value);
+        else if constexpr (std::is_same<T, boost::python::object>::value)
+            return boost::python::incref(value.ptr());
+        else if constexpr (std::is_same<T, PyObject*>::value)
+            return value;
+        else
+            static_assert(sizeof(T) == 0, "def_fast: unsupported return type");
+    }
+
+    template<class F>
+    struct traits;
+
+    template<class R, class... Args>
+    struct traits<R(*)(Args...)>
+    {
+        typedef R result_type;
+        typedef std::tuple<arg<typename std::decay<Args>::type>...> arguments;
+        static constexpr Py_ssize_t arity = sizeof...(Args);
+    };
+
+    template<class R, class... Args>
+    struct traits<R(*)(Args...) noexcept> : traits<R(*)(Args...)> {};
+
+    template<auto F, size_t... I>
+    PyObject* invoke(PyObject* const* args, std::index_sequence<I...>)
+    {
+        typedef traits<decltype(F)> traits_type;
+        typename traits_type::arguments unpacked;
+
+        // 依次转换，任一失败则停止
+        bool converted = (std::get<I>(unpacked).from(args[I]) && ...);
+        if (!converted)
+            return nullptr;
+
+        if constexpr (std::is_void<typename traits_type::result_type>::value)
+        {
+            F(std::get<I>(unpacked).get()...);
+            Py_RETURN_NONE;
+        }
+        else
+            return result(F(std::get<I>(unpacked).get()...));
+    }
+
+    //! METH_FASTCALL 蹦床函数，self 为函数名(用于错误描述)
+    template<auto F>
+    PyObject* trampoline(PyObject* self, PyObject* const* args, Py_ssize_t nargs)
+    {
+        typedef traits<decltype(F)> traits_type;
+        if (nargs != traits_type::arity)
+        {
+            PyErr_Format(PyExc_TypeError, "%U() takes %zd positional arguments but %zd were given",
+                self, traits_type::arity, nargs);
+            return nullptr;
+        }
+
+        try
+        {
+            return invoke<F>(args, std::make_index_sequence<traits_type::arity>());
+        }
+        catch (...)
+        {
+            boost::python::handle_exception();
+            return nullptr;
+        }
+    }
+} // namespace pyfastcall
+
+//! @brief 以 METH_FASTCALL 将函数添加到当前作用域(boost::python::scope)
+//! @param name 函数名
+//! @param doc 文档字符串，须具有静态存储期
+//! @note 通常在 BOOST_PYTHON_MODULE 中调用，可与 boost::python::def()、class_ 混合使用。
+template<auto F>
+void def_fast(const char* name, const char* doc = nullptr)
+{
+    static_assert(std::is_pointer<decltype(F)>::value, "def_fast: F must be a function pointer");
+
+    namespace bp = boost::python;
+    bp::object pyname(bp::handle<>(PyUnicode_InternFromString(name)));
+
+    // 方法定义须在函数对象的生命周期内有效，而扩展函数与模块同生命周期
+    auto* def = new PyMethodDef{
+        PyUnicode_AsUTF8(pyname.ptr()),
+        reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(&pyfastcall::trampoline<F>)),
+        METH_FASTCALL,
+        doc
+    };
+
+    bp::scope current;
+    bp::object module_name = bp::getattr(current, "__name__", bp::object());
+    bp::object function(bp::handle<>(PyCFunction_NewEx(def, pyname.ptr(), module_name.ptr())));
+    bp::setattr(current, pyname, function);
+}
+
+#endif // pyembed_fastcall_h__
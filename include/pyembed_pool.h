@@ -0,0 +1,144 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#ifndef pyembed_pool_h__
+#define pyembed_pool_h__
+
+#include "pyembed.h"
+
+#include <atomic>
+#include <chrono>
+
+//!
+//! 预热的执行上下文池
+//! 
+//! 池中的上下文由模板代码初始化并捕获快照(pyembed::snapshot())，
+//! 归还时自动恢复(pyembed::restore())，因此请求处理过程中无需构建上下文。
+//! 解释器回收(pyembed::recycle())后，池中的上下文将重新执行模板代码并捕获快照；
+//! 有上下文被借出期间自动回收将被推迟(pyembed::defer_recycle())。
+//! 
+class pyembed_pool
+{
+public:
+    struct options
+    {
+        std::string name = "pool";              //!< 上下文名称前缀，实际名称为 "{name}@{serial}#{index}"，serial 为池的序号
+        std::string prelude;                    //!< 模板代码片段(utf-8)
+        std::filesystem::path prelude_file;     //!< 模板脚本文件，在模板代码片段之后执行
+        size_t min_size = 1;                    //!< 常驻(预热)的上下文数量
+        size_t max_size = 8;                    //!< 上下文数量上限
+        std::chrono::milliseconds idle_timeout{ 30000 }; //!< 超出常驻数量的上下文空闲多久后被释放
+    };
+
+    struct statistics
+    {
+        uint64_t checkouts;     //!< 借出次数
+        uint64_t waits;         //!< 因池已满而等待的次数
+        uint64_t wait_total_ns; //!< 累计等待时间(纳秒)
+        uint64_t wait_max_ns;   //!< 最长等待时间(纳秒)
+        size_t   size;          //!< 当前上下文数量
+        size_t   idle;          //!< 当前空闲的上下文数量
+    };
+
+    //! 借出的上下文，析构时自动归还
+    class lease
+    {
+    public:
+        lease() = default;
+        lease(lease&& other) noexcept { swap(other); }
+        lease& operator=(lease&& other) noexcept { 
+            lease(std::move(other)).swap(*this); 
+            return *this; 
+        }
+        ~lease() { 
+            if (_pool) _pool->checkin(_index); 
+        }
+
+        lease(const lease&) = delete;
+        lease& operator=(const lease&) = delete;
+
+        const pyembed::context& get() const { return _ctx; }
+        const pyembed::context& operator->() const { return _ctx; }
+        explicit operator bool() const { return _pool != nullptr; }
+
+    private:
+        friend class pyembed_pool;
+        lease(pyembed_pool* pool, size_t index, pyembed::context ctx)
+            : _pool(pool), _index(index), _ctx(std::move(ctx))
+        { }
+
+        void swap(lease& other) noexcept {
+            std::swap(_pool, other._pool);
+            std::swap(_index, other._index);
+            std::swap(_ctx, other._ctx);
+        }
+
+        pyembed_pool*    _pool  = nullptr;
+        size_t           _index = 0;
+        pyembed::context _ctx;
+    };
+
+    //! @brief 创建上下文池并预热 options::min_size 个上下文
+    //! @note 该方法应该在 pyembed::init() 后调用，模板代码执行失败或上下文名称已被占用将抛出异常(std::runtime_error)。
+    PYEMBED_LIB pyembed_pool(pyembed& embed, const options& opts);
+    PYEMBED_LIB ~pyembed_pool();
+
+    pyembed_pool(const pyembed_pool&) = delete;
+    pyembed_pool& operator=(const pyembed_pool&) = delete;
+
+    //! @brief 借出一个上下文
+    //! @note 1. 选取空闲上下文的过程是无锁的；没有空闲上下文且未达上限时将新建一个，
+    //!          达到上限则等待其他线程归还(等待期间释放GIL)。
+    //!       2. 新建上下文需要执行模板代码，失败将抛出异常(std::runtime_error)。
+    PYEMBED_LIB lease checkout();
+
+    //! @brief 释放空闲时间超过 options::idle_timeout 且超出常驻数量的上下文
+    //! @note 归还上下文时会自动调用。
+    PYEMBED_LIB void shrink();
+
+    //! @brief 获取统计信息
+    PYEMBED_LIB statistics stats() const;
+
+private:
+    enum slot_state { empty, idle, busy, reserved };
+
+    struct slot
+    {
+        std::atomic<int>     state{ empty };
+        std::atomic<int64_t> last_used{ 0 };
+        pyembed::context     ctx;
+    };
+
+    void build(size_t index);
+    void checkin(size_t index);
+    void record_checkout(int64_t started);
+
+    pyembed&                 _embed;
+    options                  _options;
+    const uint64_t           _serial;
+    std::unique_ptr<slot[]>  _slots;
+    std::atomic<uint64_t>    _checkouts{ 0 };
+    std::atomic<uint64_t>    _waits{ 0 };
+    std::atomic<uint64_t>    _wait_total_ns{ 0 };
+    std::atomic<uint64_t>    _wait_max_ns{ 0 };
+};
+
+#endif // pyembed_pool_h__
@@ -0,0 +1,129 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pyembed_process_pool_h__
+#define pyembed_process_pool_h__
+
+#include "pyembed.h"
+
+#include <memory>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+
+//!
+//! 多进程的解释器池，用于在多核上扩展CPU密集的Python代码
+//! 
+//! 构造时由当前进程fork出监管进程，后者完成预热(同 pyembed_zygote)后fork出 options::workers 个工作进程，
+//! 并在工作进程崩溃或超时后重新创建。请求与结果经由共享内存传递：调用者将请求写入空闲的共享内存块(slab)，
+//! 并将其序号放入无锁的请求队列，工作进程取出后就地写回结果，因此参数与结果不经过管道复制。
+//! 参数与结果以 pickle 序列化，接口与进程内的 eval()/exec()/call() 相对应。
+//! 
+//! @note 1. 仅支持POSIX系统，其他系统上的调用将抛出异常(std::runtime_error)。
+//!       2. 各工作进程的命名空间相互独立，exec() 仅在其中一个工作进程上执行，
+//!          所有工作进程都需要的定义应放在 options::prelude 中。
+//! 
+class pyembed_process_pool
+{
+public:
+    struct options
+    {
+        size_t                   workers = 4;           //!< 工作进程数量
+        size_t                   slabs = 0;             //!< 共享内存块的数量，即同时进行的请求数量上限，0表示工作进程数量的2倍
+        size_t                   slab_size = 1 << 20;   //!< 每个共享内存块的大小，请求与结果(序列化后)均不能超过该大小
+        std::vector<std::string> preload;               //!< 预先导入的模块
+        std::string              prelude;               //!< 预热代码片段(utf-8)，在每个工作进程的默认上下文中可见
+        std::chrono::milliseconds restart_delay{ 100 }; //!< 工作进程退出后，等待多久再重新创建
+    };
+
+    struct statistics
+    {
+        size_t   workers;       //!< 当前存活的工作进程数量
+        uint64_t restarts;      //!< 工作进程被重新创建的次数
+        uint64_t completed;     //!< 已完成的请求数量
+        uint64_t failed;        //!< 因异常、超时或工作进程崩溃而失败的请求数量
+    };
+
+    //! @brief 创建监管进程与工作进程，并等待所有工作进程就绪
+    //! @note 1. 应在 pyembed::init() 后、创建其他线程前调用，参考 pyembed_zygote。
+    //!       2. 预热失败将抛出异常(std::runtime_error)。
+    PYEMBED_LIB pyembed_process_pool(pyembed& embed, const options& opts);
+
+    //! @brief 终止监管进程与工作进程
+    PYEMBED_LIB ~pyembed_process_pool();
+
+    pyembed_process_pool(const pyembed_process_pool&) = delete;
+    pyembed_process_pool& operator=(const pyembed_process_pool&) = delete;
+
+    //! @brief 在工作进程中计算给定表达式的值并返回结果值，参考 pyembed::eval()
+    //! @param limits 调用限制，在工作进程中执行；超时的工作进程无法中断时将被终止并重新创建
+    //! @note 1. 等待结果期间释放GIL，可由多个线程同时调用。
+    //!       2. 工作进程中的(python)异常在当前进程中重新抛出，交由 exception_handler 处理；
+    //!          工作进程崩溃时抛出 RuntimeError，结果超出 options::slab_size 时抛出 OverflowError。
+    //!       3. 请求超出 options::slab_size 时抛出异常(std::length_error)。
+    PYEMBED_LIB boost::python::object eval(
+        const std::string& expression,
+        const std::function<bool(const pyembed::pyerror&)>& exception_handler = {},
+        const pyembed::pylimits& limits = {});
+
+    //! @brief 在任一工作进程中执行给定的代码片段，参考 eval() 与 pyembed::exec()
+    //! @return 返回值总是None
+    PYEMBED_LIB boost::python::object exec(
+        const std::string& code,
+        const std::function<bool(const pyembed::pyerror&)>& exception_handler = {},
+        const pyembed::pylimits& limits = {});
+
+    //! @brief 在工作进程中调用可调用对象，参考 eval()
+    //! @param callable 可调用对象的名称，如预热代码中定义的函数名或 "json.dumps"，
+    //!     首段在工作进程的默认上下文中查找，不存在时作为模块导入
+    //! @param args 位置参数，须能被 pickle 序列化
+    //! @param kwargs 关键字参数，须能被 pickle 序列化
+    PYEMBED_LIB boost::python::object call(
+        const std::string& callable,
+        const boost::python::tuple& args = boost::python::tuple(),
+        const boost::python::dict& kwargs = boost::python::dict(),
+        const std::function<bool(const pyembed::pyerror&)>& exception_handler = {},
+        const pyembed::pylimits& limits = {});
+
+    //! @brief 获取统计信息
+    PYEMBED_LIB statistics stats() const;
+
+    //! 监管进程的标识
+    int pid() const { return _pid; }
+
+private:
+    struct shared;
+
+    boost::python::object submit(
+        uint32_t op,
+        const std::string& request,
+        const std::function<bool(const pyembed::pyerror&)>& exception_handler,
+        const pyembed::pylimits& limits);
+
+    pyembed&                _embed;
+    options                 _options;
+    std::shared_ptr<shared> _shared;
+    int                     _pid;
+};
+
+#endif // pyembed_process_pool_h__
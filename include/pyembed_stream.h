@@ -0,0 +1,192 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pyembed_stream_h__
+#define pyembed_stream_h__
+
+#include "pyembed.h"
+
+#include <tuple>
+#include <iterator>
+
+//!
+//! 逐块拉取Python可迭代对象的数据源，参考 pystream
+//! 
+class pystream_source
+{
+public:
+    //! @param iterable 可迭代对象(如生成器)，需持有GIL
+    //! @param fields 每项的字段类型
+    //! @param unpack 为true时每项须为长度等于 fields.size() 的序列(如tuple)，否则 fields 仅包含一项
+    //! @param exception_handler 异常处理器，迭代或转换失败时被调用，参考 pyembed::eval()
+    PYEMBED_LIB pystream_source(
+        const boost::python::object& iterable,
+        const std::vector<pyembed::pyvalue_type>& fields,
+        bool unpack,
+        const std::function<bool(const pyembed::pyerror&)>& exception_handler);
+
+    //! @note 释放迭代器时将获取GIL。
+    PYEMBED_LIB ~pystream_source();
+
+    pystream_source(const pystream_source&) = delete;
+    pystream_source& operator=(const pystream_source&) = delete;
+
+    //! @brief 在一次GIL获取中拉取至多count项，写入输出缓冲区
+    //! @param outputs 每个字段的输出缓冲区，至少容纳count个元素
+    //! @return 返回拉取的数量，迭代结束或失败后返回0
+    //! @note 调用线程未持有GIL时，拉取结束后释放GIL；已持有GIL时，在拉取结束后短暂地让出GIL。
+    PYEMBED_LIB size_t fetch(size_t count, const std::vector<pyembed::pyoutput>& outputs);
+
+    //! 迭代是否已结束(包括失败)
+    bool done() const { return _done; }
+
+    //! 迭代是否因异常而终止
+    bool failed() const { return _failed; }
+
+private:
+    PyObject*                                     _iterator;
+    std::vector<pyembed::pyvalue_type>            _fields;
+    bool                                          _unpack;
+    std::function<bool(const pyembed::pyerror&)>  _handler;
+    bool                                          _done;
+    bool                                          _failed;
+};
+
+//!
+//! 以输入区间(input range)的形式流式消费Python可迭代对象
+//! 
+//! 元素按块拉取并转换为C++类型，每块仅获取一次GIL，块之间释放GIL以便其他线程执行，
+//! 因此不需要将生成器的全部结果物化为list，例如：
+//! 
+//!     auto rows = pyembed::get().eval("((i, i * 0.5, str(i)) for i in range(10000000))");
+//!     for (const auto& [id, weight, name] : pystream<std::tuple<int64_t, double, std::string>>(rows, 4096))
+//!         ...
+//! 
+//! 元素类型 T 可以是 int64_t、double、bool、std::string，或由它们组成的 std::tuple(每项须为等长的序列)。
+//! 
+template<class T>
+class pystream
+{
+    template<class U>
+    struct layout
+    {
+        static std::vector<pyembed::pyvalue_type> fields() { return { pyembed::pyvalue_type_of<U>() }; }
+        static std::vector<pyembed::pyoutput> outputs(U* data) { return { pyembed::output(data) }; }
+        static constexpr bool unpack = false;
+    };
+
+    template<class... Ts>
+    struct layout<std::tuple<Ts...>>
+    {
+        static std::vector<pyembed::pyvalue_type> fields() { return { pyembed::pyvalue_type_of<Ts>()... }; }
+        static std::vector<pyembed::pyoutput> outputs(std::tuple<Ts...>* data) {
+            return outputs(data, std::index_sequence_for<Ts...>());
+        }
+        template<size_t... I>
+        static std::vector<pyembed::pyoutput> outputs(std::tuple<Ts...>* data, std::index_sequence<I...>) {
+            return { { pyembed::pyvalue_type_of<Ts>(), &std::get<I>(*data), sizeof(std::tuple<Ts...>) }... };
+        }
+        static constexpr bool unpack = true;
+    };
+
+public:
+    //! @param iterable 可迭代对象，需持有GIL
+    //! @param chunk_size 每块拉取的元素数量
+    //! @param exception_handler 异常处理器，迭代或转换失败时被调用，此后迭代结束，参考 pyembed::eval()
+    explicit pystream(
+        const boost::python::object& iterable,
+        size_t chunk_size = 1024,
+        const std::function<bool(const pyembed::pyerror&)>& exception_handler = {})
+        : _source(std::make_shared<pystream_source>(
+            iterable, layout<T>::fields(), layout<T>::unpack, exception_handler))
+        , _chunk_size(chunk_size ? chunk_size : 1)
+    { }
+
+    class iterator
+    {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef T                       value_type;
+        typedef std::ptrdiff_t          difference_type;
+        typedef const T*                pointer;
+        typedef const T&                reference;
+
+        iterator() : _owner(nullptr) { }
+        explicit iterator(pystream* owner) : _owner(owner) {
+            if (!_owner->next())
+                _owner = nullptr;
+        }
+
+        reference operator*() const { return _owner->current(); }
+        pointer operator->() const { return &_owner->current(); }
+
+        iterator& operator++() {
+            if (!_owner->next())
+                _owner = nullptr;
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(const iterator& other) const { return _owner == other._owner; }
+        bool operator!=(const iterator& other) const { return _owner != other._owner; }
+
+    private:
+        pystream* _owner;
+    };
+
+    //! @note 区间只能遍历一次。
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+    //! 迭代是否因异常而终止
+    bool failed() const { return _source->failed(); }
+
+private:
+    const T& current() const { return _chunk[_index]; }
+
+    bool next()
+    {
+        if (_started && ++_index < _size)
+            return true;
+
+        _started = true;
+        _index = 0;
+        _size = 0;
+        if (_source->done())
+            return false;
+
+        // 缓冲区在块之间复用(std::vector<bool> 没有连续存储，因此不使用vector)
+        if (!_chunk)
+            _chunk.reset(new T[_chunk_size]());
+        _size = _source->fetch(_chunk_size, layout<T>::outputs(_chunk.get()));
+        return _size != 0;
+    }
+
+    std::shared_ptr<pystream_source> _source;
+    size_t               _chunk_size;
+    std::unique_ptr<T[]> _chunk;
+    size_t               _size = 0;
+    size_t               _index = 0;
+    bool                 _started = false;
+};
+
+#endif // pyembed_stream_h__
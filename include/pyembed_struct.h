@@ -0,0 +1,345 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pyembed_struct_h__
+#define pyembed_struct_h__
+
+#include "pyembed.h"
+
+#include <new>
+#include <string>
+#include <vector>
+#include <structmember.h>
+
+//!
+//! 以槽(PyMemberDef)的形式向Python暴露C++结构体
+//! 
+//! 结构体的值内联存储在Python对象中，数值字段由成员描述符按偏移量直接读写，
+//! 不经过 boost.python 的属性描述符与转换器，例如：
+//! 
+//!     struct point { double x; double y; int64_t id; char tag[8]; std::string name; };
+//! 
+//!     BOOST_PYTHON_MODULE(geometry)
+//!     {
+//!         pystruct<point>::def("point", {
+//!             pystruct<point>::field<&point::x>("x"),
+//!             pystruct<point>::field<&point::y>("y"),
+//!             pystruct<point>::field<&point::id>("id", true),
+//!             pystruct<point>::field<&point::tag>("tag"),
+//!             pystruct<point>::field<&point::name>("name"),
+//!         });
+//!     }
+//! 
+//! 支持的字段类型: bool、整数、float、double(读写)，char[N](只读)，
+//!                std::string(读写，由 getset 描述符直接转换 utf-8)
+//! 
+template<class S>
+class pystruct
+{
+    struct object
+    {
+        PyObject_HEAD
+        S value;
+    };
+
+public:
+    //! 字段描述
+    struct member
+    {
+        const char* name;
+        const char* doc;
+        int         type;       // T_*，-1表示由 get/set 访问
+        Py_ssize_t  offset;     // 相对于Python对象的偏移量
+        int         flags;      // READONLY
+        getter      get;
+        setter      set;
+    };
+
+    //! @brief 描述一个字段
+    //! @param name 属性名，须具有静态存储期
+    //! @param readonly 是否只读
+    //! @param doc 文档字符串，须具有静态存储期
+    template<auto M>
+    static member field(const char* name, bool readonly = false, const char* doc = nullptr)
+    {
+        typedef typename member_traits<decltype(M)>::type T;
+
+        member item = { name, doc, -1, offset_of<M>(), readonly ? READONLY : 0, nullptr, nullptr };
+        if constexpr (std::is_same<T, std::string>::value)
+        {
+            item.get = &get_string<M>;
+            item.set = readonly ? nullptr : &set_string<M>;
+        }
+        else if constexpr (std::is_array<T>::value)
+        {
+            static_assert(std::is_same<typename std::remove_extent<T>::type, char>::value,
+                "pystruct: only char arrays are supported");
+            item.type = T_STRING_INPLACE;
+            item.flags = READONLY;
+        }
+        else
+            item.type = member_type<T>();
+        return item;
+    }
+
+    //! @brief 创建类型并添加到当前作用域(boost::python::scope)
+    //! @param name 类型名，须具有静态存储期
+    //! @param members 字段列表，同时决定构造时位置参数的顺序
+    //! @param doc 文档字符串，须具有静态存储期
+    //! @return 返回类型对象
+    //! @note 通常在 BOOST_PYTHON_MODULE 中调用，每个结构体仅创建一次类型。
+    static boost::python::object def(
+        const char* name,
+        std::initializer_list<member> members,
+        const char* doc = nullptr)
+    {
+        namespace bp = boost::python;
+        if (!_type)
+        {
+            // 描述符数组与类型同生命周期
+            auto* slots_members = new std::vector<PyMemberDef>();
+            auto* slots_getset = new std::vector<PyGetSetDef>();
+            auto* names = new std::vector<const char*>();
+            for (const member& item : members)
+            {
+                names->push_back(item.name);
+                if (item.type < 0)
+                    slots_getset->push_back({ item.name, item.get, item.set, item.doc, nullptr });
+                else
+                    slots_members->push_back({ item.name, item.type, item.offset, item.flags, item.doc });
+            }
+            slots_members->push_back(PyMemberDef{});
+            slots_getset->push_back(PyGetSetDef{});
+            _names = names;
+
+            bp::scope current;
+            std::string qualified = name;
+            bp::object module_name = bp::getattr(current, "__name__", bp::object());
+            if (!module_name.is_none())
+                qualified = bp::extract<std::string>(module_name)() + "." + qualified;
+            auto* type_name = new std::string(qualified);
+
+            PyType_Slot slots[] = {
+                { Py_tp_new,     reinterpret_cast<void*>(&create) },
+                { Py_tp_init,    reinterpret_cast<void*>(&init) },
+                { Py_tp_dealloc, reinterpret_cast<void*>(&dealloc) },
+                { Py_tp_members, slots_members->data() },
+                { Py_tp_getset,  slots_getset->data() },
+                { Py_tp_doc,     const_cast<char*>(doc) },
+                { 0, nullptr },
+            };
+            if (!doc)
+                slots[5] = { 0, nullptr };
+
+            PyType_Spec spec = {
+                type_name->c_str(),
+                int(sizeof(object)),
+                0,
+                Py_TPFLAGS_DEFAULT,
+                slots
+            };
+            PyObject* type = PyType_FromSpec(&spec);
+            if (!type)
+                bp::throw_error_already_set();
+            _type = reinterpret_cast<PyTypeObject*>(type);
+        }
+
+        bp::object type(bp::handle<>(bp::borrowed(reinterpret_cast<PyObject*>(_type))));
+        bp::scope().attr(name) = type;
+        return type;
+    }
+
+    //! @brief 复制结构体到新的Python对象
+    //! @note 需持有GIL，类型须已由 def() 创建。
+    static boost::python::object wrap(const S& value)
+    {
+        namespace bp = boost::python;
+        PyObject* self = _type->tp_alloc(_type, 0);
+        if (!self)
+            bp::throw_error_already_set();
+        bp::object result{ bp::handle<>(self) };
+        new (&reinterpret_cast<object*>(self)->value) S(value);
+        return result;
+    }
+
+    //! @brief 获得Python对象内联存储的结构体
+    //! @return 对象不是该类型时返回nullptr
+    static S* get(PyObject* obj)
+    {
+        if (!_type || !PyObject_TypeCheck(obj, _type))
+            return nullptr;
+        return &reinterpret_cast<object*>(obj)->value;
+    }
+
+    static S* get(const boost::python::object& obj) { return get(obj.ptr()); }
+
+private:
+    template<class M>
+    struct member_traits;
+
+    template<class T>
+    struct member_traits<T S::*> { typedef T type; };
+
+    template<auto M>
+    static Py_ssize_t offset_of()
+    {
+        // 仅计算地址，不构造对象
+        alignas(object) static unsigned char storage[sizeof(object)];
+        auto* self = reinterpret_cast<object*>(storage);
+        return reinterpret_cast<unsigned char*>(&(self->value.*M)) - storage;
+    }
+
+    template<class T>
+    static constexpr int member_type()
+    {
+        if constexpr (std::is_same<T, bool>::value)
+        {
+            static_assert(sizeof(bool) == sizeof(char), "pystruct: bool must be one byte");
+            return T_BOOL;
+        }
+        else if constexpr (std::is_same<T, float>::value)
+            return T_FLOAT;
+        else if constexpr (std::is_same<T, double>::value)
+            return T_DOUBLE;
+        else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value)
+        {
+            if constexpr (sizeof(T) == sizeof(char))
+                return T_BYTE;
+            else if constexpr (sizeof(T) == sizeof(short))
+                return T_SHORT;
+            else if constexpr (sizeof(T) == sizeof(int))
+                return T_INT;
+            else
+            {
+                static_assert(sizeof(T) == sizeof(long long), "pystruct: unsupported integer size");
+                return T_LONGLONG;
+            }
+        }
+        else if constexpr (std::is_integral<T>::value)
+        {
+            if constexpr (sizeof(T) == sizeof(unsigned char))
+                return T_UBYTE;
+            else if constexpr (sizeof(T) == sizeof(unsigned short))
+                return T_USHORT;
+            else if constexpr (sizeof(T) == sizeof(unsigned int))
+                return T_UINT;
+            else
+            {
+                static_assert(sizeof(T) == sizeof(unsigned long long), "pystruct: unsupported integer size");
+                return T_ULONGLONG;
+            }
+        }
+        else
+        {
+            static_assert(sizeof(T) == 0, "pystruct: unsupported field type");
+            return -1;
+        }
+    }
+
+    template<auto M>
+    static PyObject* get_string(PyObject* self, void*)
+    {
+        const std::string& str = reinterpret_cast<object*>(self)->value.*M;
+        return PyUnicode_FromStringAndSize(str.data(), str.size());
+    }
+
+    template<auto M>
+    static int set_string(PyObject* self, PyObject* value, void*)
+    {
+        if (!value)
+        {
+            PyErr_SetString(PyExc_TypeError, "can't delete attribute");
+            return -1;
+        }
+
+        Py_ssize_t size = 0;
+        const char* str = PyUnicode_AsUTF8AndSize(value, &size);
+        if (!str)
+            return -1;
+        (reinterpret_cast<object*>(self)->value.*M).assign(str, size);
+        return 0;
+    }
+
+    static PyObject* create(PyTypeObject* type, PyObject*, PyObject*)
+    {
+        PyObject* self = type->tp_alloc(type, 0);
+        if (!self)
+            return nullptr;
+
+        try
+        {
+            new (&reinterpret_cast<object*>(self)->value) S();
+        }
+        catch (...)
+        {
+            // 结构体未构造，不能经由 dealloc() 析构
+            type->tp_free(self);
+            Py_DECREF(type);
+            boost::python::handle_exception();
+            return nullptr;
+        }
+        return self;
+    }
+
+    // 位置参数按字段顺序赋值，关键字参数按名称赋值
+    static int init(PyObject* self, PyObject* args, PyObject* kwargs)
+    {
+        Py_ssize_t count = PyTuple_GET_SIZE(args);
+        if (count > Py_ssize_t(_names->size()))
+        {
+            PyErr_Format(PyExc_TypeError, "%s() takes at most %zd positional arguments (%zd given)",
+                _type->tp_name, Py_ssize_t(_names->size()), count);
+            return -1;
+        }
+
+        for (Py_ssize_t i = 0; i < count; ++i)
+        {
+            if (PyObject_SetAttrString(self, (*_names)[i], PyTuple_GET_ITEM(args, i)) < 0)
+                return -1;
+        }
+
+        if (kwargs)
+        {
+            PyObject* key, * value;
+            Py_ssize_t pos = 0;
+            while (PyDict_Next(kwargs, &pos, &key, &value))
+            {
+                if (PyObject_SetAttr(self, key, value) < 0)
+                    return -1;
+            }
+        }
+        return 0;
+    }
+
+    static void dealloc(PyObject* self)
+    {
+        PyTypeObject* type = Py_TYPE(self);
+        reinterpret_cast<object*>(self)->value.~S();
+        type->tp_free(self);
+        Py_DECREF(type);
+    }
+
+    static inline PyTypeObject*                   _type = nullptr;
+    static inline const std::vector<const char*>* _names = nullptr;
+};
+
+#endif // pyembed_struct_h__
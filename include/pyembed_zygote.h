@@ -0,0 +1,115 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pyembed_zygote_h__
+#define pyembed_zygote_h__
+
+#include "pyembed.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <filesystem>
+
+//!
+//! 预热的fork-server(zygote)，以独立的子进程执行不可信或可能崩溃的脚本
+//! 
+//! zygote进程完成初始化、导入预置模块并执行 gc.freeze() 后，在Unix套接字上等待作业，
+//! 每个作业fork出一个子进程执行一次 exec_file()，子进程共享zygote的(写时复制)堆，
+//! 无需重新初始化解释器。子进程的标准输出、错误输出与结果以帧的形式经由连接流式返回。
+//! 
+//! @note 仅支持POSIX系统，其他系统上的调用将抛出异常(std::runtime_error)。
+//! 
+class pyembed_zygote
+{
+public:
+    struct options
+    {
+        std::filesystem::path    socket_path;       //!< Unix套接字的路径，已存在时将被替换
+        std::vector<std::string> preload;           //!< 预先导入的模块
+        std::string              prelude;           //!< 预热代码片段(utf-8)，在默认上下文中执行
+        size_t                   max_children = 16; //!< 同时执行作业的子进程数量上限，达到上限后新的连接将等待
+    };
+
+    struct job
+    {
+        std::filesystem::path     script;           //!< 脚本文件，相对路径以zygote进程的工作目录为准
+        std::vector<std::string>  args;             //!< 执行参数
+        std::chrono::milliseconds timeout{ 0 };     //!< 超时时间，0表示不限制，超时后子进程将被终止
+    };
+
+    struct outcome
+    {
+        int         exit_code = -1;     //!< 子进程的退出码：0成功，1脚本抛出异常，被信号终止时为-1
+        int         signal = 0;         //!< 终止子进程的信号，0表示正常退出
+        bool        timed_out = false;  //!< 是否超时
+        std::string out;                //!< 标准输出(utf-8)
+        std::string err;                //!< 错误输出(utf-8)
+        std::string result;             //!< 脚本全局变量 result 的 str()，未定义时为空
+        std::string error;              //!< 脚本抛出的异常(traceback.format_exception())
+    };
+
+    //! 输出回调，子进程每次写入时调用
+    //! @param is_stderr 是否为错误输出
+    //! @param text 写入的内容(utf-8)
+    typedef std::function<void(bool is_stderr, const std::string& text)> output_handler;
+
+    //! @brief 由当前进程fork出zygote进程，并等待其就绪
+    //! @note 1. 应在 pyembed::init() 后、创建其他线程(包括设置了 pylimits 的调用)前调用，
+    //!          fork只会复制调用线程，其他线程持有的锁在zygote进程中将无法释放。
+    //!       2. 启动失败将抛出异常(std::runtime_error)。
+    PYEMBED_LIB pyembed_zygote(pyembed& embed, const options& opts);
+
+    //! @brief 终止zygote进程及其正在执行作业的子进程
+    PYEMBED_LIB ~pyembed_zygote();
+
+    pyembed_zygote(const pyembed_zygote&) = delete;
+    pyembed_zygote& operator=(const pyembed_zygote&) = delete;
+
+    //! @brief 提交作业并等待其完成
+    //! @param task 作业
+    //! @param on_output 输出回调，可为空；输出同时记录在返回值中
+    //! @return 返回作业的结果，无法连接zygote时抛出异常(std::runtime_error)
+    //! @note 线程安全，不需要GIL，调用期间不持有GIL。
+    PYEMBED_LIB outcome run(const job& task, const output_handler& on_output = {}) const;
+
+    //! @brief 向给定套接字上的zygote提交作业，可在其他进程中使用，参考 run()
+    PYEMBED_LIB static outcome run(
+        const std::filesystem::path& socket_path,
+        const job& task,
+        const output_handler& on_output = {});
+
+    //! @brief 在当前进程中运行zygote(阻塞)，直到收到 SIGTERM 或 SIGINT
+    //! @note 1. 当前进程应为单线程，且已调用 pyembed::init()，通常用于以专门的命令行参数启动的宿主进程。
+    //!       2. 启动失败将抛出异常(std::runtime_error)。
+    PYEMBED_LIB static void serve(pyembed& embed, const options& opts);
+
+    //! zygote进程的标识
+    int pid() const { return _pid; }
+
+private:
+    options _options;
+    int     _pid;
+};
+
+#endif // pyembed_zygote_h__
@@ -0,0 +1,143 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#include "pyembed.h"
+#include "pyvalue.hpp"
+
+namespace bp = boost::python;
+
+namespace {
+
+// 可调用对象的限定名，如 "module.function"，无法获得时为类型名
+std::string callable_name(const bp::object& callable)
+{
+    PyObject* name = PyObject_GetAttrString(callable.ptr(), "__qualname__");
+    if (!name)
+    {
+        PyErr_Clear();
+        return Py_TYPE(callable.ptr())->tp_name;
+    }
+
+    bp::object qualname{ bp::handle<>(name) };
+    std::string text = bp::extract<std::string>(bp::str(qualname));
+
+    PyObject* module = PyObject_GetAttrString(callable.ptr(), "__module__");
+    if (!module)
+    {
+        PyErr_Clear();
+        return text;
+    }
+
+    bp::object owner{ bp::handle<>(module) };
+    if (PyUnicode_Check(owner.ptr()))
+        text = std::string(bp::extract<std::string>(owner)) + "." + text;
+    return text;
+}
+
+} // namespace
+
+size_t pyembed::eval_batch(
+    const std::string& expression,
+    const std::vector<pyfield>& fields,
+    size_t count,
+    const pyoutput& output,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    gil_acquire gil("eval_batch", &expression);
+    size_t index = 0;
+    exec_for([&]() {
+        bp::object code;
+        {
+            trace_scope span("compile", "compile", &expression);
+            code = bp::object(bp::handle<>(
+                Py_CompileString(expression.c_str(), "<batch>", Py_eval_input)));
+        }
+
+        // 变量名预先驻留，局部命名空间在整个批次中复用
+        std::vector<bp::object> keys;
+        for (const auto& item : fields)
+            keys.emplace_back(bp::handle<>(PyUnicode_InternFromString(item.name.c_str())));
+
+        bp::dict local;
+        for (; index < count; ++index)
+        {
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                const pyfield& item = fields[i];
+                bp::handle<> value(to_python(item.type, item.data, item.stride, index));
+                if (PyDict_SetItem(local.ptr(), keys[i].ptr(), value.get()) != 0)
+                    bp::throw_error_already_set();
+            }
+
+            bp::handle<> result(PyEval_EvalCode(code.ptr(), global().ptr(), local.ptr()));
+            if (!from_python(output, index, result.get()))
+                bp::throw_error_already_set();
+        }
+        }, exception_handler, limits);
+    return index;
+}
+
+size_t pyembed::call_batch(
+    const boost::python::object& callable,
+    const std::vector<pyfield>& fields,
+    size_t count,
+    const pyoutput& output,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    std::string detail; // 可调用对象的名称，获取GIL后填充，用于GIL争用报告
+    gil_acquire gil("call_batch", &detail);
+    detail = callable_name(callable);
+
+    size_t index = 0;
+    exec_for([&]() {
+        std::vector<bp::handle<>> values(fields.size());
+        std::vector<PyObject*> args(fields.size());
+
+        for (; index < count; ++index)
+        {
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                const pyfield& item = fields[i];
+                values[i] = bp::handle<>(to_python(item.type, item.data, item.stride, index));
+                args[i] = values[i].get();
+            }
+
+#if PY_VERSION_HEX >= 0x03090000
+            // vectorcall 无需为每次调用构造参数元组
+            bp::handle<> result(PyObject_Vectorcall(
+                callable.ptr(), args.data(), args.size(), nullptr));
+#else
+            bp::handle<> tuple(PyTuple_New(args.size()));
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                Py_INCREF(args[i]);
+                PyTuple_SET_ITEM(tuple.get(), i, args[i]);
+            }
+            bp::handle<> result(PyObject_Call(callable.ptr(), tuple.get(), nullptr));
+#endif
+            if (!from_python(output, index, result.get()))
+                bp::throw_error_already_set();
+        }
+        }, exception_handler, limits);
+    return index;
+}
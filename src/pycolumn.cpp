@@ -0,0 +1,367 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#include "pyembed_column.h"
+
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+
+namespace bp = boost::python;
+
+namespace {
+
+//
+// pyembed.column
+//
+struct column_object
+{
+    PyObject_HEAD
+    pycolumn    column;
+    PyObject*   dictionary;     // 字符串列的字典(tuple of str)，首次访问时创建
+    Py_ssize_t  shape;
+    Py_ssize_t  itemsize;
+};
+
+const char* column_format(pyembed::pyvalue_type type)
+{
+    switch (type)
+    {
+    case pyembed::pyvalue_type::int64:   return "q";
+    case pyembed::pyvalue_type::float64: return "d";
+    case pyembed::pyvalue_type::boolean: return "?";
+    case pyembed::pyvalue_type::string:  return "i";
+    }
+    return "B";
+}
+
+const char* column_type_name(pyembed::pyvalue_type type)
+{
+    switch (type)
+    {
+    case pyembed::pyvalue_type::int64:   return "int64";
+    case pyembed::pyvalue_type::float64: return "float64";
+    case pyembed::pyvalue_type::boolean: return "bool";
+    case pyembed::pyvalue_type::string:  return "string";
+    }
+    return "unknown";
+}
+
+Py_ssize_t column_itemsize(pyembed::pyvalue_type type)
+{
+    switch (type)
+    {
+    case pyembed::pyvalue_type::int64:   return sizeof(int64_t);
+    case pyembed::pyvalue_type::float64: return sizeof(double);
+    case pyembed::pyvalue_type::boolean: return sizeof(bool);
+    case pyembed::pyvalue_type::string:  return sizeof(int32_t);
+    }
+    return 1;
+}
+
+PyObject* column_dictionary(column_object* self)
+{
+    if (self->dictionary)
+        return self->dictionary;
+
+    const auto* dictionary = self->column.dictionary;
+    const Py_ssize_t size = dictionary ? dictionary->size() : 0;
+    PyObject* tuple = PyTuple_New(size);
+    if (!tuple)
+        return nullptr;
+
+    for (Py_ssize_t i = 0; i < size; ++i)
+    {
+        const auto& str = (*dictionary)[i];
+        PyObject* item = PyUnicode_FromStringAndSize(str.data(), str.size());
+        if (!item)
+        {
+            Py_DECREF(tuple);
+            return nullptr;
+        }
+        PyTuple_SET_ITEM(tuple, i, item);
+    }
+    return self->dictionary = tuple;
+}
+
+void column_dealloc(PyObject* obj)
+{
+    auto self = reinterpret_cast<column_object*>(obj);
+    Py_XDECREF(self->dictionary);
+    self->column.~pycolumn();
+
+    // 堆类型的实例持有类型的引用
+    PyTypeObject* type = Py_TYPE(obj);
+    type->tp_free(obj);
+#if PY_VERSION_HEX >= 0x03080000
+    Py_DECREF(type);
+#endif
+}
+
+Py_ssize_t column_length(PyObject* obj)
+{
+    return reinterpret_cast<column_object*>(obj)->column.length;
+}
+
+PyObject* column_item(PyObject* obj, Py_ssize_t index)
+{
+    auto self = reinterpret_cast<column_object*>(obj);
+    const pycolumn& column = self->column;
+    if (index < 0 || size_t(index) >= column.length)
+    {
+        PyErr_SetString(PyExc_IndexError, "column index out of range");
+        return nullptr;
+    }
+
+    if (!column.valid(index))
+        Py_RETURN_NONE;
+
+    switch (column.type)
+    {
+    case pyembed::pyvalue_type::int64:
+        return PyLong_FromLongLong(static_cast<const int64_t*>(column.data)[index]);
+    case pyembed::pyvalue_type::float64:
+        return PyFloat_FromDouble(static_cast<const double*>(column.data)[index]);
+    case pyembed::pyvalue_type::boolean:
+        return PyBool_FromLong(static_cast<const bool*>(column.data)[index]);
+    case pyembed::pyvalue_type::string: {
+        PyObject* dictionary = column_dictionary(self);
+        if (!dictionary)
+            return nullptr;
+        int32_t code = static_cast<const int32_t*>(column.data)[index];
+        if (code < 0 || code >= PyTuple_GET_SIZE(dictionary))
+        {
+            PyErr_SetString(PyExc_IndexError, "dictionary index out of range");
+            return nullptr;
+        }
+        PyObject* item = PyTuple_GET_ITEM(dictionary, code);
+        Py_INCREF(item);
+        return item;
+    }
+    }
+    Py_RETURN_NONE;
+}
+
+int column_getbuffer(PyObject* obj, Py_buffer* view, int flags)
+{
+    auto self = reinterpret_cast<column_object*>(obj);
+    if (flags & PyBUF_WRITABLE)
+    {
+        PyErr_SetString(PyExc_BufferError, "pyembed.column is read-only");
+        return -1;
+    }
+
+    view->obj = obj;
+    view->buf = const_cast<void*>(self->column.data);
+    view->len = self->shape * self->itemsize;
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? 
+        const_cast<char*>(column_format(self->column.type)) : nullptr;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->shape : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) ? &self->itemsize : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    Py_INCREF(obj);
+    return 0;
+}
+
+PyObject* column_get_type(PyObject* obj, void*)
+{
+    return PyUnicode_FromString(
+        column_type_name(reinterpret_cast<column_object*>(obj)->column.type));
+}
+
+PyObject* column_get_null_count(PyObject* obj, void*)
+{
+    const pycolumn& column = reinterpret_cast<column_object*>(obj)->column;
+    size_t count = 0;
+    if (column.validity)
+    {
+        for (size_t i = 0; i < column.length; ++i)
+            count += !column.valid(i);
+    }
+    return PyLong_FromSize_t(count);
+}
+
+PyObject* column_get_validity(PyObject* obj, void*)
+{
+    const pycolumn& column = reinterpret_cast<column_object*>(obj)->column;
+    if (!column.validity)
+        Py_RETURN_NONE;
+
+    // 只读的内存视图，直接引用有效位图
+    return PyMemoryView_FromMemory(
+        reinterpret_cast<char*>(const_cast<uint8_t*>(column.validity)),
+        (column.length + 7) / 8, PyBUF_READ);
+}
+
+PyObject* column_get_dictionary(PyObject* obj, void*)
+{
+    auto self = reinterpret_cast<column_object*>(obj);
+    if (self->column.type != pyembed::pyvalue_type::string)
+        Py_RETURN_NONE;
+
+    PyObject* dictionary = column_dictionary(self);
+    Py_XINCREF(dictionary);
+    return dictionary;
+}
+
+PyGetSetDef column_getset[] = {
+    { "type", column_get_type, nullptr, "element type of the column.", nullptr },
+    { "null_count", column_get_null_count, nullptr, "number of invalid elements.", nullptr },
+    { "validity", column_get_validity, nullptr, "validity bitmap, or None if all elements are valid.", nullptr },
+    { "dictionary", column_get_dictionary, nullptr, "dictionary of a string column.", nullptr },
+    {}
+};
+
+PyType_Slot column_slots[] = {
+    { Py_tp_doc, const_cast<char*>("A zero-copy view of a column owned by the host application.") },
+    { Py_tp_dealloc, reinterpret_cast<void*>(column_dealloc) },
+    { Py_tp_getset, column_getset },
+    { Py_sq_length, reinterpret_cast<void*>(column_length) },
+    { Py_sq_item, reinterpret_cast<void*>(column_item) },
+    { Py_bf_getbuffer, reinterpret_cast<void*>(column_getbuffer) },
+    { 0, nullptr }
+};
+
+PyType_Spec column_spec = {
+    "pyembed.column", sizeof(column_object), 0, Py_TPFLAGS_DEFAULT, column_slots
+};
+
+PyTypeObject* column_type = nullptr;
+
+PyTypeObject* column_type_ready()
+{
+    static std::atomic<bool> ready{ false };
+    if (ready.load(std::memory_order_acquire))
+        return column_type;
+
+    // 自由线程构建中可能有多个线程同时首次使用
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (column_type)
+        return column_type;
+
+    // 堆类型，与解释器一样有意不释放
+    PyObject* type = PyType_FromSpec(&column_spec);
+    if (!type)
+        bp::throw_error_already_set();
+    column_type = reinterpret_cast<PyTypeObject*>(type);
+    ready.store(true, std::memory_order_release);
+    return column_type;
+}
+
+} // namespace
+
+boost::python::object pycolumn::to_python() const
+{
+    PyTypeObject* object_type = column_type_ready();
+    PyObject* obj = object_type->tp_alloc(object_type, 0);
+    if (!obj)
+        bp::throw_error_already_set();
+
+    auto self = reinterpret_cast<column_object*>(obj);
+    new (&self->column) pycolumn(*this);
+    self->dictionary = nullptr;
+    self->shape = length;
+    self->itemsize = column_itemsize(type);
+    return bp::object(bp::handle<>(obj));
+}
+
+boost::python::dict pycolumn::table(
+    const std::vector<std::pair<std::string, pycolumn>>& columns)
+{
+    bp::dict result;
+    for (const auto& item : columns)
+        result[item.first] = item.second.to_python();
+    return result;
+}
+
+pycolumn_buffer::~pycolumn_buffer()
+{
+    release();
+}
+
+void pycolumn_buffer::acquire(const boost::python::object& obj)
+{
+    release();
+
+    // 列对象直接共享其引用的缓冲区
+    if (PyObject_TypeCheck(obj.ptr(), column_type_ready()))
+    {
+        _column = reinterpret_cast<column_object*>(obj.ptr())->column;
+        _object = obj;
+        return;
+    }
+
+    if (PyObject_GetBuffer(obj.ptr(), &_view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) != 0)
+        bp::throw_error_already_set();
+    _acquired = true;
+
+    const char* format = _view.format ? _view.format : "B";
+    if (*format == '@' || *format == '=' || *format == '<')
+        ++format;
+
+    pyembed::pyvalue_type type;
+    if ((!strcmp(format, "q") || !strcmp(format, "l")) && _view.itemsize == sizeof(int64_t))
+        type = pyembed::pyvalue_type::int64;
+    else if (!strcmp(format, "d") && _view.itemsize == sizeof(double))
+        type = pyembed::pyvalue_type::float64;
+    else if (!strcmp(format, "?") && _view.itemsize == sizeof(bool))
+        type = pyembed::pyvalue_type::boolean;
+    else
+    {
+        // format 指向缓冲区视图，须在释放前复制
+        std::string unsupported = format;
+        release();
+        PyErr_Format(PyExc_TypeError, 
+            "unsupported buffer format '%s' for a column", unsupported.c_str());
+        bp::throw_error_already_set();
+        return;
+    }
+
+    if (_view.ndim > 1)
+    {
+        release();
+        PyErr_SetString(PyExc_TypeError, "a column must be one-dimensional");
+        bp::throw_error_already_set();
+    }
+
+    _column = pycolumn();
+    _column.type = type;
+    _column.data = _view.buf;
+    _column.length = _view.len / _view.itemsize;
+    _object = obj;
+}
+
+void pycolumn_buffer::release()
+{
+    if (_acquired)
+    {
+        PyBuffer_Release(&_view);
+        _acquired = false;
+    }
+    _column = pycolumn();
+    _object = bp::object();
+}
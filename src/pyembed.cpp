@@ -21,18 +21,47 @@
 
 #include "pyembed.h"
 #include "pyconvert.hpp"
+#include "pytimer.hpp"
+#include "pyexecutor.hpp"
+#include "pywatcher.hpp"
+#include "pymemory.hpp"
 #include "utility/utility.hpp"
 
 #include <assert.h>
 #include <signal.h>
+#include <fstream>
 #include <iostream>
 #include <strstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <typeindex>
+#include <system_error>
 #include <functional>
+#include <unordered_map>
 #include <boost/format.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/algorithm/string.hpp>
 
+#if OS_WIN
+#   include <io.h>
+#   include <windows.h>
+#else
+#   include <time.h>
+#   include <unistd.h>
+#   include <pthread.h>
+#endif
+
+// 由 faulthandler 使用的调用栈输出函数，不获取GIL，是异步信号安全的(声明位于内部头文件中)
+extern "C" const char* _Py_DumpTracebackThreads(
+    int fd, PyInterpreterState* interp, PyThreadState* current_tstate);
+
+#if defined(__GNUC__) || defined(__clang__)
+#   include <cxxabi.h>
+#endif
+
 namespace bp = boost::python;
 
 enum pipe_type 
@@ -95,35 +124,66 @@ std::string pyembed::pyerror::format_exception() const
 class pyembed_private 
 {
 public:
-    pyembed_private(pyembed* p) {
-        _public = p;
+    pyembed_private(pyembed* p) : _self(p) {
     }
 
     ~pyembed_private()
     {
-        _stdin.reset();
-        _stdout.reset();
-        _stderr.reset();
+        // 后台线程可能正在等待GIL，停止期间须释放GIL
+        if (_timer || _injector || _watcher || _watchdog_timer)
+        {
+            pyembed::gil_release unlock;
+            _watcher.reset();
+            _watchdog_timer.reset();
+            _timer.reset();
+            _injector.reset();
+        }
+
+        boost::atomic_store(&_stdin, boost::shared_ptr<stdin_redirector>());
+        boost::atomic_store(&_stdout, boost::shared_ptr<stdout_redirector>());
+        boost::atomic_store(&_stderr, boost::shared_ptr<stderr_redirector>());
 
-        _public = nullptr;
+        _public.store(nullptr, std::memory_order_release);
+        _self = nullptr;
     }
 
     void init()
     {
-        _stdin = boost::make_shared<stdin_redirector>(
+        // 重定向器可能被多个线程同时使用(自由线程构建中没有GIL的互斥)，因此以原子方式发布
+        // 内容由boost.python转换为std::string(调用期间有效)，读取的结果在返回后才转换为Python对象，
+        // 因此调用虚函数期间可以释放GIL
+        boost::atomic_store(&_stdin, boost::make_shared<stdin_redirector>(
             [&](int size) -> std::string {
-                return _public->readline_stdin(size);
-            });
-
-        _stdout = boost::make_shared<stdout_redirector>(
+                pyembed::trace_scope span("redirect", "stdin");
+                if (!_release_sinks.load(std::memory_order_relaxed))
+                    return _self->readline_stdin(size);
+                pyembed::gil_release unlock;
+                return _self->readline_stdin(size);
+            }));
+
+        boost::atomic_store(&_stdout, boost::make_shared<stdout_redirector>(
             [&](const std::string& str) {
-                _public->write_stdout(str);
-            });
-
-        _stderr = boost::make_shared<stderr_redirector>(
+                pyembed::trace_scope span("redirect", "stdout");
+                if (_release_sinks.load(std::memory_order_relaxed))
+                {
+                    pyembed::gil_release unlock;
+                    _self->write_stdout(str);
+                }
+                else
+                    _self->write_stdout(str);
+            }));
+
+        boost::atomic_store(&_stderr, boost::make_shared<stderr_redirector>(
             [&](const std::string& str) {
-                _public->write_stderr(str);
-            });
+                pyembed::trace_scope span("redirect", "stderr");
+                if (_release_sinks.load(std::memory_order_relaxed))
+                {
+                    pyembed::gil_release unlock;
+                    _self->write_stderr(str);
+                }
+                else
+                    _self->write_stderr(str);
+            }));
 
         // Retrieve the main module
         _main_module = std::make_shared<bp::object>(bp::import("__main__"));
@@ -133,21 +193,486 @@ public:
         _local = std::make_shared<bp::dict>();
         *_local = *_global;
 
+        // 上下文共享的内建层，初始为 builtins 模块字典的副本
+        _builtins = bp::dict(bp::import("builtins").attr("__dict__"));
+
+        // 超时注入的异常类型，派生自BaseException以避免被脚本中的 except Exception 拦截
+        _timeout = bp::object(bp::handle<>(
+            PyErr_NewException("pyembed.Timeout", PyExc_BaseException, nullptr)));
+
+        // 超出执行预算时注入的异常类型
+        _budget = bp::object(bp::handle<>(
+            PyErr_NewException("pyembed.BudgetExceeded", PyExc_BaseException, nullptr)));
+
         string_from_python_type();
         string_from_python_base_exception();
         //string_from_python_traceback();
     }
 
+    // 向执行调用的线程注入异常的目标，由时间轮线程判定到期，交由注入线程获取GIL后注入
+    // active/fired 与定时器的重新调度由 lock 保护，获取顺序为 GIL -> lock，
+    // 自由线程构建中没有GIL的互斥，同样依赖 lock 避免调用结束后仍注入异常
+    struct async_target
+    {
+        unsigned long thread_id = PyThread_get_thread_ident();
+        bool active = true;
+        bool fired = false;
+        uint64_t timer = 0;
+        std::mutex lock;
+
+        // 在注入线程上调用，可能长时间等待GIL(如调用阻塞在持有GIL的C代码中)
+        void raise(PyObject* type)
+        {
+            pyembed::gil_acquire gil;
+            std::lock_guard<std::mutex> guard(lock);
+            if (active && !fired)
+            {
+                fired = true;
+                PyThreadState_SetAsyncExc(thread_id, type);
+            }
+        }
+
+        // 在执行调用的线程上调用(持有GIL)
+        void finish(pytimer_wheel* wheel)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            active = false;
+            wheel->cancel(timer);
+
+            // 异常已注入但尚未触发(如调用恰好结束)，须清除以免影响后续调用
+            if (fired)
+                discard_pending();
+        }
+
+        // 求值循环的中断标志仅在投递异步异常时复位，直接清除(包括 PyThreadState_SetAsyncExc(id, NULL))
+        // 会使该标志保持置位：此后每次检查都进入慢速路径，而安装了跟踪函数时求值循环将停滞在 RESUME 指令上。
+        // 因此执行一段空代码，由解释器投递异常并复位标志，再丢弃该异常
+        static void discard_pending()
+        {
+            PyThreadState* tstate = PyThreadState_Get();
+            if (!tstate->async_exc)
+                return;
+
+            PyObject *type, *value, *traceback;
+            PyErr_Fetch(&type, &value, &traceback);
+
+            PyObject* space = PyDict_New();
+            if (space)
+            {
+                PyDict_SetItemString(space, "__builtins__", PyEval_GetBuiltins());
+                Py_XDECREF(PyRun_String("None", Py_eval_input, space, space));
+                Py_DECREF(space);
+            }
+            PyErr_Clear();
+            Py_CLEAR(tstate->async_exc);
+            PyErr_Restore(type, value, traceback);
+        }
+    };
+
+    pytimer_wheel* timer()
+    {
+        // 自由线程构建中可能有多个线程同时首次使用
+        std::call_once(_timer_once, [this]() { _timer = std::make_unique<pytimer_wheel>(); });
+        return _timer.get();
+    }
+
+    // 时间轮的回调不能等待GIL，否则一个停滞的调用会推迟所有的期限、采样与看门狗，
+    // 因此需要GIL的注入交由该线程执行
+    pyexecutor* injector()
+    {
+        std::call_once(_injector_once, [this]() { _injector = std::make_unique<pyexecutor>(); });
+        return _injector.get();
+    }
+
+    // 调用期限，超时后注入 pyembed.Timeout
+    class deadline
+    {
+    public:
+        deadline(pyembed_private& p, const pyembed::pylimits& limits)
+            : _wheel(nullptr)
+        {
+            if (limits.timeout.count() <= 0)
+                return;
+
+            _wheel = p.timer();
+            _target = std::make_shared<async_target>();
+
+            PyObject* type = p._timeout.ptr();
+            pyexecutor* injector = p.injector();
+            std::shared_ptr<async_target> target = _target;
+            std::lock_guard<std::mutex> guard(target->lock);
+            target->timer = _wheel->schedule(limits.timeout, [target, type, injector]() {
+                injector->post([target, type]() { target->raise(type); });
+            });
+        }
+
+        ~deadline()
+        {
+            if (_target)
+                _target->finish(_wheel);
+        }
+
+    private:
+        pytimer_wheel*                _wheel;
+        std::shared_ptr<async_target> _target;
+    };
+
+    // 线程CPU时间预算，由时间轮周期性地采样调用线程的CPU时钟，超出后注入 pyembed.BudgetExceeded
+    // 采样不依赖跟踪钩子，因此没有字节码派发的额外开销，单行的死循环同样可以被终止。
+    class cpu_budget
+    {
+    public:
+        cpu_budget(pyembed_private& p, const pyembed::pylimits& limits)
+            : _wheel(nullptr)
+        {
+            if (limits.max_cpu_time.count() <= 0)
+                return;
+
+            auto clock = std::make_shared<thread_clock>();
+            if (!clock->valid())
+                return;
+
+            _wheel = p.timer();
+            _target = std::make_shared<async_target>();
+
+            const int64_t deadline = clock->now() + 
+                std::chrono::duration_cast<std::chrono::nanoseconds>(limits.max_cpu_time).count();
+
+            std::lock_guard<std::mutex> guard(_target->lock);
+            schedule(_wheel, p.injector(), _target, clock, p._budget.ptr(), deadline);
+        }
+
+        ~cpu_budget()
+        {
+            if (_target)
+                _target->finish(_wheel);
+        }
+
+    private:
+        // 调用线程的CPU时钟，可在其他线程上读取
+        struct thread_clock
+        {
+#if OS_WIN
+            HANDLE handle = nullptr;
+            thread_clock() {
+                DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), 
+                    GetCurrentProcess(), &handle, THREAD_QUERY_INFORMATION, FALSE, 0);
+            }
+            ~thread_clock() { 
+                if (handle) CloseHandle(handle); 
+            }
+            bool valid() const { return handle != nullptr; }
+            int64_t now() const {
+                FILETIME creation, exit, kernel, user;
+                if (!GetThreadTimes(handle, &creation, &exit, &kernel, &user))
+                    return 0;
+                auto ticks = [](const FILETIME& t) {
+                    return (int64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+                };
+                return (ticks(kernel) + ticks(user)) * 100;
+            }
+#else
+            clockid_t id;
+            bool ok;
+            thread_clock() { 
+                ok = pthread_getcpuclockid(pthread_self(), &id) == 0; 
+            }
+            bool valid() const { return ok; }
+            int64_t now() const {
+                timespec ts;
+                if (clock_gettime(id, &ts) != 0)
+                    return 0;
+                return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+            }
+#endif
+        };
+
+        // 调用方须持有 target->lock
+        static void schedule(
+            pytimer_wheel* wheel,
+            pyexecutor* injector,
+            std::shared_ptr<async_target> target,
+            std::shared_ptr<thread_clock> clock,
+            PyObject* type,
+            int64_t deadline)
+        {
+            // CPU时间的增长不会快于墙上时间，因此剩余的预算就是下一次采样的最早时机
+            int64_t remaining = std::max<int64_t>(deadline - clock->now(), 1000000);
+            target->timer = wheel->schedule(std::chrono::nanoseconds(remaining), 
+                [=]() {
+                    if (clock->now() >= deadline)
+                    {
+                        injector->post([target, type]() { target->raise(type); });
+                        return;
+                    }
+
+                    std::lock_guard<std::mutex> guard(target->lock);
+                    if (target->active)
+                        schedule(wheel, injector, target, clock, type, deadline);
+                });
+        }
+
+        pytimer_wheel*                _wheel;
+        std::shared_ptr<async_target> _target;
+    };
+
+    // 指令预算，通过跟踪钩子对字节码指令计数
+    class budget
+    {
+    public:
+        budget(pyembed_private& p, const pyembed::pylimits& limits)
+            : _active(false)
+        {
+            if (limits.max_instructions == 0)
+                return;
+
+            _type = p._budget.ptr();
+            _max_instructions = limits.max_instructions;
+            _count = 0;
+
+            // 保存原有的跟踪函数(如调试器)，调用结束后恢复
+            PyThreadState* tstate = PyThreadState_Get();
+            _saved_func = tstate->c_tracefunc;
+            _saved_obj = tstate->c_traceobj;
+            Py_XINCREF(_saved_obj);
+
+            _outer = _current;
+            _current = this;
+            _active = true;
+            PyEval_SetTrace(&budget::trace, nullptr);
+        }
+
+        ~budget()
+        {
+            if (!_active)
+                return;
+
+            _current = _outer;
+            PyEval_SetTrace(_saved_func, _saved_obj);
+            Py_XDECREF(_saved_obj);
+        }
+
+    private:
+        static int trace(PyObject*, PyFrameObject* frame, int what, PyObject*)
+        {
+            // 行事件无法覆盖单行的循环，因此对每个新帧开启逐条的字节码事件
+            if (what == PyTrace_CALL)
+                return PyObject_SetAttrString((PyObject*)frame, "f_trace_opcodes", Py_True);
+            if (what != PyTrace_OPCODE)
+                return 0;
+
+            budget* self = _current;
+            if (++self->_count <= self->_max_instructions)
+                return 0;
+
+            // 脚本即使拦截了该异常，后续的跟踪事件依然会再次触发，从而保证执行终止
+            PyErr_SetString(self->_type, "The call exceeded its instruction budget");
+            return -1;
+        }
+
+        bool         _active;
+        PyObject*    _type;
+        uint64_t     _max_instructions;
+        uint64_t     _count;
+        Py_tracefunc _saved_func;
+        PyObject*    _saved_obj;
+        budget*      _outer;
+
+        static thread_local budget* _current;
+    };
+
+    // 调用的嵌套深度与正在执行的(最外层)调用数量，用于在调用间隙检查回收策略
+    class call_scope
+    {
+    public:
+        call_scope(pyembed_private& p) : _p(p) {
+            if (_depth++ == 0)
+                _p._in_flight.fetch_add(1, std::memory_order_relaxed);
+        }
+        ~call_scope() {
+            if (--_depth == 0)
+                _p._in_flight.fetch_sub(1, std::memory_order_relaxed);
+        }
+        static bool outermost() { return _depth == 0; }
+
+    private:
+        pyembed_private& _p;
+        static thread_local int _depth;
+    };
+
+    // 看门狗，记录各线程最外层调用的开始时间，由看门狗自己的时间轮周期性地检查，
+    // 每个调用只需两次原子写入，而无需在时间轮上调度与取消定时器
+    class watchdog
+    {
+    public:
+        watchdog(pyembed_private& p)
+            : _record(nullptr)
+        {
+            if (p._watchdog_ms.load(std::memory_order_relaxed) <= 0 || !call_scope::outermost())
+                return;
+
+            _record = &current();
+            _record->started.store(now_ns(), std::memory_order_relaxed);
+        }
+
+        ~watchdog()
+        {
+            if (_record)
+                _record->started.store(0, std::memory_order_relaxed);
+        }
+
+        // 在看门狗的时间轮线程上调用，不获取GIL，输出超时且尚未输出过的调用
+        static void check(int64_t threshold_ns, int fd)
+        {
+            const int64_t now = now_ns();
+            bool stalled = false;
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (auto& item : _records)
+            {
+                const int64_t started = item->started.load(std::memory_order_relaxed);
+                if (!started || now - started < threshold_ns || item->reported == started)
+                    continue;
+
+                item->reported = started;
+                stalled = true;
+
+                char header[128];
+                int size = snprintf(header, sizeof(header),
+                    "pyembed watchdog: call on thread 0x%0*lx has run for %lld ms\n",
+                    int(sizeof(unsigned long) * 2), item->thread_id,
+                    (long long)((now - started) / 1000000));
+                write_fd(fd, header, size);
+            }
+
+            if (stalled)
+                pyembed::dump_python_stacks(fd);
+        }
+
+    private:
+        struct record
+        {
+            std::atomic<int64_t> started{ 0 };  // 调用的开始时间(纳秒)，0表示没有调用
+            int64_t              reported = 0;  // 最近一次输出的调用的开始时间
+            unsigned long        thread_id = PyThread_get_thread_ident();
+        };
+
+        static int64_t now_ns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // 线程首次调用时登记，线程退出后保留
+        static record& current()
+        {
+            thread_local record* local = nullptr;
+            if (!local)
+            {
+                auto created = std::make_unique<record>();
+                std::lock_guard<std::mutex> lock(_mutex);
+                local = created.get();
+                _records.push_back(std::move(created));
+            }
+            return *local;
+        }
+
+        record* _record;
+
+        static std::mutex                           _mutex;
+        static std::vector<std::unique_ptr<record>> _records;
+    };
+
+    // 看门狗使用独立的时间轮，写入 fd 时的阻塞也不会推迟调用期限
+    pytimer_wheel* watchdog_timer()
+    {
+        std::call_once(_watchdog_once, [this]() { _watchdog_timer = std::make_unique<pytimer_wheel>(); });
+        return _watchdog_timer.get();
+    }
+
+    // 周期性地检查看门狗，时长改变或关闭后停止
+    void watch(uint64_t generation)
+    {
+        const int64_t threshold = _watchdog_ms.load(std::memory_order_relaxed);
+        if (threshold <= 0 || generation != _watchdog_generation.load(std::memory_order_relaxed))
+            return;
+
+        watchdog::check(threshold * 1000000, _watchdog_fd.load(std::memory_order_relaxed));
+        watchdog_timer()->schedule(std::chrono::milliseconds(std::max<int64_t>(threshold / 2, 1)),
+            [this, generation]() { watch(generation); });
+    }
+
+    static void write_fd(int fd, const char* data, size_t size)
+    {
+#if OS_WIN
+        _write(fd, data, unsigned(size));
+#else
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written <= 0)
+                return;
+            data += written;
+            size -= written;
+        }
+#endif
+    }
+
     void exec_for(
         const std::function<void()>& f, 
-        const std::function<bool(const pyembed::pyerror&)>& e = {})
+        const std::function<bool(const pyembed::pyerror&)>& e = {},
+        const pyembed::pylimits& limits = {})
+    {
+        {
+            watchdog dog(*this);
+            call_scope scope(*this);
+            run_for(f, e, limits);
+        }
+
+        if (call_scope::outermost())
+            maybe_recycle();
+    }
+
+    void run_for(
+        const std::function<void()>& f, 
+        const std::function<bool(const pyembed::pyerror&)>& e,
+        const pyembed::pylimits& limits)
     {
+        deadline guard(*this, limits);
+        cpu_budget cpu(*this, limits);
+        budget meter(*this, limits);
         try 
         {
             f();
         }
         catch (const bp::error_already_set&)
         {
+            if (PyErr_ExceptionMatches(_timeout.ptr()))
+            {
+                PyErr_Clear();
+                throw pyembed::timeout_error(boost::str(boost::format(
+                    "The call exceeded its deadline of %1% ms") % limits.timeout.count()));
+            }
+
+            if (PyErr_ExceptionMatches(_budget.ptr()))
+            {
+                // 指令预算由跟踪钩子抛出并携带描述，CPU时间预算由异步异常注入，不带参数
+                PyObject* exc_type, * exc_value, * exc_traceback;
+                PyErr_Fetch(&exc_type, &exc_value, &exc_traceback);
+                PyErr_NormalizeException(&exc_type, &exc_value, &exc_traceback);
+                bp::handle<> type(bp::allow_null(exc_type));
+                bp::handle<> value(bp::allow_null(exc_value));
+                bp::handle<> traceback(bp::allow_null(exc_traceback));
+
+                std::string message;
+                if (value)
+                    message = bp::extract<std::string>(bp::str(bp::object(value)))();
+                if (message.empty())
+                    message = boost::str(boost::format(
+                        "The call exceeded its CPU time budget of %1% ms") % limits.max_cpu_time.count());
+                throw pyembed::budget_error(message);
+            }
+
             if (e)
             {
                 // https://docs.python.org/zh-cn/3.6/c-api/exceptions.html#c.PyErr_Fetch
@@ -183,6 +708,436 @@ public:
         }
     }
 
+    // 在脚本执行期间设置 sys.argv，结束后重置
+    class argv_scope
+    {
+    public:
+        argv_scope(
+            const std::filesystem::path& filename,
+            const std::vector<std::string>& args)
+        {
+            std::vector<std::wstring> argd(1, filename.wstring());
+            for (auto& i : args)
+            {
+                std::wstring output;
+                util::conv::utf8_to_wstring(i, output);
+                argd.push_back(output);
+            }
+
+            std::vector<wchar_t*> argv;
+            for (const auto& i : argd)
+                argv.push_back((wchar_t*)i.c_str());
+
+            // PySys_SetArgvEx()要求参数argv[0]须为执行的脚本文件
+            // https://docs.python.org/3/c-api/init.html?highlight=pysys_setargvex#c.PySys_SetArgvEx
+            // Set sys.argv based on argc and argv. 
+            // These parameters are similar to those passed to the program's main() 
+            // function with the difference that the first entry should refer to 
+            // the script file to be executed rather than the executable hosting 
+            // the Python interpreter. If there isn't a script that will be run, 
+            // the first entry in argv can be an empty string. 
+            PySys_SetArgvEx(argv.size(), (wchar_t**)&argv[0], 1);
+        }
+
+        ~argv_scope()
+        {
+            std::vector<wchar_t*> argv(1, L"");
+            PySys_SetArgvEx(argv.size(), (wchar_t**)&argv[0], 1); // 重置参数
+        }
+    };
+
+    bp::object exec_file(
+        const std::filesystem::path& filename,
+        const std::vector<std::string>& args,
+        bp::dict& global,
+        bp::dict& local)
+    {
+        argv_scope scope(filename, args);
+
+#if OS_WIN
+        // 运行脚本
+        // https://docs.python.org/3/c-api/veryhigh.html?highlight=pyrun_string#c.PyRun_FileExFlags
+        FILE* fs = _Py_wfopen(filename.c_str(), L"r");
+        PyObject* pyobj = PyRun_FileExFlags(
+            fs,
+            filename.u8string().c_str(),
+            Py_file_input,
+            global.ptr(), 
+            local.ptr(),
+            true,
+            nullptr);
+
+        if (!pyobj)
+            throw bp::error_already_set();
+        return bp::object(bp::handle<>(pyobj));
+#else
+        // 不支持宽字节
+        return bp::exec_file(filename.string().c_str(), global, local);
+#endif
+    }
+
+    bp::object run_code(
+        const bp::object& code,
+        const std::filesystem::path& filename,
+        const std::vector<std::string>& args,
+        bp::dict& global,
+        bp::dict& local)
+    {
+        argv_scope scope(filename, args);
+
+        PyObject* pyobj = PyEval_EvalCode(code.ptr(), global.ptr(), local.ptr());
+        if (!pyobj)
+            throw bp::error_already_set();
+        return bp::object(bp::handle<>(pyobj));
+    }
+
+    // 编译脚本并原子地替换代码对象，失败时保留旧版本
+    bool compile(
+        pyembed::pyscript& compiled,
+        const std::function<bool(const pyembed::pyerror&)>& e)
+    {
+        // 读取文件期间不持有GIL(调用方持有时暂时释放)，仅在编译与替换代码对象时获取
+        std::string source, error;
+        {
+            pyembed::gil_release unlock;
+            std::ifstream stream(compiled._path, std::ios::in | std::ios::binary);
+            source.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+            if (!stream.good() && !stream.eof())
+                error = "Failed to read " + compiled._path.u8string();
+        }
+
+        if (error.empty())
+        {
+            const std::string filename = compiled._path.u8string();
+            pyembed::gil_acquire gil("compile", &filename);
+            exec_for([&]() {
+                pyembed::trace_scope span("compile", "compile", &filename);
+                PyObject* code = Py_CompileStringExFlags(
+                    source.c_str(),
+                    filename.c_str(),
+                    Py_file_input,
+                    nullptr,
+                    -1);
+                if (!code)
+                    bp::throw_error_already_set();
+
+                std::atomic_store(&compiled._code,
+                    std::make_shared<bp::object>(bp::handle<>(code)));
+                compiled._version.fetch_add(1);
+                }, [&](const pyembed::pyerror& pyerr) {
+                    error = pyerr.format_exception();
+                    return e ? e(pyerr) : false;
+                });
+        }
+
+        std::lock_guard<std::mutex> lock(compiled._mutex);
+        compiled._error = error;
+        return error.empty();
+    }
+
+    // 在监视线程上调用，重新编译发生变更的脚本
+    void reload(const std::filesystem::path& file)
+    {
+        std::vector<pyembed::script> scripts;
+        {
+            std::lock_guard<std::mutex> lock(_watched_mutex);
+            auto iter = _watched.find(file);
+            if (iter == _watched.end())
+                return;
+            for (const auto& item : iter->second)
+            {
+                if (auto compiled = item.lock())
+                    scripts.push_back(compiled);
+            }
+        }
+
+        for (const auto& compiled : scripts)
+            compile(*compiled, compiled->_handler);
+
+        // 脚本可能已被释放，最后的引用须在持有GIL时析构代码对象
+        pyembed::gil_acquire gil("reload");
+        scripts.clear();
+    }
+
+    // 查找当前异常的转换器，返回转换后的Python异常类型，没有匹配的返回nullptr
+    // type 为异常的动态类型(无法获得时为空)，e 为异常对象(非std::exception时为空)
+    PyObject* find_translator(const std::type_info* type, const std::exception* e, std::string& message)
+    {
+        std::lock_guard<std::mutex> lock(_translator_mutex);
+        if (type)
+        {
+            auto iter = _translated.find(*type);
+            if (iter != _translated.end())
+            {
+                if (iter->second < 0)
+                    return nullptr;
+
+                const auto& item = _translators[iter->second];
+                if (e && item.describe)
+                    message = item.describe(*e);
+                else
+                    item.rethrow(message);
+                return item.pytype;
+            }
+        }
+
+        // 首次出现的类型，按注册的逆序匹配基类
+        int index = int(_translators.size()) - 1;
+        for (; index >= 0; --index)
+        {
+            if (_translators[index].rethrow(message))
+                break;
+        }
+
+        if (type)
+            _translated[*type] = index;
+        return index < 0 ? nullptr : _translators[index].pytype;
+    }
+
+    // 异常转换表，作为一个整体加入boost.python的异常处理链
+    void translate(const boost::function0<void>& f)
+    {
+        std::string message;
+        PyObject* pytype = nullptr;
+        try
+        {
+            f();
+            return;
+        }
+        catch (const std::exception& e)
+        {
+            pytype = find_translator(&typeid(e), &e, message);
+            if (!pytype)
+                throw;
+        }
+        catch (...)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            pytype = find_translator(abi::__cxa_current_exception_type(), nullptr, message);
+#else
+            pytype = find_translator(nullptr, nullptr, message);
+#endif
+            if (!pytype)
+                throw;
+        }
+
+        if (message.empty())
+            PyErr_SetNone(pytype);
+        else
+            PyErr_SetString(pytype, message.c_str());
+    }
+
+    // 重置上下文的命名空间，仅保留内建层
+    // 每个上下文持有内建层的副本(浅复制)，脚本修改 __builtins__ 不会影响其他上下文；
+    // 不使用只读映射(types.MappingProxyType)，因为非dict的内建层使全局名字的查找失去特化
+    void reset_context(pyembed::pycontext& ctx)
+    {
+        ctx.space.clear();
+        ctx.space["__builtins__"] = bp::dict(_builtins);
+        ctx.space["__name__"] = "__main__";
+    }
+
+    // 在最外层调用结束后检查回收策略
+    void maybe_recycle()
+    {
+        const uint64_t jobs = _jobs.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (!_recycling.load(std::memory_order_relaxed))
+            return;
+        if (_in_flight.load(std::memory_order_relaxed) != 0 ||
+            _deferrals.load(std::memory_order_relaxed) != 0)
+            return;
+
+        // 其他线程正在回收
+        std::unique_lock<std::mutex> running(_recycle_running, std::try_to_lock);
+        if (!running)
+            return;
+
+        const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        bool due = false;
+        {
+            std::lock_guard<std::mutex> lock(_recycle_mutex);
+            due = (_policy.max_jobs && jobs >= _policy.max_jobs) ||
+                (_policy.max_age.count() > 0 &&
+                    now - _born >= std::chrono::duration_cast<std::chrono::nanoseconds>(_policy.max_age).count());
+
+            // 读取常驻内存需要系统调用，因此限制采样频率
+            if (!due && _policy.max_rss && now - _rss_sampled >= 100000000)
+            {
+                _rss_sampled = now;
+                due = pymemory::resident_size() >= _rss_limit;
+            }
+        }
+
+        if (due)
+            recycle();
+    }
+
+    // 回收解释器，调用方需持有GIL与 _recycle_running
+    // 期间会释放GIL，因此不能持有 _recycle_mutex，否则持有GIL并等待该锁的线程(如 add_warmup())将造成死锁
+    pyembed::pyrecycle_result recycle()
+    {
+        // 重放预热动作期间的调用不再检查回收策略
+        call_scope scope(*this);
+        _recycler.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
+        std::vector<std::string> keep_modules;
+        {
+            std::lock_guard<std::mutex> lock(_recycle_mutex);
+            keep_modules = _policy.keep_modules;
+        }
+
+        pyembed::pyrecycle_result result = { 0, pymemory::resident_size(), 0 };
+        exec_for([&]() {
+            // 重置默认上下文与所有命名上下文，共享层恢复为 builtins 模块字典的副本
+            std::vector<pyembed::context> contexts;
+            {
+                std::lock_guard<std::mutex> lock(_contexts_mutex);
+                _builtins = bp::dict(bp::import("builtins").attr("__dict__"));
+                for (auto& item : _contexts)
+                    contexts.push_back(item.second);
+            }
+            for (auto& ctx : contexts)
+            {
+                reset_context(*ctx);
+                ctx->image = bp::object();
+            }
+            contexts.clear();
+
+            _self->clean();
+            _image = bp::object();
+
+            // 清除初始化后导入的Python模块，内建模块与扩展模块无法卸载，予以保留；
+            // 扩展模块不会重新初始化，重新导入其所在的包将得到不一致的状态(如numpy)，因此整个包予以保留
+            static const char* const purge_py =
+                "def purge(baseline, keep):                                             \n"
+                "    import sys                                                         \n"
+                "    from importlib.machinery import EXTENSION_SUFFIXES                 \n"
+                "    def origin(name):                                                  \n"
+                "        spec = getattr(sys.modules.get(name), '__spec__', None)        \n"
+                "        return getattr(spec, 'origin', None)                           \n"
+                "    keep = set(keep)                                                   \n"
+                "    suffixes = tuple(EXTENSION_SUFFIXES)                               \n"
+                "    for name in list(sys.modules):                                     \n"
+                "        path = origin(name)                                            \n"
+                "        if '.' in name and path and path.endswith(suffixes):           \n"
+                "            keep.add(name.partition('.')[0])                           \n"
+                "    removed = 0                                                        \n"
+                "    for name in list(sys.modules):                                     \n"
+                "        if name in baseline:                                           \n"
+                "            continue                                                   \n"
+                "        if any(name == k or name.startswith(k + '.') for k in keep):   \n"
+                "            continue                                                   \n"
+                "        path = origin(name)                                            \n"
+                "        if path is not None and not path.endswith(('.py', '.pyc')):    \n"
+                "            continue                                                   \n"
+                "        del sys.modules[name]                                          \n"
+                "        removed += 1                                                   \n"
+                "    return removed                                                     \n";
+
+            bp::dict space;
+            space["__builtins__"] = bp::import("builtins");
+            bp::exec(purge_py, space, space);
+
+            bp::list keep;
+            for (const auto& name : keep_modules)
+                keep.append(name);
+            result.modules = bp::extract<size_t>(space["purge"](_baseline, keep));
+            space.clear();
+
+            bp::import("gc").attr("collect")();
+            bp::import("sys").attr("_clear_type_cache")();
+            bp::import("importlib").attr("invalidate_caches")();
+            });
+
+        // 归还内存可能需要较长时间，期间不持有GIL
+        {
+            pyembed::gil_release unlock;
+            pymemory::trim();
+        }
+
+        if (!_preamble.empty())
+            _self->set_preamble(_preamble);
+
+        // 重放预热动作，同时移除已失效的条目；
+        // 重放副本且不持有锁，预热动作中可以登记新的预热动作(如扩容上下文池)
+        std::vector<warmup> warmups;
+        {
+            std::lock_guard<std::mutex> lock(_recycle_mutex);
+            _warmups.erase(std::remove_if(_warmups.begin(), _warmups.end(),
+                [](const warmup& item) { return item.scoped && item.ctx.expired(); }),
+                _warmups.end());
+            warmups = _warmups;
+        }
+        for (const auto& item : warmups)
+        {
+            pyembed::context ctx = item.ctx.lock();
+            if (item.scoped && !ctx)
+                continue;
+            exec_for([&]() { item.action(ctx); });
+        }
+
+        _jobs.store(0, std::memory_order_relaxed);
+        result.rss_after = pymemory::resident_size();
+
+        std::lock_guard<std::mutex> lock(_recycle_mutex);
+        _born = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        // 回收后常驻内存仍未低于上限时(如内存由宿主程序占用)，再次回收无济于事，
+        // 因此以回收后的常驻内存为基线，增长超过25%后才再次触发，回收后低于上限时恢复原上限
+        if (_policy.max_rss && result.rss_after >= _policy.max_rss)
+            _rss_limit = result.rss_after + result.rss_after / 4;
+        else
+            _rss_limit = _policy.max_rss;
+        _recycler.store(std::thread::id(), std::memory_order_relaxed);
+        return result;
+    }
+
+    // 将命名空间恢复为快照的内容，仅写入发生变化的键
+    // 需要遍历整个命名空间(及删除键时的快照)，开销与命名空间的大小成正比；
+    // 记录被写入的键需要字典监视器(PyDict_AddWatcher，3.12+)，在支持的版本范围内无法统一实现
+    static void restore_space(PyObject* space, PyObject* image)
+    {
+        // 迭代期间允许修改已有键的值，但不能增删键，因此删除操作延后执行
+        std::vector<bp::object> removed;
+        PyObject* key, * value;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(space, &pos, &key, &value))
+        {
+            PyObject* saved = PyDict_GetItemWithError(image, key);
+            if (saved == nullptr)
+            {
+                if (PyErr_Occurred())
+                    bp::throw_error_already_set();
+                removed.push_back(bp::object(bp::handle<>(bp::borrowed(key))));
+            }
+            else if (saved != value)
+            {
+                if (PyDict_SetItem(space, key, saved) != 0)
+                    bp::throw_error_already_set();
+            }
+        }
+
+        for (const auto& item : removed)
+        {
+            if (PyDict_DelItem(space, item.ptr()) != 0)
+                bp::throw_error_already_set();
+        }
+
+        // 此时命名空间的键是快照的子集，数量一致则说明没有被删除的键
+        if (PyDict_Size(space) == PyDict_Size(image))
+            return;
+
+        pos = 0;
+        while (PyDict_Next(image, &pos, &key, &value))
+        {
+            if (PyDict_SetDefault(space, key, value) == nullptr)
+                bp::throw_error_already_set();
+        }
+    }
+
     static void signal_handler(int signum)
     {
         if (signum == SIGINT)
@@ -194,18 +1149,71 @@ public:
 public:
     bool  _initsigs;   // 是否初始化信号处理器
     bool  _redirect;   // 是否重定向标准流
+    std::atomic<bool> _release_sinks{ true }; // 调用重定向接口期间是否释放GIL
 
     std::shared_ptr<bp::object> _main_module;
     std::shared_ptr<bp::dict>   _global;
     std::shared_ptr<bp::dict>   _local;
+
+    bp::object                                _builtins; // 上下文共享的内建/预置层
+    bp::object                                _image;    // 默认上下文的快照
+    bp::object                                _timeout;  // 超时注入的异常类型(pyembed.Timeout)
+    bp::object                                _budget;   // 超出预算的异常类型(pyembed.BudgetExceeded)
+    std::unique_ptr<pytimer_wheel>            _timer;    // 调用期限的时间轮，首次使用时创建
+    std::once_flag                            _timer_once;
+    std::unique_ptr<pyexecutor>               _injector; // 注入异步异常的线程，首次使用时创建
+    std::once_flag                            _injector_once;
+    std::unique_ptr<pywatcher>                _watcher;  // 脚本变更监视器，首次使用时创建
+    std::once_flag                            _watcher_once;
+    std::mutex                                _watched_mutex;
+    std::map<std::filesystem::path,
+        std::vector<std::weak_ptr<pyembed::pyscript>>> _watched; // 热重载的脚本
+    std::mutex                                _contexts_mutex;
+    std::map<std::string, pyembed::context>   _contexts; // 命名执行上下文
+    std::mutex                                _translator_mutex;
+    std::vector<pyembed::pytranslator>        _translators; // 异常转换器，按注册顺序
+    std::unordered_map<std::type_index, int>  _translated;  // 异常的动态类型到转换器的映射，-1表示没有匹配
     
-    static pyembed* _public;
+    // 回收
+    struct warmup
+    {
+        bool                                          scoped; // 是否属于命名上下文(否则为默认上下文)
+        std::weak_ptr<pyembed::pycontext>             ctx;
+        std::function<void(const pyembed::context&)>  action;
+    };
+
+    std::string                               _preamble;  // 最近一次成功设置的预置代码，回收后重放
+    bp::object                                _baseline;  // 初始化完成时已导入的模块名(frozenset)
+    std::mutex                                _recycle_mutex;   // 保护回收策略与预热动作，仅短暂持有，期间不调用Python
+    std::mutex                                _recycle_running; // 回收期间持有，获取顺序为 _recycle_running -> GIL
+    std::atomic<std::thread::id>              _recycler;        // 正在回收的线程
+    pyembed::pyrecycle_policy                 _policy;
+    std::vector<warmup>                       _warmups;
+    std::atomic<bool>                         _recycling{ false }; // 是否设置了自动回收的条件
+    std::atomic<uint64_t>                     _jobs{ 0 };       // 上次回收后的调用次数
+    std::atomic<int>                          _in_flight{ 0 };  // 正在执行的调用数量
+    std::atomic<int>                          _deferrals{ 0 };  // defer_recycle() 的计数
+    int64_t                                   _born = 0;        // 上次回收(或初始化)的时间(纳秒)
+    int64_t                                   _rss_sampled = 0; // 上次采样常驻内存的时间(纳秒)
+    size_t                                    _rss_limit = 0;   // 触发回收的常驻内存，参考 recycle()
+    std::atomic<int64_t>                      _watchdog_ms{ 0 };    // 看门狗的时长，0表示关闭
+    std::atomic<int>                          _watchdog_fd{ 2 };
+    std::atomic<uint64_t>                     _watchdog_generation{ 0 };
+    std::unique_ptr<pytimer_wheel>            _watchdog_timer; // 看门狗的时间轮，首次使用时创建
+    std::once_flag                            _watchdog_once;
+
+    pyembed* _self;                         // 所属的实例
+    static std::atomic<pyembed*> _public;   // 由 pyembed::get() 发布的单例
     static boost::shared_ptr<stdin_redirector>  _stdin;
     static boost::shared_ptr<stdout_redirector> _stdout;
     static boost::shared_ptr<stderr_redirector> _stderr;
 };
 
-pyembed* pyembed_private::_public = nullptr;
+std::atomic<pyembed*> pyembed_private::_public{ nullptr };
+thread_local pyembed_private::budget* pyembed_private::budget::_current = nullptr;
+thread_local int pyembed_private::call_scope::_depth = 0;
+std::mutex pyembed_private::watchdog::_mutex;
+std::vector<std::unique_ptr<pyembed_private::watchdog::record>> pyembed_private::watchdog::_records;
 boost::shared_ptr<stdin_redirector>  pyembed_private::_stdin;
 boost::shared_ptr<stdout_redirector> pyembed_private::_stdout;
 boost::shared_ptr<stderr_redirector> pyembed_private::_stderr;
@@ -213,18 +1221,19 @@ boost::shared_ptr<stderr_redirector> pyembed_private::_stderr;
 //////////////////////////////////////////////////////////////////////////
 
 boost::shared_ptr<stdin_redirector>  get_stdin(){
-    return pyembed_private::_stdin;
+    return boost::atomic_load(&pyembed_private::_stdin);
 }
 boost::shared_ptr<stdout_redirector> get_stdout() {
-    return pyembed_private::_stdout;
+    return boost::atomic_load(&pyembed_private::_stdout);
 }
 boost::shared_ptr<stderr_redirector> get_stderr() {
-    return pyembed_private::_stderr;
+    return boost::atomic_load(&pyembed_private::_stderr);
 }
 
 BOOST_PYTHON_MODULE(redirector)
 {
     using namespace boost::python;
+    PYEMBED_MODULE_GIL_NOT_USED();
 
     class_<stdin_redirector>("stdin",
         "This class redirects python's standard input to the pyembed.",
@@ -263,12 +1272,24 @@ pyembed::~pyembed()
 
 pyembed* pyembed::get_ptr()
 {
-    return pyembed_private::_public;
+    return pyembed_private::_public.load(std::memory_order_acquire);
+}
+
+void pyembed::set_ptr(pyembed* instance)
+{
+    pyembed_private::_public.store(instance, std::memory_order_release);
+}
+
+std::mutex& pyembed::get_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
 }
 
 void pyembed::init(
     const std::filesystem::path& pyhome /*= ""*/,
-    bool initsigs /*= true*/)
+    bool initsigs /*= true*/,
+    bool perf_profiling /*= false*/)
 {
     // Register the module with the interpreter; must be called before Py_Initialize.
     /* ToDo: C style cast to avoid compiler warning about
@@ -307,7 +1328,7 @@ void pyembed::init(
             "import sys\n"
             "import redirector\n"
             "sys.stdin  = redirector.stdin()\n"
-            "sys.stdout = redirector.stdout()\n";
+            "sys.stdout = redirector.stdout()\n"
             "sys.stderr = redirector.stderr()\n";
 
 #if 1
@@ -320,6 +1341,15 @@ void pyembed::init(
             __private->_global.ptr(), __private->_global.ptr());
 #endif
     }
+
+    if (perf_profiling)
+        set_perf_profiling(true);
+
+    // 回收时保留初始化期间导入的模块
+    __private->_baseline = bp::object(bp::handle<>(
+        PyFrozenSet_New(PySys_GetObject("modules"))));
+    __private->_born = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 void pyembed::interrupt()
@@ -331,6 +1361,29 @@ void pyembed::interrupt()
     PyErr_SetInterrupt();
 }
 
+void pyembed::dump_python_stacks(int fd)
+{
+    // 仅读取运行时的全局状态，不分配内存也不获取锁
+    if (!Py_IsInitialized())
+        return;
+
+    const char* error = _Py_DumpTracebackThreads(
+        fd, PyInterpreterState_Main(), PyGILState_GetThisThreadState());
+    if (error)
+    {
+        pyembed_private::write_fd(fd, error, strlen(error));
+        pyembed_private::write_fd(fd, "\n", 1);
+    }
+}
+
+void pyembed::set_watchdog(std::chrono::milliseconds threshold, int fd /*= 2*/)
+{
+    gil_acquire gil("set_watchdog");
+    __private->_watchdog_fd.store(fd, std::memory_order_relaxed);
+    __private->_watchdog_ms.store(std::max<int64_t>(threshold.count(), 0), std::memory_order_relaxed);
+    __private->watch(++__private->_watchdog_generation);
+}
+
 bool pyembed::append_inittab(
     const char* name, PyObject* (*initfunc)(void))
 {
@@ -369,105 +1422,88 @@ void pyembed::register_exception_handler(
         });
 }
 
+void pyembed::register_exception_translator(
+    const std::type_info& type,
+    const pytranslator& translator)
+{
+    Py_XINCREF(translator.pytype);
+
+    std::lock_guard<std::mutex> lock(__private->_translator_mutex);
+    __private->_translators.push_back(translator);
+
+    // 新的转换器可能改变派生类型的匹配结果
+    __private->_translated.clear();
+    __private->_translated[type] = int(__private->_translators.size()) - 1;
+
+    if (__private->_translators.size() == 1)
+    {
+        namespace bpy = boost::python::detail;
+        bpy::register_exception_handler([p = __private](
+            bpy::exception_handler const& e,
+            boost::function0<void> const& f) -> bool {
+                return e([=]{ p->translate(f); });
+            });
+    }
+}
+
 boost::python::object pyembed::eval(
     const std::string& expression,
-    const std::function<bool(const pyerror&)>& exception_handler /*= {} */)
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
 {
+    gil_acquire gil("eval", &expression);
     boost::python::object result;
     __private->exec_for([&]() {
         result = bp::eval(expression.c_str(),
             *__private->_global,
             *__private->_local);
-        }, exception_handler);
+        }, exception_handler, limits);
     return result;
 }
 
 boost::python::object pyembed::exec(
     const std::string& snippets,
-    const std::function<bool(const pyerror&)>& exception_handler /*= {} */)
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
 {
+    gil_acquire gil("exec", &snippets);
     boost::python::object result;
     __private->exec_for([&]() {
         result = bp::exec(snippets.c_str(),
             *__private->_global, 
             *__private->_local);
-        }, exception_handler);
+        }, exception_handler, limits);
     return result;
 }
 
 boost::python::object pyembed::exec_file(
     const std::filesystem::path& script, 
     const std::vector<std::string>& args /*= {}*/,
-    const std::function<bool(const pyerror&)>& exception_handler /*= {} */)
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
 {
     // 脚本文件获取绝对路径
-    std::error_code ecode;
     std::filesystem::path filename =
         std::filesystem::canonical(script);
+    const std::string detail = filename.string();
 
+    gil_acquire gil("exec_file", &detail);
     boost::python::object result;
-    __private->exec_for([=, &result]()
-    {
-        std::vector<std::wstring> argd(1, filename.wstring());
-        for (auto& i : args)
-        {
-            std::wstring output;
-            util::conv::utf8_to_wstring(i, output);
-            argd.push_back(output);
-        }
-
-        std::vector<wchar_t*> argv;
-        for (const auto& i : argd)
-            argv.push_back((wchar_t*)i.c_str());
-
-        // PySys_SetArgvEx()要求参数argv[0]须为执行的脚本文件
-        // https://docs.python.org/3/c-api/init.html?highlight=pysys_setargvex#c.PySys_SetArgvEx
-        // Set sys.argv based on argc and argv. 
-        // These parameters are similar to those passed to the program's main() 
-        // function with the difference that the first entry should refer to 
-        // the script file to be executed rather than the executable hosting 
-        // the Python interpreter. If there isn't a script that will be run, 
-        // the first entry in argv can be an empty string. 
-        PySys_SetArgvEx(argv.size(), (wchar_t**)&argv[0], 1);
-        struct _scope {
-            ~_scope() {
-                std::vector<wchar_t*> argv(1, L"");
-                PySys_SetArgvEx(argv.size(), (wchar_t**)&argv[0], 1); // 重置参数
-            }
-        } _clean;
-
-#if OS_WIN
-        // 运行脚本
-        // https://docs.python.org/3/c-api/veryhigh.html?highlight=pyrun_string#c.PyRun_FileExFlags
-        FILE* fs = _Py_wfopen(filename.c_str(), L"r");
-        PyObject* pyobj = PyRun_FileExFlags(
-            fs,
-            filename.u8string().c_str(),
-            Py_file_input,
-            __private->_global->ptr(), 
-            __private->_local->ptr(),
-            true,
-            nullptr);
-
-        if (!pyobj)
-            throw bp::error_already_set();
-        result = bp::object(bp::handle<>(pyobj));
-#else
-        // 不支持宽字节
-        result = bp::exec_file(
-           filename.string().c_str(), *__private->_global, *__private->_local);
-#endif
-
-    }, exception_handler);
-
+    __private->exec_for([&]() {
+        result = __private->exec_file(filename, args,
+            *__private->_global,
+            *__private->_local);
+        }, exception_handler, limits);
     return result;
 }
 
 void pyembed::exec_for(
     const std::function<void()>& action,
-    const std::function<bool(const pyerror&)>& exception_handler /*= {} */)
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
 {
-    __private->exec_for(action, exception_handler);
+    gil_acquire gil("exec_for");
+    __private->exec_for(action, exception_handler, limits);
 }
 
 boost::python::dict& pyembed::global()
@@ -480,16 +1516,385 @@ boost::python::dict& pyembed::local()
     return *__private->_local;
 }
 
+// 读取字典中的值(新引用)，不存在时返回nullptr且不设置异常
+static PyObject* dict_get(PyObject* space, PyObject* key)
+{
+#if PY_VERSION_HEX >= 0x030D0000
+    // 自由线程构建中借用引用可能被其他线程释放
+    PyObject* value = nullptr;
+    if (PyDict_GetItemRef(space, key, &value) < 0)
+        bp::throw_error_already_set();
+    return value;
+#else
+    PyObject* value = PyDict_GetItemWithError(space, key);
+    if (!value && PyErr_Occurred())
+        bp::throw_error_already_set();
+    Py_XINCREF(value);
+    return value;
+#endif
+}
+
+boost::python::object pyembed::getitem(
+    const boost::python::dict& space,
+    const pykey& key)
+{
+    PyObject* value = dict_get(space.ptr(), key.ptr());
+    if (!value)
+    {
+        PyErr_SetObject(PyExc_KeyError, key.ptr());
+        bp::throw_error_already_set();
+    }
+    return bp::object(bp::handle<>(value));
+}
+
+boost::python::object pyembed::getitem(
+    const boost::python::dict& space,
+    const pykey& key,
+    const boost::python::object& fallback)
+{
+    PyObject* value = dict_get(space.ptr(), key.ptr());
+    if (!value)
+        return fallback;
+    return bp::object(bp::handle<>(value));
+}
+
+void pyembed::setitem(
+    boost::python::dict& space,
+    const pykey& key,
+    const boost::python::object& value)
+{
+    if (PyDict_SetItem(space.ptr(), key.ptr(), value.ptr()) != 0)
+        bp::throw_error_already_set();
+}
+
 void pyembed::clean()
 {
-    boost::python::object builtins = global()["__builtins__"];
+    gil_acquire gil("clean");
+    boost::python::object builtins = getitem(global(), PYEMBED_KEY("__builtins__"));
 
     local().clear();
     global().clear();
-    global()["__builtins__"] = builtins;
+    setitem(global(), PYEMBED_KEY("__builtins__"), builtins);
     local() = global();
 }
 
+bool pyembed::set_preamble(
+    const std::string& snippets,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */)
+{
+    gil_acquire gil("set_preamble", &snippets);
+    bool succeeded = false;
+    __private->exec_for([&]() {
+        // 预置代码在独立的命名空间中执行，完成后将其定义的名字合并到内建层的副本中
+        bp::object builtins = bp::import("builtins").attr("__dict__");
+        bp::dict space;
+        space["__builtins__"] = builtins;
+        bp::exec(snippets.c_str(), space, space);
+
+        // 预置代码中的函数以 space 作为 __globals__，3.10之前帧在调用时从中解析内建名字，
+        // 因此保留 space 中的 __builtins__，合并时跳过该键
+        bp::dict layer = bp::dict(builtins);
+        PyObject* key, * value;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(space.ptr(), &pos, &key, &value))
+        {
+            if (PyUnicode_Check(key) && PyUnicode_CompareWithASCIIString(key, "__builtins__") == 0)
+                continue;
+            if (PyDict_SetItem(layer.ptr(), key, value) != 0)
+                bp::throw_error_already_set();
+        }
+
+        // 替换共享层，并使已创建的上下文同样生效
+        std::vector<context> contexts;
+        {
+            std::lock_guard<std::mutex> lock(__private->_contexts_mutex);
+            __private->_builtins = layer;
+            for (auto& item : __private->_contexts)
+                contexts.push_back(item.second);
+        }
+        for (auto& ctx : contexts)
+            ctx->space["__builtins__"] = bp::dict(layer);
+        __private->_preamble = snippets;
+        succeeded = true;
+        }, exception_handler);
+    return succeeded;
+}
+
+pyembed::context pyembed::create_context(const std::string& name)
+{
+    gil_acquire gil("create_context", &name);
+    std::lock_guard<std::mutex> lock(__private->_contexts_mutex);
+    auto iter = __private->_contexts.find(name);
+    if (iter != __private->_contexts.end())
+        return iter->second;
+
+    auto ctx = std::make_shared<pycontext>();
+    ctx->name = name;
+    __private->reset_context(*ctx);
+    __private->_contexts[name] = ctx;
+    return ctx;
+}
+
+pyembed::context pyembed::get_context(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(__private->_contexts_mutex);
+    auto iter = __private->_contexts.find(name);
+    if (iter == __private->_contexts.end())
+        return nullptr;
+    return iter->second;
+}
+
+void pyembed::remove_context(const std::string& name)
+{
+    gil_acquire gil("remove_context", &name);
+    context removed; // 在锁外释放，命名空间的析构可能执行任意Python代码
+    std::lock_guard<std::mutex> lock(__private->_contexts_mutex);
+    auto iter = __private->_contexts.find(name);
+    if (iter == __private->_contexts.end())
+        return;
+    removed = iter->second;
+    __private->_contexts.erase(iter);
+}
+
+boost::python::object pyembed::eval(
+    const context& ctx,
+    const std::string& expression,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    gil_acquire gil("eval", &expression);
+    boost::python::object result;
+    __private->exec_for([&]() {
+        result = bp::eval(expression.c_str(), ctx->space, ctx->space);
+        }, exception_handler, limits);
+    return result;
+}
+
+boost::python::object pyembed::exec(
+    const context& ctx,
+    const std::string& snippets,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    gil_acquire gil("exec", &snippets);
+    boost::python::object result;
+    __private->exec_for([&]() {
+        result = bp::exec(snippets.c_str(), ctx->space, ctx->space);
+        }, exception_handler, limits);
+    return result;
+}
+
+boost::python::object pyembed::exec_file(
+    const context& ctx,
+    const std::filesystem::path& script,
+    const std::vector<std::string>& args /*= {}*/,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    std::filesystem::path filename =
+        std::filesystem::canonical(script);
+    const std::string detail = filename.string();
+
+    gil_acquire gil("exec_file", &detail);
+    boost::python::object result;
+    __private->exec_for([&]() {
+        result = __private->exec_file(filename, args, ctx->space, ctx->space);
+        }, exception_handler, limits);
+    return result;
+}
+
+void pyembed::clean(const context& ctx)
+{
+    gil_acquire gil("clean", &ctx->name);
+    __private->reset_context(*ctx);
+}
+
+void pyembed::snapshot(const context& ctx /*= nullptr*/)
+{
+    gil_acquire gil("snapshot", ctx ? &ctx->name : nullptr);
+    bp::dict& space = ctx ? ctx->space : global();
+    bp::object& image = ctx ? ctx->image : __private->_image;
+    image = space.copy();
+}
+
+bool pyembed::restore(const context& ctx /*= nullptr*/)
+{
+    gil_acquire gil("restore", ctx ? &ctx->name : nullptr);
+    bp::dict& space = ctx ? ctx->space : global();
+    bp::object& image = ctx ? ctx->image : __private->_image;
+    if (image.is_none())
+        return false;
+
+    bool succeeded = false;
+    __private->exec_for([&]() {
+        pyembed_private::restore_space(space.ptr(), image.ptr());
+        succeeded = true;
+        });
+    return succeeded;
+}
+
+void pyembed::set_recycle_policy(const pyrecycle_policy& policy)
+{
+    std::lock_guard<std::mutex> lock(__private->_recycle_mutex);
+    __private->_policy = policy;
+    __private->_rss_limit = policy.max_rss;
+    __private->_recycling = policy.max_rss || policy.max_jobs || policy.max_age.count() > 0;
+}
+
+void pyembed::defer_recycle()
+{
+    __private->_deferrals.fetch_add(1, std::memory_order_relaxed);
+}
+
+void pyembed::resume_recycle()
+{
+    __private->_deferrals.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void pyembed::add_warmup(
+    const context& ctx,
+    const std::function<void(const context&)>& warmup)
+{
+    std::lock_guard<std::mutex> lock(__private->_recycle_mutex);
+    __private->_warmups.push_back({ ctx != nullptr, ctx, warmup });
+}
+
+pyembed::pyrecycle_result pyembed::recycle()
+{
+    gil_acquire gil("recycle");
+
+    // 在预热动作中再次回收将等待自身
+    if (__private->_recycler.load(std::memory_order_relaxed) == std::this_thread::get_id())
+        return { 0, 0, 0 };
+
+    // 回收期间会释放GIL，因此须先获取 _recycle_running，等待期间释放GIL
+    std::unique_lock<std::mutex> running(__private->_recycle_running, std::defer_lock);
+    if (!running.try_lock())
+    {
+        gil_release unlock;
+        running.lock();
+    }
+    return __private->recycle();
+}
+
+pyembed::script pyembed::compile_file(
+    const std::filesystem::path& file,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */)
+{
+    auto compiled = std::make_shared<pyscript>();
+    compiled->_path = std::filesystem::canonical(file);
+    compiled->_handler = exception_handler;
+
+    if (!__private->compile(*compiled, exception_handler))
+        return nullptr;
+    return compiled;
+}
+
+pyembed::script pyembed::watch_file(
+    const std::filesystem::path& file,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */)
+{
+    gil_acquire gil("watch_file");
+    auto compiled = compile_file(file, exception_handler);
+    if (!compiled)
+        return nullptr;
+
+    std::call_once(__private->_watcher_once, [p = __private]() {
+        p->_watcher = std::make_unique<pywatcher>(
+            [p](const std::filesystem::path& changed) {
+                p->reload(changed);
+            });
+        });
+
+    {
+        std::lock_guard<std::mutex> lock(__private->_watched_mutex);
+        auto& scripts = __private->_watched[compiled->_path];
+        scripts.erase(std::remove_if(scripts.begin(), scripts.end(),
+            [](const std::weak_ptr<pyscript>& item) { return item.expired(); }),
+            scripts.end());
+        scripts.push_back(compiled);
+    }
+
+    // 无法使用inotify(如达到 max_user_instances 的上限)时改为比较修改时间，变更的发现将有延迟
+    if (!__private->_watcher->add(compiled->_path))
+    {
+        const std::string reason = std::system_category().message(__private->_watcher->error());
+        PySys_FormatStderr("pyembed: cannot watch %s with inotify (%s), polling its modification time instead\n",
+            compiled->_path.string().c_str(), reason.c_str());
+    }
+    return compiled;
+}
+
+void pyembed::unwatch_file(const script& compiled)
+{
+    gil_acquire gil("unwatch_file");
+    if (!compiled)
+        return;
+
+    // 脚本登记在 _watched 中时监视器必然已创建
+    std::lock_guard<std::mutex> lock(__private->_watched_mutex);
+    auto iter = __private->_watched.find(compiled->_path);
+    if (iter == __private->_watched.end())
+        return;
+
+    auto& scripts = iter->second;
+    scripts.erase(std::remove_if(scripts.begin(), scripts.end(),
+        [&](const std::weak_ptr<pyscript>& item) { 
+            auto locked = item.lock();
+            return !locked || locked == compiled; 
+        }), scripts.end());
+
+    if (scripts.empty())
+    {
+        __private->_watched.erase(iter);
+        __private->_watcher->remove(compiled->_path);
+    }
+}
+
+boost::python::object pyembed::exec_file(
+    const script& compiled,
+    const std::vector<std::string>& args /*= {}*/,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    const std::string detail = compiled->_path.string();
+    gil_acquire gil("exec_file", &detail);
+
+    // 持有当前版本的代码对象，执行期间即使被替换也不受影响
+    auto code = std::atomic_load(&compiled->_code);
+
+    boost::python::object result;
+    __private->exec_for([&]() {
+        result = __private->run_code(*code, compiled->_path, args,
+            *__private->_global,
+            *__private->_local);
+        }, exception_handler, limits);
+    return result;
+}
+
+boost::python::object pyembed::exec_file(
+    const context& ctx,
+    const script& compiled,
+    const std::vector<std::string>& args /*= {}*/,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    const std::string detail = compiled->_path.string();
+    gil_acquire gil("exec_file", &detail);
+    auto code = std::atomic_load(&compiled->_code);
+
+    boost::python::object result;
+    __private->exec_for([&]() {
+        result = __private->run_code(*code, compiled->_path, args, ctx->space, ctx->space);
+        }, exception_handler, limits);
+    return result;
+}
+
+void pyembed::set_redirect_gil_release(bool release)
+{
+    __private->_release_sinks.store(release, std::memory_order_relaxed);
+}
+
 void pyembed::write_stdout(const std::string& str)
 {
     // 如果派生类没有实现此接口，那么在调试模式下通过异常通知用户，否则通过输出信息。
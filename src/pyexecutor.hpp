@@ -0,0 +1,102 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#ifndef pyexecutor_h__
+#define pyexecutor_h__
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+//
+// 单线程的任务队列，按提交顺序执行任务
+//
+// 用于承接需要等待GIL的工作(如注入异步异常)，使时间轮线程的回调从不阻塞在GIL上。
+// 停止时丢弃尚未执行的任务，正在执行的任务须先完成，因此析构前调用方须释放GIL。
+//
+class pyexecutor
+{
+public:
+    typedef std::function<void()> task;
+
+    pyexecutor()
+        : _stop(false)
+    {
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ~pyexecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _tasks.clear();
+        }
+        _cond.notify_all();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    pyexecutor(const pyexecutor&) = delete;
+    pyexecutor& operator=(const pyexecutor&) = delete;
+
+    // 提交任务，不等待其执行
+    void post(task f)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stop)
+                return;
+            _tasks.push_back(std::move(f));
+        }
+        _cond.notify_one();
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _cond.wait(lock, [&] { return _stop || !_tasks.empty(); });
+            if (_stop)
+                break;
+
+            task f = std::move(_tasks.front());
+            _tasks.pop_front();
+
+            lock.unlock();
+            f();
+            lock.lock();
+        }
+    }
+
+private:
+    bool                    _stop;
+    std::deque<task>        _tasks;
+    std::mutex              _mutex;
+    std::condition_variable _cond;
+    std::thread             _thread;
+};
+
+#endif // pyexecutor_h__
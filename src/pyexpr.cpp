@@ -0,0 +1,659 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#include "pyembed.h"
+
+#include <map>
+#include <cmath>
+
+namespace bp = boost::python;
+
+//
+// 原生求值树
+// 
+// 树中的值仅有 int(int64_t)、float(double) 与 bool 三种，运算语义与解释器保持一致。
+// 结果可能与解释器不同的情形(整数溢出、除零、负数的非整数次幂、超出 2^53 的整数与浮点数的比较等)
+// 一律放弃原生求值，由调用方回退到解释器，由解释器给出结果或抛出异常。
+// 
+class pyexpr_program
+{
+public:
+    //! @brief 将 ast 表达式编译为原生求值树
+    //! @return 表达式包含不受支持的语法时返回nullptr
+    static std::shared_ptr<const pyexpr_program> build(const bp::object& body)
+    {
+        auto program = std::make_shared<pyexpr_program>();
+        program->_root = program->compile(body);
+        if (program->_root < 0)
+            return nullptr;
+        return program;
+    }
+
+    //! @brief 计算表达式
+    //! @param globals 全局命名空间
+    //! @param locals 局部命名空间，变量优先在其中查找
+    //! @return 返回计算结果(新引用)，无法原生计算时返回nullptr
+    PyObject* evaluate(PyObject* globals, PyObject* locals) const
+    {
+        value buffer[16];
+        std::unique_ptr<value[]> heap;
+        value* vars = buffer;
+        if (_names.size() > std::size(buffer))
+        {
+            heap.reset(new value[_names.size()]);
+            vars = heap.get();
+        }
+
+        for (size_t i = 0; i < _names.size(); ++i)
+        {
+#if PY_VERSION_HEX >= 0x030D0000
+            // 自由线程构建中借用引用可能被其他线程释放
+            PyObject* obj = nullptr;
+            if (PyDict_GetItemRef(locals, _names[i].ptr(), &obj) == 0 && locals != globals)
+                PyDict_GetItemRef(globals, _names[i].ptr(), &obj);
+            bp::handle<> holder(bp::allow_null(obj));
+#else
+            PyObject* obj = PyDict_GetItemWithError(locals, _names[i].ptr());
+            if (!obj && locals != globals)
+                obj = PyDict_GetItemWithError(globals, _names[i].ptr());
+#endif
+            if (!obj || !load(obj, vars[i]))
+            {
+                PyErr_Clear();
+                return nullptr;
+            }
+        }
+
+        value result;
+        if (!evaluate(_root, vars, result))
+            return nullptr;
+
+        switch (result.kind)
+        {
+        case value_kind::integer: return PyLong_FromLongLong(result.i);
+        case value_kind::real:    return PyFloat_FromDouble(result.d);
+        case value_kind::boolean: return PyBool_FromLong(result.i);
+        }
+        return nullptr;
+    }
+
+private:
+    enum class value_kind : uint8_t { integer, real, boolean };
+
+    struct value
+    {
+        value_kind kind = value_kind::integer;
+        union
+        {
+            int64_t i = 0;
+            double  d;
+        };
+
+        static value integer(int64_t v) { value r; r.kind = value_kind::integer; r.i = v; return r; }
+        static value real(double v)     { value r; r.kind = value_kind::real; r.d = v; return r; }
+        static value boolean(bool v)    { value r; r.kind = value_kind::boolean; r.i = v; return r; }
+
+        bool truth() const { return kind == value_kind::real ? d != 0.0 : i != 0; }
+        double as_real() const { return kind == value_kind::real ? d : double(i); }
+    };
+
+    enum class op : uint8_t
+    {
+        constant, variable,
+        add, sub, mul, truediv, floordiv, mod, pow,
+        neg, pos, invert, not_,
+        and_, or_, ifexp,
+        eq, ne, lt, le, gt, ge,
+    };
+
+    struct node
+    {
+        op      code;
+        int32_t a = -1;     // 左操作数、一元操作数、条件
+        int32_t b = -1;     // 右操作数、条件为真时的值
+        int32_t c = -1;     // 条件为假时的值
+        value   constant;   // 常量，或变量的序号(i)
+    };
+
+    // 超出该范围的整数与浮点数之间的比较或真除法无法用 double 精确表示
+    static constexpr int64_t exact_limit = int64_t(1) << 53;
+
+    static bool exact(int64_t v) { return v >= -exact_limit && v <= exact_limit; }
+
+    static bool add_overflow(int64_t x, int64_t y, int64_t* r)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_add_overflow(x, y, r);
+#else
+        if ((y > 0 && x > INT64_MAX - y) || (y < 0 && x < INT64_MIN - y))
+            return true;
+        *r = x + y;
+        return false;
+#endif
+    }
+
+    static bool sub_overflow(int64_t x, int64_t y, int64_t* r)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_sub_overflow(x, y, r);
+#else
+        if ((y < 0 && x > INT64_MAX + y) || (y > 0 && x < INT64_MIN + y))
+            return true;
+        *r = x - y;
+        return false;
+#endif
+    }
+
+    static bool mul_overflow(int64_t x, int64_t y, int64_t* r)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_mul_overflow(x, y, r);
+#else
+        if (x != 0 && y != 0)
+        {
+            if ((x == -1 && y == INT64_MIN) || (y == -1 && x == INT64_MIN))
+                return true;
+            if (x != -1 && y != -1 && 
+                (x > 0 ? (y > 0 ? x > INT64_MAX / y : y < INT64_MIN / x)
+                       : (y > 0 ? x < INT64_MIN / y : x < INT64_MAX / y)))
+                return true;
+        }
+        *r = x * y;
+        return false;
+#endif
+    }
+
+    static bool load(PyObject* obj, value& out)
+    {
+        if (PyBool_Check(obj))
+        {
+            out = value::boolean(obj == Py_True);
+            return true;
+        }
+        if (PyLong_CheckExact(obj))
+        {
+            int overflow = 0;
+            long long v = PyLong_AsLongLongAndOverflow(obj, &overflow);
+            if (overflow || (v == -1 && PyErr_Occurred()))
+                return false;
+            out = value::integer(v);
+            return true;
+        }
+        if (PyFloat_CheckExact(obj))
+        {
+            out = value::real(PyFloat_AS_DOUBLE(obj));
+            return true;
+        }
+        return false;
+    }
+
+    int32_t append(const node& item)
+    {
+        _nodes.push_back(item);
+        return int32_t(_nodes.size() - 1);
+    }
+
+    int32_t append(op code, int32_t a, int32_t b = -1, int32_t c = -1)
+    {
+        if (a < 0 || (b < 0 && code >= op::add && code <= op::pow) || (code >= op::and_ && b < 0))
+            return -1;
+        if (code == op::ifexp && c < 0)
+            return -1;
+
+        node item;
+        item.code = code;
+        item.a = a;
+        item.b = b;
+        item.c = c;
+        return append(item);
+    }
+
+    static std::string type_name(const bp::object& obj)
+    {
+        return bp::extract<std::string>(obj.attr("__class__").attr("__name__"));
+    }
+
+    int32_t compile(const bp::object& expr)
+    {
+        std::string type = type_name(expr);
+        if (type == "Constant")
+        {
+            node item;
+            item.code = op::constant;
+            if (!load(bp::object(expr.attr("value")).ptr(), item.constant))
+            {
+                PyErr_Clear();
+                return -1;
+            }
+            return append(item);
+        }
+
+        if (type == "Name")
+        {
+            std::string name = bp::extract<std::string>(expr.attr("id"));
+            auto iter = _slots.find(name);
+            if (iter == _slots.end())
+            {
+                iter = _slots.emplace(name, int64_t(_names.size())).first;
+                _names.emplace_back(bp::handle<>(PyUnicode_InternFromString(name.c_str())));
+            }
+
+            node item;
+            item.code = op::variable;
+            item.constant = value::integer(iter->second);
+            return append(item);
+        }
+
+        if (type == "BinOp")
+        {
+            static const std::map<std::string, op> operators = {
+                { "Add", op::add }, { "Sub", op::sub }, { "Mult", op::mul },
+                { "Div", op::truediv }, { "FloorDiv", op::floordiv },
+                { "Mod", op::mod }, { "Pow", op::pow },
+            };
+            auto iter = operators.find(type_name(expr.attr("op")));
+            if (iter == operators.end())
+                return -1;
+            int32_t lhs = compile(expr.attr("left"));
+            int32_t rhs = lhs < 0 ? -1 : compile(expr.attr("right"));
+            return append(iter->second, lhs, rhs);
+        }
+
+        if (type == "UnaryOp")
+        {
+            static const std::map<std::string, op> operators = {
+                { "USub", op::neg }, { "UAdd", op::pos },
+                { "Invert", op::invert }, { "Not", op::not_ },
+            };
+            auto iter = operators.find(type_name(expr.attr("op")));
+            if (iter == operators.end())
+                return -1;
+            return append(iter->second, compile(expr.attr("operand")));
+        }
+
+        if (type == "BoolOp")
+        {
+            op code = type_name(expr.attr("op")) == "And" ? op::and_ : op::or_;
+            bp::list values(expr.attr("values"));
+
+            // a and b and c => (a and b) and c
+            int32_t result = compile(values[0]);
+            for (bp::ssize_t i = 1; i < bp::len(values) && result >= 0; ++i)
+                result = append(code, result, compile(values[i]));
+            return result;
+        }
+
+        if (type == "Compare")
+        {
+            static const std::map<std::string, op> operators = {
+                { "Eq", op::eq }, { "NotEq", op::ne }, { "Lt", op::lt },
+                { "LtE", op::le }, { "Gt", op::gt }, { "GtE", op::ge },
+            };
+            bp::list ops(expr.attr("ops"));
+            bp::list comparators(expr.attr("comparators"));
+
+            // a < b < c => (a < b) and (b < c)，子树中没有副作用，b 被共享
+            int32_t lhs = compile(expr.attr("left"));
+            int32_t result = -1;
+            for (bp::ssize_t i = 0; i < bp::len(ops) && lhs >= 0; ++i)
+            {
+                auto iter = operators.find(type_name(ops[i]));
+                if (iter == operators.end())
+                    return -1;
+
+                int32_t rhs = compile(comparators[i]);
+                int32_t current = append(iter->second, lhs, rhs);
+                result = result < 0 ? current : append(op::and_, result, current);
+                if (result < 0)
+                    return -1;
+                lhs = rhs;
+            }
+            return result;
+        }
+
+        if (type == "IfExp")
+        {
+            int32_t test = compile(expr.attr("test"));
+            int32_t body = test < 0 ? -1 : compile(expr.attr("body"));
+            int32_t orelse = body < 0 ? -1 : compile(expr.attr("orelse"));
+            return append(op::ifexp, test, body, orelse);
+        }
+
+        return -1;
+    }
+
+    static bool arithmetic(op code, const value& lhs, const value& rhs, value& out)
+    {
+        if (lhs.kind != value_kind::real && rhs.kind != value_kind::real)
+        {
+            // bool 参与算术运算时视为 int
+            int64_t x = lhs.i, y = rhs.i, r = 0;
+            switch (code)
+            {
+            case op::add:
+                if (add_overflow(x, y, &r))
+                    return false;
+                out = value::integer(r);
+                return true;
+            case op::sub:
+                if (sub_overflow(x, y, &r))
+                    return false;
+                out = value::integer(r);
+                return true;
+            case op::mul:
+                if (mul_overflow(x, y, &r))
+                    return false;
+                out = value::integer(r);
+                return true;
+            case op::truediv:
+                if (y == 0 || !exact(x) || !exact(y))
+                    return false;
+                out = value::real(double(x) / double(y));
+                return true;
+            case op::floordiv:
+            case op::mod: {
+                if (y == 0 || (x == INT64_MIN && y == -1))
+                    return false;
+                int64_t q = x / y, m = x % y;
+                if (m != 0 && ((m < 0) != (y < 0)))
+                {
+                    q -= 1;
+                    m += y;
+                }
+                out = value::integer(code == op::mod ? m : q);
+                return true;
+            }
+            case op::pow: {
+                if (y < 0)
+                    break; // 负指数的结果为 float
+                int64_t base = x;
+                uint64_t exponent = uint64_t(y);
+                r = 1;
+                for (;;)
+                {
+                    if ((exponent & 1) && mul_overflow(r, base, &r))
+                        return false;
+                    exponent >>= 1;
+                    if (!exponent)
+                        break;
+                    if (mul_overflow(base, base, &base))
+                        return false;
+                }
+                out = value::integer(r);
+                return true;
+            }
+            default:
+                return false;
+            }
+        }
+
+        double x = lhs.as_real(), y = rhs.as_real();
+        switch (code)
+        {
+        case op::add: out = value::real(x + y); return true;
+        case op::sub: out = value::real(x - y); return true;
+        case op::mul: out = value::real(x * y); return true;
+        case op::truediv:
+            if (y == 0.0)
+                return false;
+            out = value::real(x / y);
+            return true;
+        case op::floordiv:
+        case op::mod: {
+            if (y == 0.0)
+                return false;
+
+            // 与 CPython 的 float_divmod() 一致
+            double mod = std::fmod(x, y);
+            double div = (x - mod) / y;
+            if (mod)
+            {
+                if ((y < 0) != (mod < 0))
+                {
+                    mod += y;
+                    div -= 1.0;
+                }
+            }
+            else
+                mod = std::copysign(0.0, y);
+
+            double floordiv;
+            if (div)
+            {
+                floordiv = std::floor(div);
+                if (div - floordiv > 0.5)
+                    floordiv += 1.0;
+            }
+            else
+                floordiv = std::copysign(0.0, x / y);
+
+            out = value::real(code == op::mod ? mod : floordiv);
+            return true;
+        }
+        case op::pow: {
+            if (!std::isfinite(x) || !std::isfinite(y))
+                return false;
+            if (x == 0.0 && y < 0.0)
+                return false; // ZeroDivisionError
+            if (x < 0.0 && y != std::floor(y))
+                return false; // 结果为复数
+            double r = std::pow(x, y);
+            if (!std::isfinite(r))
+                return false; // OverflowError
+            out = value::real(r);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    static bool compare(op code, const value& lhs, const value& rhs)
+    {
+        if (lhs.kind != value_kind::real && rhs.kind != value_kind::real)
+        {
+            switch (code)
+            {
+            case op::eq: return lhs.i == rhs.i;
+            case op::ne: return lhs.i != rhs.i;
+            case op::lt: return lhs.i < rhs.i;
+            case op::le: return lhs.i <= rhs.i;
+            case op::gt: return lhs.i > rhs.i;
+            default:     return lhs.i >= rhs.i;
+            }
+        }
+
+        double x = lhs.as_real(), y = rhs.as_real();
+        switch (code)
+        {
+        case op::eq: return x == y;
+        case op::ne: return x != y;
+        case op::lt: return x < y;
+        case op::le: return x <= y;
+        case op::gt: return x > y;
+        default:     return x >= y;
+        }
+    }
+
+    bool evaluate(int32_t index, const value* vars, value& out) const
+    {
+        const node& item = _nodes[index];
+        switch (item.code)
+        {
+        case op::constant:
+            out = item.constant;
+            return true;
+
+        case op::variable:
+            out = vars[item.constant.i];
+            return true;
+
+        case op::neg:
+        case op::pos:
+        case op::invert:
+        case op::not_: {
+            value operand;
+            if (!evaluate(item.a, vars, operand))
+                return false;
+            if (item.code == op::not_)
+            {
+                out = value::boolean(!operand.truth());
+                return true;
+            }
+            if (operand.kind == value_kind::real)
+            {
+                if (item.code == op::invert)
+                    return false;
+                out = value::real(item.code == op::neg ? -operand.d : operand.d);
+                return true;
+            }
+            if (item.code == op::invert)
+            {
+                if (operand.kind == value_kind::boolean)
+                    return false; // ~bool 在新版本中会触发 DeprecationWarning
+                out = value::integer(~operand.i);
+                return true;
+            }
+            if (item.code == op::neg && operand.i == INT64_MIN)
+                return false;
+            out = value::integer(item.code == op::neg ? -operand.i : operand.i);
+            return true;
+        }
+
+        case op::and_:
+        case op::or_:
+            if (!evaluate(item.a, vars, out))
+                return false;
+            if (out.truth() == (item.code == op::or_))
+                return true;
+            return evaluate(item.b, vars, out);
+
+        case op::ifexp: {
+            value test;
+            if (!evaluate(item.a, vars, test))
+                return false;
+            return evaluate(test.truth() ? item.b : item.c, vars, out);
+        }
+
+        case op::eq:
+        case op::ne:
+        case op::lt:
+        case op::le:
+        case op::gt:
+        case op::ge: {
+            value lhs, rhs;
+            if (!evaluate(item.a, vars, lhs) || !evaluate(item.b, vars, rhs))
+                return false;
+            if ((lhs.kind == value_kind::real) != (rhs.kind == value_kind::real))
+            {
+                const value& integer = lhs.kind == value_kind::real ? rhs : lhs;
+                if (!exact(integer.i))
+                    return false;
+            }
+            out = value::boolean(compare(item.code, lhs, rhs));
+            return true;
+        }
+
+        default: {
+            value lhs, rhs;
+            if (!evaluate(item.a, vars, lhs) || !evaluate(item.b, vars, rhs))
+                return false;
+            return arithmetic(item.code, lhs, rhs, out);
+        }
+        }
+    }
+
+    std::vector<node>               _nodes;
+    int32_t                         _root = -1;
+    std::vector<bp::object>         _names;     // 驻留的变量名，下标即变量序号
+    std::map<std::string, int64_t>  _slots;
+};
+
+pyembed::expression pyembed::compile_expr(
+    const std::string& expression,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */)
+{
+    gil_acquire gil("compile_expr", &expression);
+    pyembed::expression compiled;
+    exec_for([&]() {
+        auto result = std::make_shared<pyexpression>();
+        result->_text = expression;
+        trace_scope span("compile", "compile", &expression);
+        result->_code = bp::object(bp::handle<>(
+            Py_CompileString(expression.c_str(), "<string>", Py_eval_input)));
+
+        // 语法已由上面的编译检查，这里仅将 ast 翻译为原生求值树
+        bp::object tree = bp::import("ast").attr("parse")(expression, "<string>", "eval");
+        result->_program = pyexpr_program::build(tree.attr("body"));
+        compiled = result;
+        }, exception_handler);
+    return compiled;
+}
+
+boost::python::object pyembed::eval(
+    const expression& compiled,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    gil_acquire gil("eval", &compiled->_text);
+    boost::python::object result;
+    exec_for([&]() {
+        if (compiled->_program)
+        {
+            if (PyObject* value = compiled->_program->evaluate(global().ptr(), local().ptr()))
+            {
+                result = bp::object(bp::handle<>(value));
+                return;
+            }
+            compiled->_fallbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        result = bp::object(bp::handle<>(
+            PyEval_EvalCode(compiled->_code.ptr(), global().ptr(), local().ptr())));
+        }, exception_handler, limits);
+    return result;
+}
+
+boost::python::object pyembed::eval(
+    const context& ctx,
+    const expression& compiled,
+    const std::function<bool(const pyerror&)>& exception_handler /*= {} */,
+    const pylimits& limits /*= {} */)
+{
+    gil_acquire gil("eval", &compiled->_text);
+    boost::python::object result;
+    exec_for([&]() {
+        if (compiled->_program)
+        {
+            if (PyObject* value = compiled->_program->evaluate(ctx->space.ptr(), ctx->space.ptr()))
+            {
+                result = bp::object(bp::handle<>(value));
+                return;
+            }
+            compiled->_fallbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        result = bp::object(bp::handle<>(
+            PyEval_EvalCode(compiled->_code.ptr(), ctx->space.ptr(), ctx->space.ptr())));
+        }, exception_handler, limits);
+    return result;
+}
@@ -0,0 +1,102 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pyfork_h__
+#define pyfork_h__
+
+#include "pyembed.h"
+#include "utility/config.h"
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#if OS_POSIX
+#   include <signal.h>
+#   include <unistd.h>
+#endif
+#if OS_LINUX
+#   include <sys/prctl.h>
+#endif
+
+#if OS_POSIX
+namespace pyfork {
+
+//! @brief 导入预置模块并执行预热代码，随后冻结当前存活的对象
+//! @note 冻结后子进程的循环垃圾回收不再访问(写入)这些对象，与父进程共享的内存页保持写时复制。
+//!       调用者须持有GIL，失败将抛出异常(std::runtime_error)。
+inline void warm_up(
+    pyembed& embed,
+    const std::vector<std::string>& preload,
+    const std::string& prelude)
+{
+    std::string message;
+    auto handler = [&](const pyembed::pyerror& pyerr) {
+        message = pyerr.format_exception();
+        return true;
+    };
+    for (const auto& name : preload)
+        embed.exec_for([&]() { boost::python::import(name.c_str()); }, handler);
+    if (message.empty() && !prelude.empty())
+        embed.exec(prelude, handler);
+    if (!message.empty())
+        throw std::runtime_error("warm-up failed: " + message);
+
+    embed.gc_freeze();
+}
+
+//! @brief fork子进程并在其中执行 child()，子进程以其返回值退出，不会返回调用者
+//! @param death_signal 父进程退出时子进程收到的信号(仅Linux)
+//! @return 返回子进程的标识，失败返回-1
+//! @note 调用者须持有GIL；fork只复制调用线程，其他线程持有的锁在子进程中无法释放。
+template<class F>
+pid_t spawn(F&& child, int death_signal)
+{
+    PyOS_BeforeFork();
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        PyOS_AfterFork_Child();
+#if OS_LINUX
+        ::prctl(PR_SET_PDEATHSIG, death_signal);
+#else
+        (void)death_signal;
+#endif
+        int code = 1;
+        try
+        {
+            code = child();
+        }
+        catch (const std::exception& e)
+        {
+            fprintf(stderr, "%s\n", e.what());
+        }
+        _exit(code);
+    }
+    PyOS_AfterFork_Parent();
+    return pid;
+}
+
+} // namespace pyfork
+#endif
+
+#endif // pyfork_h__
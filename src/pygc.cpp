@@ -0,0 +1,233 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#include "pyembed.h"
+#include "pyhistogram.hpp"
+
+#include <mutex>
+#include <boost/format.hpp>
+
+namespace bp = boost::python;
+
+namespace {
+
+using pyhistogram::now_ns;
+using pyhistogram::histogram;
+
+struct generation_stats
+{
+    std::atomic<uint64_t> collected{ 0 };
+    std::atomic<uint64_t> uncollectable{ 0 };
+    histogram             pause;
+};
+
+generation_stats generations[3];
+thread_local int64_t collect_started = 0; // 回收在触发它的线程上开始与结束
+
+std::mutex suspend_mutex;
+int        suspended = 0;       // 进入中的 gc_suspend 数量
+bool       resume = false;      // 最后一个 gc_suspend 退出时是否重新启用
+
+bp::object gc_module()
+{
+    return bp::import("gc");
+}
+
+bool gc_enabled()
+{
+#if PY_VERSION_HEX >= 0x030A0000
+    return PyGC_IsEnabled() != 0;
+#else
+    return bp::extract<bool>(gc_module().attr("isenabled")());
+#endif
+}
+
+bool gc_enable(bool enabled)
+{
+#if PY_VERSION_HEX >= 0x030A0000
+    return (enabled ? PyGC_Enable() : PyGC_Disable()) != 0;
+#else
+    bool previous = gc_enabled();
+    gc_module().attr(enabled ? "enable" : "disable")();
+    return previous;
+#endif
+}
+
+uint64_t item_of(PyObject* info, const char* key)
+{
+    PyObject* value = PyDict_GetItemString(info, key);
+    return value ? PyLong_AsUnsignedLongLong(value) : 0;
+}
+
+// gc.callbacks 中的回调：callback(phase, info)
+PyObject* on_collect(PyObject*, PyObject* args)
+{
+    PyObject* phase = nullptr;
+    PyObject* info = nullptr;
+    if (!PyArg_ParseTuple(args, "UO!", &phase, &PyDict_Type, &info))
+        return nullptr;
+
+    if (PyUnicode_CompareWithASCIIString(phase, "start") == 0)
+    {
+        collect_started = now_ns();
+        Py_RETURN_NONE;
+    }
+
+    size_t generation = item_of(info, "generation");
+    if (collect_started == 0 || generation > 2)
+        Py_RETURN_NONE;
+
+    generation_stats& stats = generations[generation];
+    stats.pause.record(now_ns() - collect_started);
+    stats.collected.fetch_add(item_of(info, "collected"), std::memory_order_relaxed);
+    stats.uncollectable.fetch_add(item_of(info, "uncollectable"), std::memory_order_relaxed);
+    collect_started = 0;
+    PyErr_Clear();
+    Py_RETURN_NONE;
+}
+
+PyMethodDef on_collect_def = { "pyembed_gc_callback", on_collect, METH_VARARGS, nullptr };
+
+bp::object callback()
+{
+    static PyObject* function = PyCFunction_New(&on_collect_def, nullptr);
+    return bp::object(bp::handle<>(bp::borrowed(function)));
+}
+
+} // namespace
+
+void pyembed::set_gc_thresholds(int gen0, int gen1 /*= -1*/, int gen2 /*= -1*/)
+{
+    gil_acquire gil("set_gc_thresholds");
+    bp::object gc = gc_module();
+    bp::object current = gc.attr("get_threshold")();
+    gc.attr("set_threshold")(
+        gen0 < 0 ? current[0] : bp::object(gen0),
+        gen1 < 0 ? current[1] : bp::object(gen1),
+        gen2 < 0 ? current[2] : bp::object(gen2));
+}
+
+bool pyembed::set_gc_enabled(bool enabled)
+{
+    gil_acquire gil("set_gc_enabled");
+    return gc_enable(enabled);
+}
+
+size_t pyembed::gc_collect(int generation /*= 2*/)
+{
+    gil_acquire gil("gc_collect");
+    return bp::extract<size_t>(gc_module().attr("collect")(generation));
+}
+
+size_t pyembed::gc_freeze(bool collect /*= true */)
+{
+    gil_acquire gil("gc_freeze");
+    bp::object gc = gc_module();
+    if (collect)
+        gc.attr("collect")();
+    gc.attr("freeze")();
+    return bp::extract<size_t>(gc.attr("get_freeze_count")());
+}
+
+void pyembed::gc_unfreeze()
+{
+    gil_acquire gil("gc_unfreeze");
+    gc_module().attr("unfreeze")();
+}
+
+pyembed::gc_suspend::gc_suspend()
+{
+    gil_acquire gil("gc_suspend");
+    std::lock_guard<std::mutex> lock(suspend_mutex);
+    if (suspended++ == 0)
+        resume = gc_enable(false);
+}
+
+pyembed::gc_suspend::~gc_suspend()
+{
+    gil_acquire gil("gc_suspend");
+    std::lock_guard<std::mutex> lock(suspend_mutex);
+    if (--suspended == 0 && resume)
+        gc_enable(true);
+}
+
+void pyembed::set_gc_profiling(bool enabled)
+{
+    gil_acquire gil("set_gc_profiling");
+    bp::list callbacks = bp::extract<bp::list>(gc_module().attr("callbacks"));
+    bp::object function = callback();
+    bool installed = callbacks.count(function) > 0;
+    if (enabled && !installed)
+        callbacks.append(function);
+    else if (!enabled && installed)
+        callbacks.remove(function);
+}
+
+pyembed::gc_statistics pyembed::gc_report()
+{
+    gil_acquire gil("gc_report");
+    bp::object gc = gc_module();
+    bp::object thresholds = gc.attr("get_threshold")();
+    bp::object counts = gc.attr("get_count")();
+
+    gc_statistics report = {};
+    report.enabled = gc_enabled();
+    report.frozen = bp::extract<size_t>(gc.attr("get_freeze_count")());
+    for (int i = 0; i < 3; ++i)
+    {
+        gc_generation& item = report.generations[i];
+        item.threshold = bp::extract<int>(thresholds[i]);
+        item.count = bp::extract<int>(counts[i]);
+        item.collected = generations[i].collected.load(std::memory_order_relaxed);
+        item.uncollectable = generations[i].uncollectable.load(std::memory_order_relaxed);
+        generations[i].pause.merge_into(item.pause);
+    }
+    return report;
+}
+
+void pyembed::reset_gc_report()
+{
+    for (auto& item : generations)
+    {
+        item.collected = 0;
+        item.uncollectable = 0;
+        item.pause.reset();
+    }
+}
+
+std::string pyembed::gc_statistics::format() const
+{
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    std::string text = boost::str(boost::format("GC pauses (us, %1%, %2% frozen):\n") 
+        % (enabled ? "enabled" : "disabled") % frozen);
+    text += boost::str(boost::format("  %-10s %10s %12s %10s %10s %10s %10s %10s\n")
+        % "" % "threshold" % "collections" % "collected" % "p50" % "p99" % "max" % "total");
+    for (int i = 0; i < 3; ++i)
+    {
+        const gc_generation& item = generations[i];
+        text += boost::str(boost::format("  %-10s %10d %12u %10u %10.1f %10.1f %10.1f %10.1f\n")
+            % ("gen" + std::to_string(i)) % item.threshold % item.pause.count % item.collected
+            % us(item.pause.percentile(0.5)) % us(item.pause.percentile(0.99))
+            % us(item.pause.max_ns) % us(item.pause.total_ns));
+    }
+    return text;
+}
@@ -0,0 +1,402 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#include "pyembed.h"
+#include "pyhistogram.hpp"
+#include "pytrace.hpp"
+
+#include <boost/format.hpp>
+
+namespace {
+
+std::atomic<uint64_t> acquires{ 0 };
+std::atomic<uint64_t> nested{ 0 };
+std::atomic<uint64_t> releases{ 0 };
+std::atomic<uint64_t> threads{ 0 };
+std::atomic<bool>     profiling{ false };
+
+using pyhistogram::now_ns;
+using pyhistogram::histogram;
+
+struct timings
+{
+    histogram wait;
+    histogram hold;
+};
+
+// 线程的统计在首次记录时登记(加锁一次)，此后的记录是无锁的；线程退出后保留
+struct thread_profile
+{
+    std::string name;
+    timings     data;
+};
+
+std::mutex                                   registry_mutex;
+std::vector<std::unique_ptr<thread_profile>> thread_profiles;
+
+// 入口的统计以入口名的地址为键，开放寻址，槽位通过CAS占用，表满时不再统计新的入口
+struct entry_slot
+{
+    std::atomic<const char*> key{ nullptr };
+    timings                  data;
+};
+
+const size_t entry_capacity = 64;
+entry_slot   entry_slots[entry_capacity];
+
+timings* find_entry(const char* entry)
+{
+    size_t start = (reinterpret_cast<uintptr_t>(entry) >> 3) % entry_capacity;
+    for (size_t i = 0; i < entry_capacity; ++i)
+    {
+        entry_slot& slot = entry_slots[(start + i) % entry_capacity];
+        const char* key = slot.key.load(std::memory_order_acquire);
+        if (key == nullptr && slot.key.compare_exchange_strong(key, entry, std::memory_order_acq_rel))
+            return &slot.data;
+        if (key == entry)
+            return &slot.data;
+    }
+    return nullptr;
+}
+
+// 持有GIL最久的调用，仅在超过榜单门槛时加锁
+const size_t                     top_capacity = 16;
+std::mutex                       top_mutex;
+std::vector<pyembed::gil_holder> top_holders;
+std::atomic<uint64_t>            top_threshold{ 0 };
+
+// 每个线程的GIL状态
+struct thread_cache
+{
+    PyThreadState*  state = nullptr;        // 为非Python线程创建的线程状态，线程退出时释放
+    thread_profile* profile = nullptr;
+    int64_t         hold_started = 0;       // 本线程开始持有GIL的时间，0表示未记录
+    uint64_t        released_ns = 0;        // 本线程在 gil_release 中累计释放GIL的时间
+
+    ~thread_cache()
+    {
+        // 进程退出时解释器可能已不可用，此时不再释放
+        if (!state || !Py_IsInitialized())
+            return;
+
+        PyEval_RestoreThread(state);
+        PyThreadState_Clear(state);
+        PyThreadState_DeleteCurrent();
+    }
+
+    thread_profile& current()
+    {
+        if (!profile)
+        {
+            auto created = std::make_unique<thread_profile>();
+#ifdef PY_HAVE_THREAD_NATIVE_ID
+            created->name = "thread " + std::to_string(PyThread_get_thread_native_id());
+#else
+            created->name = "thread " + std::to_string(PyThread_get_thread_ident());
+#endif
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            profile = created.get();
+            thread_profiles.push_back(std::move(created));
+        }
+        return *profile;
+    }
+};
+
+thread_local thread_cache cache;
+
+// 描述取首行，过长时截断
+std::string summarize(const std::string* detail)
+{
+    if (!detail)
+        return std::string();
+
+    std::string text = detail->substr(0, detail->find('\n'));
+    if (text.size() > 80)
+        text = text.substr(0, 77) + "...";
+    return text;
+}
+
+void offer(uint64_t hold_ns, const char* entry, const std::string* detail)
+{
+    if (hold_ns <= top_threshold.load(std::memory_order_relaxed))
+        return;
+
+    pyembed::gil_holder holder{ hold_ns, entry, summarize(detail), cache.current().name };
+
+    std::lock_guard<std::mutex> lock(top_mutex);
+    auto position = std::find_if(top_holders.begin(), top_holders.end(),
+        [&](const pyembed::gil_holder& item) { return item.hold_ns < hold_ns; });
+    top_holders.insert(position, std::move(holder));
+    if (top_holders.size() > top_capacity)
+        top_holders.pop_back();
+    if (top_holders.size() == top_capacity)
+        top_threshold.store(top_holders.back().hold_ns, std::memory_order_relaxed);
+}
+
+} // namespace
+
+pyembed::gil_acquire::gil_acquire()
+    : gil_acquire(nullptr)
+{
+}
+
+pyembed::gil_acquire::gil_acquire(const char* entry, const std::string* detail /*= nullptr*/)
+    : _state(nullptr)
+    , _entry(entry)
+    , _detail(detail)
+    , _started(0)
+    , _released(0)
+    , _traced(0)
+{
+    const bool profiled = profiling.load(std::memory_order_relaxed);
+    const uint32_t traced = pytrace::flags();
+    if (PyGILState_Check())
+    {
+        nested.fetch_add(1, std::memory_order_relaxed);
+        if (profiled)
+        {
+            _started = now_ns();
+            _released = cache.released_ns;
+        }
+        if (traced)
+            _traced = now_ns();
+        if (traced || pytrace::profiled)
+            pytrace::enter();
+        return;
+    }
+
+    // 主线程、Python创建的线程以及已缓存的线程均已登记线程状态
+    PyThreadState* state = PyGILState_GetThisThreadState();
+    if (!state)
+    {
+        // 创建的线程状态同时登记为本线程的 PyGILState 状态，
+        // 本线程中的 PyGILState_Ensure/Release 将复用它而不会将其销毁
+        state = PyThreadState_New(PyInterpreterState_Main());
+        cache.state = state;
+        threads.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const int64_t waited = (profiled || traced) ? now_ns() : 0;
+    PyEval_RestoreThread(state);
+    _state = state;
+    acquires.fetch_add(1, std::memory_order_relaxed);
+
+    if (traced)
+    {
+        _traced = now_ns();
+        if (traced & pytrace::gil_waits)
+            pytrace::record("gil", "gil_wait", waited, _traced, _entry ? _entry : "");
+    }
+    if (traced || pytrace::profiled)
+        pytrace::enter();
+
+    if (profiled)
+    {
+        _started = now_ns();
+        _released = cache.released_ns;
+        cache.hold_started = _started;
+
+        const uint64_t wait = _started - waited;
+        cache.current().data.wait.record_owned(wait);
+        if (_entry)
+        {
+            if (timings* item = find_entry(_entry))
+                item->wait.record(wait);
+        }
+    }
+}
+
+pyembed::gil_acquire::~gil_acquire()
+{
+    if (_traced && _entry)
+        pytrace::record("entry", _entry, _traced, now_ns(), _detail ? *_detail : std::string_view());
+
+    if (_started)
+    {
+        const int64_t now = now_ns();
+        const uint64_t hold = (now - _started) - (cache.released_ns - _released);
+        if (_entry)
+        {
+            if (timings* item = find_entry(_entry))
+                item->hold.record(hold);
+        }
+        offer(hold, _entry ? _entry : "gil_acquire", _detail);
+
+        if (_state && cache.hold_started)
+        {
+            cache.current().data.hold.record_owned(now - cache.hold_started);
+            cache.hold_started = 0;
+        }
+    }
+
+    if (_state)
+        PyEval_SaveThread();
+}
+
+pyembed::gil_release::gil_release()
+    : _state(nullptr)
+    , _started(0)
+{
+    if (!PyGILState_Check())
+        return;
+
+    if (profiling.load(std::memory_order_relaxed))
+    {
+        _started = now_ns();
+        if (cache.hold_started)
+            cache.current().data.hold.record_owned(_started - cache.hold_started);
+        cache.hold_started = 0;
+    }
+
+    _state = PyEval_SaveThread();
+    releases.fetch_add(1, std::memory_order_relaxed);
+}
+
+pyembed::gil_release::~gil_release()
+{
+    if (!_state)
+        return;
+
+    const bool traced = pytrace::flags() & pytrace::gil_waits;
+    const int64_t waited = (_started || traced) ? now_ns() : 0;
+    PyEval_RestoreThread(_state);
+
+    if (traced)
+        pytrace::record("gil", "gil_wait", waited, now_ns(), "gil_release");
+
+    if (_started)
+    {
+        const int64_t now = now_ns();
+        cache.current().data.wait.record_owned(now - waited);
+        cache.released_ns += now - _started;
+        cache.hold_started = now;
+    }
+}
+
+pyembed::gil_statistics pyembed::gil_stats()
+{
+    return {
+        acquires.load(std::memory_order_relaxed),
+        nested.load(std::memory_order_relaxed),
+        releases.load(std::memory_order_relaxed),
+        threads.load(std::memory_order_relaxed),
+    };
+}
+
+void pyembed::set_gil_profiling(bool enabled)
+{
+    profiling.store(enabled, std::memory_order_relaxed);
+}
+
+pyembed::gil_contention pyembed::gil_report()
+{
+    gil_contention report;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const auto& item : thread_profiles)
+        {
+            gil_profile profile{ item->name, {}, {} };
+            item->data.wait.merge_into(profile.wait);
+            item->data.hold.merge_into(profile.hold);
+            report.threads.push_back(profile);
+        }
+    }
+
+    // 同名的入口(不同编译单元中的字符串常量地址可能不同)合并统计
+    for (const auto& slot : entry_slots)
+    {
+        const char* key = slot.key.load(std::memory_order_acquire);
+        if (!key)
+            continue;
+
+        auto iter = std::find_if(report.entries.begin(), report.entries.end(),
+            [&](const gil_profile& item) { return item.name == key; });
+        if (iter == report.entries.end())
+            iter = report.entries.insert(report.entries.end(), gil_profile{ key, {}, {} });
+        slot.data.wait.merge_into(iter->wait);
+        slot.data.hold.merge_into(iter->hold);
+    }
+    std::sort(report.entries.begin(), report.entries.end(),
+        [](const gil_profile& a, const gil_profile& b) { return a.hold.total_ns > b.hold.total_ns; });
+
+    std::lock_guard<std::mutex> lock(top_mutex);
+    report.top = top_holders;
+    return report;
+}
+
+void pyembed::reset_gil_report()
+{
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (auto& item : thread_profiles)
+        {
+            item->data.wait.reset();
+            item->data.hold.reset();
+        }
+    }
+
+    for (auto& slot : entry_slots)
+    {
+        slot.data.wait.reset();
+        slot.data.hold.reset();
+    }
+
+    std::lock_guard<std::mutex> lock(top_mutex);
+    top_holders.clear();
+    top_threshold = 0;
+}
+
+std::string pyembed::gil_contention::format() const
+{
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    auto row = [&](const gil_profile& item) {
+        return boost::str(boost::format("  %-24s %10u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n")
+            % item.name % item.hold.count
+            % us(item.wait.percentile(0.5)) % us(item.wait.percentile(0.99)) % us(item.wait.max_ns)
+            % us(item.hold.percentile(0.5)) % us(item.hold.percentile(0.99)) % us(item.hold.max_ns));
+    };
+    const std::string header = boost::str(boost::format("  %-24s %10s %10s %10s %10s %10s %10s %10s\n")
+        % "" % "count" % "wait p50" % "wait p99" % "wait max" % "hold p50" % "hold p99" % "hold max");
+
+    // 统计开启后没有记录的线程或入口不输出
+    std::string text = "GIL contention by thread (us):\n" + header;
+    for (const auto& item : threads)
+    {
+        if (item.wait.count || item.hold.count)
+            text += row(item);
+    }
+
+    text += "GIL contention by entry (us):\n" + header;
+    for (const auto& item : entries)
+    {
+        if (item.wait.count || item.hold.count)
+            text += row(item);
+    }
+
+    text += "top GIL holders (us):\n";
+    for (const auto& item : top)
+    {
+        text += boost::str(boost::format("  %10.1f  %-14s %-16s %s\n")
+            % us(item.hold_ns) % item.entry % item.thread % item.detail);
+    }
+    return text;
+}
@@ -0,0 +1,106 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pyhistogram_h__
+#define pyhistogram_h__
+
+#include "pyembed.h"
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+namespace pyhistogram {
+
+inline int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline size_t bucket_of(uint64_t ns)
+{
+    if (ns == 0)
+        return 0;
+#if defined(__GNUC__) || defined(__clang__)
+    size_t index = 63 - __builtin_clzll(ns);
+#else
+    size_t index = 0;
+    while (ns >>= 1)
+        ++index;
+#endif
+    return std::min<size_t>(index, 47);
+}
+
+// 无锁直方图，各计数器独立累加，读取时不保证彼此一致
+struct histogram
+{
+    std::atomic<uint64_t> count{ 0 };
+    std::atomic<uint64_t> total_ns{ 0 };
+    std::atomic<uint64_t> max_ns{ 0 };
+    std::atomic<uint64_t> buckets[48]{};
+
+    void record(uint64_t ns)
+    {
+        count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(ns, std::memory_order_relaxed);
+        buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t longest = max_ns.load(std::memory_order_relaxed);
+        while (ns > longest && !max_ns.compare_exchange_weak(longest, ns, std::memory_order_relaxed));
+    }
+
+    // 仅由所属线程写入时无需原子的读-改-写，读取方仍以原子方式读取
+    void record_owned(uint64_t ns)
+    {
+        auto bump = [](std::atomic<uint64_t>& item, uint64_t value) {
+            item.store(item.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        };
+        bump(count, 1);
+        bump(total_ns, ns);
+        bump(buckets[bucket_of(ns)], 1);
+        if (ns > max_ns.load(std::memory_order_relaxed))
+            max_ns.store(ns, std::memory_order_relaxed);
+    }
+
+    void merge_into(pyembed::gil_histogram& out) const
+    {
+        out.count += count.load(std::memory_order_relaxed);
+        out.total_ns += total_ns.load(std::memory_order_relaxed);
+        out.max_ns = std::max(out.max_ns, max_ns.load(std::memory_order_relaxed));
+        for (size_t i = 0; i < 48; ++i)
+            out.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        count = 0;
+        total_ns = 0;
+        max_ns = 0;
+        for (auto& item : buckets)
+            item = 0;
+    }
+};
+
+} // namespace pyhistogram
+
+#endif // pyhistogram_h__
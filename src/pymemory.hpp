@@ -0,0 +1,87 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pymemory_h__
+#define pymemory_h__
+
+#include "utility/config.h"
+
+#include <cstdio>
+#include <cstddef>
+
+#if OS_WIN
+#   include <windows.h>
+#   include <psapi.h>
+#   include <malloc.h>
+#   pragma comment(lib, "psapi.lib")
+#elif OS_MACOSX
+#   include <mach/mach.h>
+#else
+#   include <unistd.h>
+#endif
+
+#if defined(__GLIBC__)
+#   include <malloc.h>
+#endif
+
+namespace pymemory {
+
+// 当前进程的常驻内存(字节)，无法获取时返回0
+inline size_t resident_size()
+{
+#if OS_WIN
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.WorkingSetSize;
+#elif OS_MACOSX
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+        return 0;
+    return info.resident_size;
+#else
+    FILE* fs = fopen("/proc/self/statm", "r");
+    if (!fs)
+        return 0;
+
+    long pages = 0;
+    if (fscanf(fs, "%*s %ld", &pages) != 1)
+        pages = 0;
+    fclose(fs);
+    return size_t(pages) * size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// 将堆中空闲的内存归还给操作系统
+inline void trim()
+{
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#elif OS_WIN
+    _heapmin();
+#endif
+}
+
+} // namespace pymemory
+
+#endif // pymemory_h__
@@ -0,0 +1,282 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#include "pyembed.h"
+#include "utility/config.h"
+
+#include <mutex>
+#include <vector>
+#include <cinttypes>
+#include <boost/format.hpp>
+
+// 3.12 起由解释器提供 perf trampoline，更早的版本(3.9 起可替换帧求值函数)由 pyembed 自行生成跳板
+#if PY_VERSION_HEX >= 0x03090000 && PY_VERSION_HEX < 0x030C0000 && \
+    OS_LINUX && (defined(__x86_64__) || defined(__aarch64__))
+#   define PYEMBED_PERF_TRAMPOLINE 1
+#   include <unistd.h>
+#   include <sys/mman.h>
+#endif
+
+namespace bp = boost::python;
+
+#if PYEMBED_PERF_TRAMPOLINE
+namespace {
+
+#if PY_VERSION_HEX >= 0x030B0000
+typedef struct _PyInterpreterFrame frame_type;
+
+// _PyInterpreterFrame 是内部结构(Include/internal/pycore_frame.h)，这里只声明 3.11 中用到的前缀
+struct frame_prefix
+{
+    PyObject*     f_func;
+    PyObject*     f_globals;
+    PyObject*     f_builtins;
+    PyObject*     f_locals;
+    PyCodeObject* f_code;
+};
+
+PyCodeObject* code_of(frame_type* frame)
+{
+    return reinterpret_cast<frame_prefix*>(frame)->f_code;
+}
+
+PyObject* name_of(PyCodeObject* code)
+{
+    return code->co_qualname;
+}
+#else
+typedef PyFrameObject frame_type;
+
+PyCodeObject* code_of(frame_type* frame)
+{
+    PyCodeObject* code = PyFrame_GetCode(frame);
+    Py_DECREF(code); // 帧持有代码对象
+    return code;
+}
+
+PyObject* name_of(PyCodeObject* code)
+{
+    return code->co_name;
+}
+#endif
+
+typedef PyObject* (*evaluator)(PyThreadState*, frame_type*, int);
+typedef PyObject* (*trampoline)(PyThreadState*, frame_type*, int, evaluator);
+
+// 跳板函数：建立栈帧后调用第4个参数(求值函数)，perf 按返回地址所在的跳板归属到Python函数
+#if defined(__x86_64__)
+// push rbp; mov rbp, rsp; call rcx; pop rbp; ret
+const unsigned char trampoline_code[] = { 0x55, 0x48, 0x89, 0xe5, 0xff, 0xd1, 0x5d, 0xc3 };
+#else
+// stp x29, x30, [sp, #-16]!; mov x29, sp; blr x3; ldp x29, x30, [sp], #16; ret
+const uint32_t trampoline_code[] = { 0xa9bf7bfd, 0x910003fd, 0xd63f0060, 0xa8c17bfd, 0xd65f03c0 };
+#endif
+
+const size_t trampoline_stride = 16;
+const size_t arena_size = 1 << 20;
+
+struct perf_state
+{
+    std::mutex               mutex;
+    Py_ssize_t               extra = -1;    // 代码对象上保存跳板的附加数据序号
+    char*                    next = nullptr;
+    char*                    end = nullptr;
+    FILE*                    map = nullptr;
+    std::vector<std::string> lines;         // 已写入的映射，fork 后写入子进程的映射文件
+    bool                     registered = false;
+};
+
+perf_state& state()
+{
+    static perf_state* instance = new perf_state; // 不析构，解释器退出时仍可能求值
+    return *instance;
+}
+
+// 创建当前进程的映射文件，并写入已分配的全部跳板：
+// 重新启用时已有跳板的代码对象不会再次分配，fork 后子进程的进程号改变，映射都需要重新写入
+FILE* open_map(const perf_state& perf)
+{
+    std::string path = boost::str(boost::format("/tmp/perf-%1%.map") % ::getpid());
+    FILE* map = fopen(path.c_str(), "w");
+    if (!map)
+        return nullptr;
+
+    for (const auto& line : perf.lines)
+        fputs(line.c_str(), map);
+    fflush(map);
+    return map;
+}
+
+// 填满一块可执行内存，所有跳板都相同，随后按需分配
+bool new_arena(perf_state& perf)
+{
+    void* memory = ::mmap(nullptr, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return false;
+
+    char* base = static_cast<char*>(memory);
+    for (size_t offset = 0; offset + trampoline_stride <= arena_size; offset += trampoline_stride)
+        memcpy(base + offset, trampoline_code, sizeof(trampoline_code));
+    if (::mprotect(memory, arena_size, PROT_READ | PROT_EXEC) != 0)
+    {
+        ::munmap(memory, arena_size);
+        return false;
+    }
+    __builtin___clear_cache(base, base + arena_size);
+
+    perf.next = base;
+    perf.end = base + arena_size;
+    return true;
+}
+
+// 为代码对象分配跳板并写入映射文件，失败时返回空
+trampoline compile(perf_state& perf, PyCodeObject* code)
+{
+    std::lock_guard<std::mutex> lock(perf.mutex);
+    if (perf.next == perf.end && !new_arena(perf))
+        return nullptr;
+
+    char* address = perf.next;
+    perf.next += trampoline_stride;
+
+    const char* name = PyUnicode_AsUTF8(name_of(code));
+    const char* filename = PyUnicode_AsUTF8(code->co_filename);
+    if (!name || !filename)
+    {
+        PyErr_Clear();
+        name = name ? name : "?";
+        filename = filename ? filename : "?";
+    }
+
+    std::string line = boost::str(boost::format("%x %x py::%s:%s\n")
+        % reinterpret_cast<uintptr_t>(address) % sizeof(trampoline_code) % name % filename);
+    perf.lines.push_back(line);
+    if (perf.map)
+    {
+        fputs(line.c_str(), perf.map);
+        fflush(perf.map);
+    }
+
+    trampoline function = reinterpret_cast<trampoline>(address);
+    if (_PyCode_SetExtra(reinterpret_cast<PyObject*>(code), perf.extra, address) != 0)
+        PyErr_Clear();
+    return function;
+}
+
+PyObject* eval_frame(PyThreadState* tstate, frame_type* frame, int throwflag)
+{
+    perf_state& perf = state();
+    PyCodeObject* code = code_of(frame);
+
+    void* extra = nullptr;
+    if (_PyCode_GetExtra(reinterpret_cast<PyObject*>(code), perf.extra, &extra) != 0)
+        PyErr_Clear();
+
+    trampoline function = extra ? reinterpret_cast<trampoline>(extra) : compile(perf, code);
+    if (!function)
+        return _PyEval_EvalFrameDefault(tstate, frame, throwflag);
+    return function(tstate, frame, throwflag, _PyEval_EvalFrameDefault);
+}
+
+// fork 后子进程的进程号改变，重新写入全部映射，无法创建映射文件时不再写入
+PyObject* after_fork(PyObject*, PyObject*)
+{
+    perf_state& perf = state();
+    std::lock_guard<std::mutex> lock(perf.mutex);
+    if (perf.map)
+    {
+        fclose(perf.map);
+        perf.map = open_map(perf);
+    }
+    Py_RETURN_NONE;
+}
+
+PyMethodDef after_fork_def = { "pyembed_perf_after_fork", after_fork, METH_NOARGS, nullptr };
+
+} // namespace
+#endif
+
+bool pyembed::set_perf_profiling(bool enabled)
+{
+    gil_acquire gil("set_perf_profiling");
+#if PY_VERSION_HEX >= 0x030C0000
+    PyObject* sys = PyImport_ImportModule("sys");
+    PyObject* result = sys ? (enabled
+        ? PyObject_CallMethod(sys, "activate_stack_trampoline", "s", "perf")
+        : PyObject_CallMethod(sys, "deactivate_stack_trampoline", nullptr)) : nullptr;
+    Py_XDECREF(sys);
+    if (!result)
+    {
+        // 解释器构建时未启用 perf trampoline(如非Linux平台)
+        PyErr_Clear();
+        write_stderr("perf profiling is not supported by this Python build\n");
+        return false;
+    }
+    Py_DECREF(result);
+    return enabled;
+#elif PYEMBED_PERF_TRAMPOLINE
+    perf_state& perf = state();
+    PyInterpreterState* interp = PyInterpreterState_Get();
+    if (!enabled)
+    {
+        _PyInterpreterState_SetEvalFrameFunc(interp, _PyEval_EvalFrameDefault);
+        std::lock_guard<std::mutex> lock(perf.mutex);
+        if (perf.map)
+            fclose(perf.map);
+        perf.map = nullptr;
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(perf.mutex);
+        if (perf.extra < 0)
+            perf.extra = _PyEval_RequestCodeExtraIndex(nullptr);
+        if (!perf.map)
+            perf.map = open_map(perf);
+        if (perf.extra < 0 || !perf.map)
+        {
+            PyErr_Clear();
+            write_stderr("perf profiling: cannot create /tmp/perf-<pid>.map\n");
+            return false;
+        }
+    }
+
+    if (!perf.registered)
+    {
+        // os.register_at_fork(after_in_child=...) 同样覆盖脚本中的 os.fork()
+        bp::object callback{ bp::handle<>(PyCFunction_New(&after_fork_def, nullptr)) };
+        bp::dict kwargs;
+        kwargs["after_in_child"] = callback;
+        bp::object args{ bp::handle<>(PyTuple_New(0)) };
+        bp::object register_at_fork = bp::import("os").attr("register_at_fork");
+        bp::handle<> result(PyObject_Call(register_at_fork.ptr(), args.ptr(), kwargs.ptr()));
+        perf.registered = true;
+    }
+
+    _PyInterpreterState_SetEvalFrameFunc(interp, eval_frame);
+    return true;
+#else
+    if (enabled)
+        write_stderr("perf profiling requires Python 3.9+ on Linux (x86-64 or AArch64)\n");
+    return false;
+#endif
+}
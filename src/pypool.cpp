@@ -0,0 +1,260 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#include "pyembed_pool.h"
+
+#include <thread>
+#include <stdexcept>
+#include <boost/format.hpp>
+
+namespace {
+
+// 池的序号，使同名的池拥有各自的上下文
+std::atomic<uint64_t> pool_serial{ 0 };
+
+int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 在上下文中执行模板代码并捕获快照，失败时返回异常描述
+std::string prepare(pyembed& embed, const pyembed_pool::options& opts, const pyembed::context& ctx)
+{
+    std::string message;
+    auto handler = [&](const pyembed::pyerror& pyerr) {
+        message = pyerr.format_exception();
+        return true;
+    };
+
+    if (!opts.prelude.empty())
+        embed.exec(ctx, opts.prelude, handler);
+    if (message.empty() && !opts.prelude_file.empty())
+        embed.exec_file(ctx, opts.prelude_file, {}, handler);
+    if (message.empty())
+        embed.snapshot(ctx);
+    return message;
+}
+
+// 推迟自动回收，直到作用域结束
+class recycle_deferral
+{
+public:
+    explicit recycle_deferral(pyembed& embed) : _embed(embed) { _embed.defer_recycle(); }
+    ~recycle_deferral() { _embed.resume_recycle(); }
+
+private:
+    pyembed& _embed;
+};
+
+} // namespace
+
+pyembed_pool::pyembed_pool(pyembed& embed, const options& opts)
+    : _embed(embed)
+    , _options(opts)
+    , _serial(++pool_serial)
+{
+    if (_options.max_size == 0)
+        _options.max_size = 1;
+    if (_options.min_size > _options.max_size)
+        _options.min_size = _options.max_size;
+
+    _slots.reset(new slot[_options.max_size]);
+
+    // 预热常驻的上下文，失败时析构函数不会执行，须移除已创建的上下文，其预热动作随之失效
+    for (size_t i = 0; i < _options.min_size; ++i)
+    {
+        _slots[i].state = reserved;
+        try
+        {
+            build(i);
+        }
+        catch (...)
+        {
+            for (size_t k = 0; k < i; ++k)
+            {
+                _embed.remove_context(_slots[k].ctx->name);
+                _slots[k].ctx.reset();
+                _slots[k].state = empty;
+            }
+            throw;
+        }
+        _slots[i].last_used = now_ns();
+        _slots[i].state = idle;
+    }
+}
+
+pyembed_pool::~pyembed_pool()
+{
+    for (size_t i = 0; i < _options.max_size; ++i)
+    {
+        if (_slots[i].ctx)
+            _embed.remove_context(_slots[i].ctx->name);
+    }
+}
+
+void pyembed_pool::build(size_t index)
+{
+    // 模板代码执行后可能触发自动回收，而预热动作尚未登记，上下文将被清空
+    recycle_deferral deferral(_embed);
+
+    // create_context() 对已存在的名称返回原有的上下文，池销毁或收缩时将移除不属于它的上下文
+    const std::string name = boost::str(
+        boost::format("%1%@%2%#%3%") % _options.name % _serial % index);
+    if (_embed.get_context(name))
+    {
+        _slots[index].state = empty;
+        throw std::runtime_error("The pooled context name is already in use: " + name);
+    }
+
+    slot& item = _slots[index];
+    item.ctx = _embed.create_context(name);
+
+    std::string message = prepare(_embed, _options, item.ctx);
+    if (!message.empty())
+    {
+        _embed.remove_context(item.ctx->name);
+        item.ctx.reset();
+        item.state = empty;
+        throw std::runtime_error(
+            "Failed to initialize the pooled context: " + message);
+    }
+
+    // 解释器回收后重新执行模板代码，上下文被释放后自动失效
+    _embed.add_warmup(item.ctx,
+        [&embed = _embed, opts = _options](const pyembed::context& ctx) {
+            std::string message = prepare(embed, opts, ctx);
+            if (!message.empty())
+                PySys_FormatStderr("%s", message.c_str());
+        });
+}
+
+pyembed_pool::lease pyembed_pool::checkout()
+{
+    int64_t started = 0;
+    for (unsigned spins = 0; ; ++spins)
+    {
+        // 优先选取空闲的上下文
+        for (size_t i = 0; i < _options.max_size; ++i)
+        {
+            int expected = idle;
+            if (_slots[i].state.compare_exchange_strong(expected, busy))
+            {
+                record_checkout(started);
+                _embed.defer_recycle();
+                return lease(this, i, _slots[i].ctx);
+            }
+        }
+
+        // 未达上限则扩容
+        for (size_t i = 0; i < _options.max_size; ++i)
+        {
+            int expected = empty;
+            if (_slots[i].state.compare_exchange_strong(expected, reserved))
+            {
+                build(i);
+                _slots[i].state = busy;
+                record_checkout(started);
+                _embed.defer_recycle();
+                return lease(this, i, _slots[i].ctx);
+            }
+        }
+
+        // 等待其他线程归还，归还时需要恢复快照，因此等待期间必须释放GIL
+        if (started == 0)
+            started = now_ns();
+
+        pyembed::gil_release unlock;
+        if (spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+void pyembed_pool::record_checkout(int64_t started)
+{
+    _checkouts.fetch_add(1, std::memory_order_relaxed);
+    if (!started)
+        return;
+
+    // 等待期间可能有上下文被释放，此时等待结束于扩容而非归还
+    uint64_t waited = now_ns() - started;
+    _waits.fetch_add(1, std::memory_order_relaxed);
+    _wait_total_ns.fetch_add(waited, std::memory_order_relaxed);
+
+    uint64_t longest = _wait_max_ns.load(std::memory_order_relaxed);
+    while (waited > longest &&
+        !_wait_max_ns.compare_exchange_weak(longest, waited))
+        ;
+}
+
+void pyembed_pool::checkin(size_t index)
+{
+    slot& item = _slots[index];
+    _embed.restore(item.ctx);
+    item.last_used = now_ns();
+    item.state = idle;
+    _embed.resume_recycle();
+
+    shrink();
+}
+
+void pyembed_pool::shrink()
+{
+    const int64_t deadline = now_ns() -
+        std::chrono::duration_cast<std::chrono::nanoseconds>(_options.idle_timeout).count();
+
+    for (size_t i = _options.min_size; i < _options.max_size; ++i)
+    {
+        slot& item = _slots[i];
+        if (item.last_used.load(std::memory_order_relaxed) > deadline)
+            continue;
+
+        int expected = idle;
+        if (!item.state.compare_exchange_strong(expected, reserved))
+            continue;
+
+        _embed.remove_context(item.ctx->name);
+        item.ctx.reset();
+        item.state = empty;
+    }
+}
+
+pyembed_pool::statistics pyembed_pool::stats() const
+{
+    statistics result = {
+        _checkouts.load(),
+        _waits.load(),
+        _wait_total_ns.load(),
+        _wait_max_ns.load(),
+        0, 0 };
+
+    for (size_t i = 0; i < _options.max_size; ++i)
+    {
+        int state = _slots[i].state.load();
+        if (state != empty)
+            ++result.size;
+        if (state == idle)
+            ++result.idle;
+    }
+    return result;
+}
@@ -0,0 +1,720 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#include "pyembed_process_pool.h"
+#include "pyfork.hpp"
+#include "pyshm.hpp"
+
+#include <thread>
+#include <stdexcept>
+#include <boost/format.hpp>
+
+#if OS_POSIX
+#   include <signal.h>
+#   include <unistd.h>
+#   include <sys/wait.h>
+#endif
+
+namespace bp = boost::python;
+
+namespace {
+enum request_op : uint32_t { op_eval, op_exec, op_call };
+} // namespace
+
+#if OS_POSIX
+namespace {
+
+enum pool_state : uint32_t { pool_starting, pool_running, pool_failed };
+enum slab_state : uint32_t { slab_free, slab_queued, slab_running, slab_done };
+enum reply_status : uint32_t { reply_ok, reply_error, reply_timeout, reply_budget, reply_crashed, reply_overflow };
+
+// 监管进程在 pylimits::timeout 之后再等待多久，仍未完成则终止工作进程
+const int64_t kill_grace_ns = 1000000000;
+
+// 共享内存块的头部，请求与结果数据紧随其后
+struct alignas(64) slab
+{
+    std::atomic<uint32_t> state;
+    std::atomic<int32_t>  owner;    // 处理该块的工作进程序号，slab_running 时有效
+    uint32_t op;
+    uint32_t status;
+    int32_t  signal;
+    uint32_t request;           // 请求的字节数
+    uint32_t response;          // 结果(pickle)的字节数
+    uint32_t text;              // 结果之后的文本(异常描述)的字节数
+    int64_t  deadline_ns;       // 监管进程终止工作进程的时间点，0表示不限制
+    int64_t  timeout_ms;
+    int64_t  max_instructions;
+    int64_t  max_cpu_ms;
+};
+
+struct alignas(64) worker_record
+{
+    std::atomic<int32_t>  pid;
+    std::atomic<int32_t>  current;  // 已取出但尚未完成的共享内存块，-1表示空闲
+    std::atomic<uint32_t> ready;
+    std::atomic<uint32_t> expired;  // 因超时被监管进程终止
+};
+
+struct alignas(64) control
+{
+    std::atomic<uint32_t> state;
+    std::atomic<uint32_t> stopping;
+    std::atomic<uint32_t> pending;  // 请求计数，空闲的工作进程在其上等待
+    std::atomic<uint32_t> released; // 归还计数，等待空闲共享内存块的调用者在其上等待
+    std::atomic<uint64_t> restarts;
+    std::atomic<uint64_t> completed;
+    std::atomic<uint64_t> failed;
+    char                  message[4096];
+};
+
+int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t align(size_t size)
+{
+    return (size + 63) & ~size_t(63);
+}
+
+bp::object to_bytes(const std::string& data)
+{
+    return bp::object(bp::handle<>(PyBytes_FromStringAndSize(data.data(), data.size())));
+}
+
+std::string from_bytes(const bp::object& data)
+{
+    char* buffer = nullptr;
+    Py_ssize_t size = 0;
+    if (PyBytes_AsStringAndSize(data.ptr(), &buffer, &size) != 0)
+        bp::throw_error_already_set();
+    return std::string(buffer, size);
+}
+
+typedef pyembed_process_pool::options pool_options;
+
+// 共享内存的布局：控制块、工作进程记录、请求队列、空闲队列与共享内存块
+struct pool_memory
+{
+    explicit pool_memory(const pool_options& opts)
+        : memory(layout(opts, nullptr))
+    {
+        layout(opts, this);
+        new (ctl) control();
+        for (size_t i = 0; i < opts.workers; ++i)
+        {
+            new (&workers[i]) worker_record();
+            workers[i].current.store(-1);
+        }
+        for (size_t i = 0; i < opts.slabs; ++i)
+        {
+            new (&at(i)) slab();
+            at(i).owner.store(-1);
+            idle->push(static_cast<uint32_t>(i));
+        }
+    }
+
+    // 计算共享内存的布局，self 不为空时设置各部分的地址
+    static size_t layout(const pool_options& opts, pool_memory* self)
+    {
+        size_t offset = 0;
+        auto take = [&](size_t bytes) {
+            size_t at = offset;
+            offset += align(bytes);
+            return at;
+        };
+
+        size_t control_at  = take(sizeof(control));
+        size_t workers_at  = take(sizeof(worker_record) * opts.workers);
+        size_t requests_at = take(pyshm::ring::bytes(opts.slabs));
+        size_t idle_at     = take(pyshm::ring::bytes(opts.slabs));
+        size_t stride      = align(sizeof(slab) + opts.slab_size);
+        size_t slabs_at    = take(stride * opts.slabs);
+
+        if (self)
+        {
+            char* base = self->memory.data();
+            self->ctl      = reinterpret_cast<control*>(base + control_at);
+            self->workers  = reinterpret_cast<worker_record*>(base + workers_at);
+            self->requests = pyshm::ring::create(base + requests_at, opts.slabs);
+            self->idle     = pyshm::ring::create(base + idle_at, opts.slabs);
+            self->slabs    = base + slabs_at;
+            self->stride   = stride;
+        }
+        return offset;
+    }
+
+    slab& at(size_t index) { return *reinterpret_cast<slab*>(slabs + index * stride); }
+    char* data(size_t index) { return slabs + index * stride + sizeof(slab); }
+
+    pyshm::region  memory;
+    control*       ctl      = nullptr;
+    worker_record* workers  = nullptr;
+    pyshm::ring*   requests = nullptr;
+    pyshm::ring*   idle     = nullptr;
+    char*          slabs    = nullptr;
+    size_t         stride   = 0;
+    std::atomic<bool> lost{ false }; // 监管进程已退出(仅在当前进程中使用)
+};
+
+// 解析 "name.attr..." 形式的可调用对象：name 在默认上下文中查找，不存在时作为模块导入
+bp::object resolve(pyembed& embed, const std::string& path)
+{
+    size_t dot = path.find('.');
+    std::string head = path.substr(0, dot);
+
+    bp::object target;
+    if (embed.global().has_key(head))
+        target = embed.global()[head];
+    else
+        target = bp::import(head.c_str());
+
+    while (dot != std::string::npos)
+    {
+        size_t next = path.find('.', dot + 1);
+        target = target.attr(path.substr(dot + 1, next - dot - 1).c_str());
+        dot = next;
+    }
+    return target;
+}
+
+// 处理共享内存块中的请求并就地写回结果，由调用方发布 slab_done
+void serve_request(pyembed& embed, pool_memory& sh, 
+    uint32_t index, const pool_options& opts, const bp::object& pickle)
+{
+    slab& item = sh.at(index);
+    char* data = sh.data(index);
+    std::string request(data, item.request);
+
+    pyembed::pylimits limits;
+    limits.timeout = std::chrono::milliseconds(item.timeout_ms);
+    limits.max_instructions = item.max_instructions;
+    limits.max_cpu_time = std::chrono::milliseconds(item.max_cpu_ms);
+
+    uint32_t status = reply_ok;
+    std::string payload, text;
+    auto handler = [&](const pyembed::pyerror& pyerr) {
+        status = reply_error;
+        text = pyerr.format_exception();
+        payload.clear();
+        try
+        {
+            // 异常对象无法序列化时，调用者将收到携带异常描述的 RuntimeError
+            payload = from_bytes(pickle.attr("dumps")(pyerr.pyexception));
+        }
+        catch (const bp::error_already_set&)
+        {
+            PyErr_Clear();
+        }
+        return true;
+    };
+
+    try
+    {
+        switch (item.op)
+        {
+        case op_eval:
+        {
+            bp::object result = embed.eval(request, handler, limits);
+            if (status == reply_ok)
+                embed.exec_for([&]() { payload = from_bytes(pickle.attr("dumps")(result)); }, handler);
+            break;
+        }
+        case op_exec:
+            embed.exec(request, handler, limits);
+            break;
+        case op_call:
+        {
+            size_t split = request.find('\0');
+            embed.exec_for([&]() {
+                bp::object callable = resolve(embed, request.substr(0, split));
+                bp::object packed = pickle.attr("loads")(to_bytes(request.substr(split + 1)));
+                bp::object args = packed[0], kwargs = packed[1];
+                bp::object result{ bp::handle<>(
+                    PyObject_Call(callable.ptr(), args.ptr(), kwargs.ptr())) };
+                payload = from_bytes(pickle.attr("dumps")(result));
+                }, handler, limits);
+            break;
+        }
+        }
+    }
+    catch (const pyembed::timeout_error& e)
+    {
+        status = reply_timeout;
+        text = e.what();
+    }
+    catch (const pyembed::budget_error& e)
+    {
+        status = reply_budget;
+        text = e.what();
+    }
+    catch (const std::exception& e)
+    {
+        status = reply_error;
+        text = e.what();
+    }
+
+    if (payload.size() + text.size() > opts.slab_size)
+    {
+        status = reply_overflow;
+        text = boost::str(boost::format("The result of %1% bytes exceeds the slab size of %2% bytes")
+            % (payload.size() + text.size()) % opts.slab_size);
+        payload.clear();
+    }
+
+    memcpy(data, payload.data(), payload.size());
+    memcpy(data + payload.size(), text.data(), text.size());
+    item.status = status;
+    item.response = static_cast<uint32_t>(payload.size());
+    item.text = static_cast<uint32_t>(text.size());
+}
+
+// 工作进程：从请求队列中取出共享内存块并处理，直到池被关闭或监管进程退出
+int run_worker(pyembed& embed, pool_memory& sh, size_t slot, const pool_options& opts)
+{
+    worker_record& self = sh.workers[slot];
+    pid_t supervisor = ::getppid();
+    bp::object pickle = bp::import("pickle");
+    self.ready.store(1);
+
+    while (!sh.ctl->stopping.load() && ::getppid() == supervisor)
+    {
+        // 出队时即记录取得的块，此后任何时刻退出，监管进程都能找到该块
+        uint32_t seen = sh.ctl->pending.load(std::memory_order_acquire);
+        if (!sh.requests->pop(self.current))
+        {
+            pyembed::gil_release unlock;
+            pyshm::wait(sh.ctl->pending, seen, std::chrono::milliseconds(100));
+            continue;
+        }
+
+        uint32_t index = static_cast<uint32_t>(self.current.load());
+        slab& item = sh.at(index);
+        item.owner.store(static_cast<int32_t>(slot));
+        item.state.store(slab_running);
+        serve_request(embed, sh, index, opts, pickle);
+
+        // 先解除关联再发布结果，块被调用者归还并复用后不再与本进程相关；
+        // 两步之间退出时，监管进程按 owner 找到该块并发布已写好的结果
+        self.current.store(-1);
+        item.state.store(slab_done, std::memory_order_release);
+        pyshm::wake(item.state);
+    }
+    return 0;
+}
+
+// 监管进程：预热后创建工作进程，回收崩溃或超时的工作进程并重新创建
+int supervise(pyembed& embed, pool_memory& sh, const pool_options& opts)
+{
+    pyembed::gil_acquire gil("process_pool");
+    control& ctl = *sh.ctl;
+    try
+    {
+        pyfork::warm_up(embed, opts.preload, opts.prelude);
+    }
+    catch (const std::exception& e)
+    {
+        strncpy(ctl.message, e.what(), sizeof(ctl.message) - 1);
+        ctl.state.store(pool_failed);
+        pyshm::wake(ctl.state);
+        return 1;
+    }
+
+    pid_t pid = 0, host = ::getppid();
+    std::vector<int64_t> respawn_at(opts.workers, 0);
+    auto start = [&](size_t index) {
+        worker_record& record = sh.workers[index];
+        record.ready.store(0);
+        record.expired.store(0);
+        record.current.store(-1);
+        record.pid.store(pyfork::spawn([&]() {
+            return run_worker(embed, sh, index, opts);
+            }, SIGKILL));
+    };
+
+    for (size_t i = 0; i < opts.workers; ++i)
+        start(i);
+    ctl.state.store(pool_running);
+    pyshm::wake(ctl.state);
+
+    while (!ctl.stopping.load() && ::getppid() == host)
+    {
+        // 回收退出的工作进程，未完成的请求以崩溃(或超时)结束
+        int status = 0;
+        while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            for (size_t i = 0; i < opts.workers; ++i)
+            {
+                worker_record& record = sh.workers[i];
+                if (record.pid.load() != pid)
+                    continue;
+
+                // 已取出的块可能尚未标记为 slab_running
+                int32_t current = record.current.load();
+                if (current < 0)
+                {
+                    // 结果已写好但尚未发布
+                    for (size_t k = 0; k < opts.slabs; ++k)
+                    {
+                        slab& item = sh.at(k);
+                        if (item.state.load() == slab_running && item.owner.load() == static_cast<int32_t>(i))
+                        {
+                            item.state.store(slab_done, std::memory_order_release);
+                            pyshm::wake(item.state);
+                        }
+                    }
+                }
+                else if (sh.at(current).state.load() != slab_done)
+                {
+                    slab& item = sh.at(current);
+                    std::string text = record.expired.load()
+                        ? boost::str(boost::format(
+                            "The call exceeded its deadline of %1% ms and worker %2% was killed")
+                            % item.timeout_ms % pid)
+                        : WIFSIGNALED(status)
+                        ? boost::str(boost::format("Worker %1% was terminated by signal %2%")
+                            % pid % WTERMSIG(status))
+                        : boost::str(boost::format("Worker %1% exited with code %2%")
+                            % pid % WEXITSTATUS(status));
+                    text.resize(std::min(text.size(), opts.slab_size));
+                    memcpy(sh.data(current), text.data(), text.size());
+                    item.status = record.expired.load() ? reply_timeout : reply_crashed;
+                    item.signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+                    item.response = 0;
+                    item.text = static_cast<uint32_t>(text.size());
+                    item.state.store(slab_done, std::memory_order_release);
+                    pyshm::wake(item.state);
+                }
+
+                record.pid.store(0);
+                record.ready.store(0);
+                respawn_at[i] = now_ns() + std::chrono::nanoseconds(opts.restart_delay).count();
+            }
+        }
+
+        int64_t now = now_ns();
+        for (size_t i = 0; i < opts.workers; ++i)
+        {
+            worker_record& record = sh.workers[i];
+            pid = record.pid.load();
+            if (pid == 0)
+            {
+                if (now >= respawn_at[i])
+                {
+                    start(i);
+                    ctl.restarts.fetch_add(1);
+                }
+                continue;
+            }
+
+            // 超时的请求无法在工作进程中中断(如阻塞在C扩展中)，终止该工作进程
+            int32_t current = record.current.load();
+            if (current < 0 || record.expired.load())
+                continue;
+            int64_t deadline = sh.at(current).deadline_ns;
+            if (deadline > 0 && now > deadline && sh.at(current).state.load() == slab_running)
+            {
+                record.expired.store(1);
+                ::kill(pid, SIGKILL);
+            }
+        }
+
+        pyembed::gil_release unlock;
+        pyshm::wait(ctl.stopping, 0, std::chrono::milliseconds(10));
+    }
+
+    for (size_t i = 0; i < opts.workers; ++i)
+    {
+        pid = sh.workers[i].pid.load();
+        if (pid > 0)
+        {
+            ::kill(pid, SIGKILL);
+            ::waitpid(pid, nullptr, 0);
+        }
+    }
+    return 0;
+}
+
+} // namespace
+#endif
+
+struct pyembed_process_pool::shared
+#if OS_POSIX
+    : pool_memory
+#endif
+{
+#if OS_POSIX
+    using pool_memory::pool_memory;
+#endif
+};
+
+pyembed_process_pool::pyembed_process_pool(pyembed& embed, const options& opts)
+    : _embed(embed)
+    , _options(opts)
+    , _pid(-1)
+{
+#if OS_POSIX
+    _options.workers = std::max<size_t>(_options.workers, 1);
+    if (_options.slabs == 0)
+        _options.slabs = _options.workers * 2;
+    _shared = std::make_shared<shared>(_options);
+
+    {
+        pyembed::gil_acquire gil("process_pool");
+        _pid = pyfork::spawn([&]() {
+            return supervise(embed, *_shared, _options);
+            }, SIGTERM);
+    }
+    if (_pid < 0)
+        throw std::runtime_error(std::string("process pool fork failed: ") + strerror(errno));
+
+    // 等待预热完成且所有工作进程就绪
+    control& ctl = *_shared->ctl;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (true)
+    {
+        uint32_t state = ctl.state.load();
+        if (state == pool_failed)
+        {
+            std::string message = ctl.message;
+            ::waitpid(_pid, nullptr, 0);
+            throw std::runtime_error("process pool failed to start: " + message);
+        }
+
+        size_t ready = 0;
+        for (size_t i = 0; i < _options.workers; ++i)
+            ready += _shared->workers[i].ready.load();
+        if (state == pool_running && ready == _options.workers)
+            break;
+
+        if (::waitpid(_pid, nullptr, WNOHANG) == _pid || std::chrono::steady_clock::now() > deadline)
+        {
+            ::kill(_pid, SIGKILL);
+            ::waitpid(_pid, nullptr, 0);
+            throw std::runtime_error("process pool failed to start");
+        }
+
+        pyembed::gil_release unlock;
+        pyshm::wait(ctl.state, state, std::chrono::milliseconds(5));
+    }
+#else
+    (void)embed;
+    throw std::runtime_error("pyembed_process_pool is only supported on POSIX systems");
+#endif
+}
+
+pyembed_process_pool::~pyembed_process_pool()
+{
+#if OS_POSIX
+    if (_pid > 0 && !_shared->lost.load())
+    {
+        _shared->ctl->stopping.store(1);
+        pyshm::wake(_shared->ctl->stopping);
+        pyshm::wake(_shared->ctl->pending);
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (::waitpid(_pid, nullptr, WNOHANG) == 0)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                ::kill(_pid, SIGKILL);
+                ::waitpid(_pid, nullptr, 0);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+#endif
+}
+
+boost::python::object pyembed_process_pool::eval(
+    const std::string& expression,
+    const std::function<bool(const pyembed::pyerror&)>& exception_handler /*= {} */,
+    const pyembed::pylimits& limits /*= {} */)
+{
+    return submit(op_eval, expression, exception_handler, limits);
+}
+
+boost::python::object pyembed_process_pool::exec(
+    const std::string& code,
+    const std::function<bool(const pyembed::pyerror&)>& exception_handler /*= {} */,
+    const pyembed::pylimits& limits /*= {} */)
+{
+    return submit(op_exec, code, exception_handler, limits);
+}
+
+boost::python::object pyembed_process_pool::call(
+    const std::string& callable,
+    const boost::python::tuple& args /*= boost::python::tuple() */,
+    const boost::python::dict& kwargs /*= boost::python::dict() */,
+    const std::function<bool(const pyembed::pyerror&)>& exception_handler /*= {} */,
+    const pyembed::pylimits& limits /*= {} */)
+{
+    pyembed::gil_acquire gil("process_pool.call", &callable);
+    std::string request = callable + '\0';
+#if OS_POSIX
+    _embed.exec_for([&]() {
+        request += from_bytes(bp::import("pickle").attr("dumps")(bp::make_tuple(args, kwargs)));
+        });
+#endif
+    return submit(op_call, request, exception_handler, limits);
+}
+
+boost::python::object pyembed_process_pool::submit(
+    uint32_t op,
+    const std::string& request,
+    const std::function<bool(const pyembed::pyerror&)>& exception_handler,
+    const pyembed::pylimits& limits)
+{
+#if OS_POSIX
+    pyembed::gil_acquire gil("process_pool", &request);
+    if (request.size() > _options.slab_size)
+        throw std::length_error(boost::str(boost::format(
+            "The request of %1% bytes exceeds the slab size of %2% bytes")
+            % request.size() % _options.slab_size));
+
+    uint32_t status = reply_ok;
+    std::string payload, text;
+    {
+        pyembed::gil_release unlock;
+        control& ctl = *_shared->ctl;
+        auto check = [&]() {
+            if (!_shared->lost.load() && ::waitpid(_pid, nullptr, WNOHANG) != _pid)
+                return;
+            _shared->lost.store(true);
+            throw std::runtime_error("process pool supervisor has exited");
+        };
+
+        // 取得空闲的共享内存块，全部占用时等待归还
+        uint32_t index = 0;
+        while (true)
+        {
+            uint32_t seen = ctl.released.load(std::memory_order_acquire);
+            if (_shared->idle->pop(index))
+                break;
+            check();
+            pyshm::wait(ctl.released, seen, std::chrono::milliseconds(100));
+        }
+
+        slab& item = _shared->at(index);
+        memcpy(_shared->data(index), request.data(), request.size());
+        item.op = op;
+        item.status = reply_ok;
+        item.signal = 0;
+        item.request = static_cast<uint32_t>(request.size());
+        item.response = item.text = 0;
+        item.timeout_ms = limits.timeout.count();
+        item.max_instructions = limits.max_instructions;
+        item.max_cpu_ms = limits.max_cpu_time.count();
+        item.deadline_ns = limits.timeout.count() > 0
+            ? now_ns() + std::chrono::nanoseconds(limits.timeout).count() + kill_grace_ns : 0;
+        item.state.store(slab_queued, std::memory_order_release);
+
+        _shared->requests->push(index);
+        ctl.pending.fetch_add(1, std::memory_order_release);
+        pyshm::wake(ctl.pending, 1);
+
+        while (true)
+        {
+            uint32_t state = item.state.load(std::memory_order_acquire);
+            if (state == slab_done)
+                break;
+            check();
+            pyshm::wait(item.state, state, std::chrono::milliseconds(100));
+        }
+
+        status = item.status;
+        const char* data = _shared->data(index);
+        payload.assign(data, item.response);
+        text.assign(data + item.response, item.text);
+
+        item.state.store(slab_free, std::memory_order_release);
+        _shared->idle->push(index);
+        ctl.released.fetch_add(1, std::memory_order_release);
+        pyshm::wake(ctl.released, 1);
+
+        ctl.completed.fetch_add(1);
+        if (status != reply_ok)
+            ctl.failed.fetch_add(1);
+    }
+
+    if (status == reply_timeout)
+        throw pyembed::timeout_error(text);
+    if (status == reply_budget)
+        throw pyembed::budget_error(text);
+
+    // 在当前进程中还原结果，或重新抛出工作进程中的异常
+    bp::object result;
+    _embed.exec_for([&]() {
+        if (status == reply_ok)
+        {
+            if (op != op_exec)
+                result = bp::import("pickle").attr("loads")(to_bytes(payload));
+            return;
+        }
+
+        bp::object error;
+        if (status == reply_error && !payload.empty())
+        {
+            error = bp::import("pickle").attr("loads")(to_bytes(payload));
+            if (!PyExceptionInstance_Check(error.ptr()))
+                error = bp::object();
+#if PY_VERSION_HEX >= 0x030B0000
+            else
+                error.attr("add_note")("Raised in worker process:\n" + text);
+#endif
+        }
+        if (error.is_none())
+        {
+            bp::object type{ bp::handle<>(bp::borrowed(
+                status == reply_overflow ? PyExc_OverflowError : PyExc_RuntimeError)) };
+            error = type(bp::str(text.data(), text.size()));
+        }
+
+        PyErr_SetObject((PyObject*)Py_TYPE(error.ptr()), error.ptr());
+        bp::throw_error_already_set();
+        }, exception_handler);
+    return result;
+#else
+    (void)op;
+    (void)request;
+    (void)exception_handler;
+    (void)limits;
+    throw std::runtime_error("pyembed_process_pool is only supported on POSIX systems");
+#endif
+}
+
+pyembed_process_pool::statistics pyembed_process_pool::stats() const
+{
+    statistics result = {};
+#if OS_POSIX
+    control& ctl = *_shared->ctl;
+    for (size_t i = 0; i < _options.workers; ++i)
+        result.workers += _shared->workers[i].pid.load() > 0 && _shared->workers[i].ready.load();
+    result.restarts = ctl.restarts.load();
+    result.completed = ctl.completed.load();
+    result.failed = ctl.failed.load();
+#endif
+    return result;
+}
@@ -0,0 +1,224 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pyshm_h__
+#define pyshm_h__
+
+#include "utility/config.h"
+
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+
+#if OS_POSIX
+#   include <errno.h>
+#   include <string.h>
+#   include <sys/mman.h>
+#endif
+#if OS_LINUX
+#   include <unistd.h>
+#   include <sys/syscall.h>
+#   include <linux/futex.h>
+#endif
+
+#if OS_POSIX
+namespace pyshm {
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+              std::atomic<uint64_t>::is_always_lock_free,
+              "atomics placed in shared memory must be address-free");
+
+//! 匿名共享内存，fork出的子进程继承同一映射
+class region
+{
+public:
+    explicit region(size_t size)
+        : _size(size)
+    {
+        _base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (_base == MAP_FAILED)
+            throw std::runtime_error(std::string("mmap failed: ") + strerror(errno));
+    }
+
+    ~region()
+    {
+        ::munmap(_base, _size);
+    }
+
+    region(const region&) = delete;
+    region& operator=(const region&) = delete;
+
+    char* data() const { return static_cast<char*>(_base); }
+    size_t size() const { return _size; }
+
+private:
+    void*  _base;
+    size_t _size;
+};
+
+//! @brief 在 word 仍等于 expected 时等待，直至被唤醒或超时
+//! @note Linux上使用(跨进程的)futex，其他系统退化为短暂休眠，调用者须在循环中重新检查条件。
+inline void wait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::milliseconds timeout)
+{
+#if OS_LINUX
+    timespec ts = { 
+        static_cast<time_t>(timeout.count() / 1000), 
+        static_cast<long>(timeout.count() % 1000 * 1000000) };
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+    if (word.load(std::memory_order_acquire) == expected)
+        std::this_thread::sleep_for(std::min<std::chrono::microseconds>(timeout, std::chrono::microseconds(200)));
+#endif
+}
+
+//! @brief 唤醒在 word 上等待的进程(线程)
+inline void wake(std::atomic<uint32_t>& word, int count = INT_MAX)
+{
+#if OS_LINUX
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+#else
+    (void)word;
+    (void)count;
+#endif
+}
+
+//!
+//! 放置在共享内存中的有界多生产者多消费者队列(Dmitry Vyukov)，元素为32位整数
+//! 
+//! 入队与出队仅需一次CAS，不使用锁，但并非崩溃安全：进程在CAS之后、写入 sequence 之前被终止时，
+//! 该单元将永远处于未就绪状态，此后轮到该位置的入队(视为已满)与出队(视为为空)都将停滞。
+//! 窗口仅有几条指令且不会发生缺页等错误，因此只有外部的 SIGKILL(如OOM killer)可能命中；
+//! 进程池中工作进程仅在请求队列上出队，监管进程只终止已将块标记为 slab_running 的工作进程，不会命中该窗口。
+//! 
+class ring
+{
+public:
+    //! 容量为 capacity(向上取2的幂) 的队列所需的字节数
+    static size_t bytes(size_t capacity)
+    {
+        return sizeof(ring) + (round_up(capacity) - 1) * sizeof(cell);
+    }
+
+    //! 在 memory 上构造容量为 capacity 的队列
+    static ring* create(void* memory, size_t capacity)
+    {
+        ring* queue = new (memory) ring;
+        size_t size = round_up(capacity);
+        queue->_mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+        {
+            new (&queue->_cells[i]) cell;
+            queue->_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        return queue;
+    }
+
+    bool push(uint32_t value)
+    {
+        uint64_t pos = _enqueue.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell& item = _cells[pos & _mask];
+            uint64_t sequence = item.sequence.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+            if (diff == 0)
+            {
+                if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    item.value = value;
+                    item.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; // 已满
+            else
+                pos = _enqueue.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool pop(uint32_t& value)
+    {
+        return pop_to([&](uint32_t item) { value = item; });
+    }
+
+    //! @brief 出队，元素在释放队列单元之前写入 value
+    //! @note value 位于共享内存时，其他进程可据此得知出队者已取得的元素，即便出队者随后崩溃。
+    bool pop(std::atomic<int32_t>& value)
+    {
+        return pop_to([&](uint32_t item) { value.store(static_cast<int32_t>(item)); });
+    }
+
+private:
+    template<class Store>
+    bool pop_to(Store store)
+    {
+        uint64_t pos = _dequeue.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell& item = _cells[pos & _mask];
+            uint64_t sequence = item.sequence.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    store(item.value);
+                    item.sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; // 为空
+            else
+                pos = _dequeue.load(std::memory_order_relaxed);
+        }
+    }
+
+    struct cell
+    {
+        std::atomic<uint64_t> sequence;
+        uint32_t              value;
+    };
+
+    static size_t round_up(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+    alignas(64) std::atomic<uint64_t> _enqueue{ 0 };
+    alignas(64) std::atomic<uint64_t> _dequeue{ 0 };
+    alignas(64) uint64_t              _mask = 0;
+    cell                              _cells[1];
+};
+
+} // namespace pyshm
+#endif
+
+#endif // pyshm_h__
@@ -0,0 +1,114 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#include "pyembed_stream.h"
+#include "pyvalue.hpp"
+
+namespace bp = boost::python;
+
+pystream_source::pystream_source(
+    const boost::python::object& iterable,
+    const std::vector<pyembed::pyvalue_type>& fields,
+    bool unpack,
+    const std::function<bool(const pyembed::pyerror&)>& exception_handler)
+    : _iterator(nullptr)
+    , _fields(fields)
+    , _unpack(unpack)
+    , _handler(exception_handler)
+    , _done(false)
+    , _failed(false)
+{
+    _iterator = PyObject_GetIter(iterable.ptr());
+    if (!_iterator)
+        bp::throw_error_already_set();
+}
+
+pystream_source::~pystream_source()
+{
+    if (_iterator)
+    {
+        pyembed::gil_acquire gil;
+        Py_DECREF(_iterator);
+    }
+}
+
+size_t pystream_source::fetch(size_t count, const std::vector<pyembed::pyoutput>& outputs)
+{
+    if (_done)
+        return 0;
+
+    const bool held = PyGILState_Check() != 0;
+    pyembed::gil_acquire gil("pystream");
+
+    size_t index = 0;
+    bool succeeded = false;
+    pyembed::get().exec_for([&]() {
+        for (; index < count; ++index)
+        {
+            bp::handle<> item(bp::allow_null(PyIter_Next(_iterator)));
+            if (!item)
+            {
+                if (PyErr_Occurred())
+                    bp::throw_error_already_set();
+                _done = true;
+                break;
+            }
+
+            if (!_unpack)
+            {
+                if (!from_python(outputs[0], index, item.get()))
+                    bp::throw_error_already_set();
+                continue;
+            }
+
+            bp::handle<> row(PySequence_Fast(item.get(), "stream items must be sequences"));
+            if (PySequence_Fast_GET_SIZE(row.get()) != Py_ssize_t(_fields.size()))
+            {
+                PyErr_Format(PyExc_ValueError, "expected %zd fields per item, got %zd",
+                    Py_ssize_t(_fields.size()), PySequence_Fast_GET_SIZE(row.get()));
+                bp::throw_error_already_set();
+            }
+
+            PyObject** values = PySequence_Fast_ITEMS(row.get());
+            for (size_t i = 0; i < _fields.size(); ++i)
+            {
+                if (!from_python(outputs[i], index, values[i]))
+                    bp::throw_error_already_set();
+            }
+        }
+        succeeded = true;
+        }, _handler);
+
+    if (!succeeded)
+    {
+        // 失败的元素不计入结果，此后迭代结束
+        _done = true;
+        _failed = true;
+    }
+
+    // 块之间让出GIL，以便其他线程执行
+    if (held)
+    {
+        pyembed::gil_release yield;
+    }
+    return index;
+}
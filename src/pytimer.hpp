@@ -0,0 +1,174 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#ifndef pytimer_h__
+#define pytimer_h__
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+//
+// 哈希时间轮，由单个线程驱动所有定时器
+//
+// 定时器回调在时间轮线程上执行，执行期间不持有内部锁。
+// 回调不应阻塞，尤其不能等待GIL：一个停滞的调用会推迟所有其他的定时器，需要GIL的工作应交由 pyexecutor 执行。
+//
+class pytimer_wheel
+{
+public:
+    typedef std::function<void()> callback;
+
+    explicit pytimer_wheel(
+        std::chrono::milliseconds tick = std::chrono::milliseconds(1),
+        size_t slots = 512)
+        : _tick(tick)
+        , _wheel(slots)
+        , _cursor(0)
+        , _next_id(1)
+        , _stop(false)
+    {
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ~pytimer_wheel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    pytimer_wheel(const pytimer_wheel&) = delete;
+    pytimer_wheel& operator=(const pytimer_wheel&) = delete;
+
+    // 添加定时器，返回定时器标识
+    uint64_t schedule(std::chrono::nanoseconds delay, callback f)
+    {
+        // 向上取整并额外推进一格，保证定时器不会提前触发
+        uint64_t ticks = (delay.count() + _tick_ns() - 1) / _tick_ns() + 1;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        const size_t slots = _wheel.size();
+        const size_t index = (_cursor + ticks) % slots;
+        const uint64_t id = _next_id++;
+
+        auto& bucket = _wheel[index];
+        bucket.push_back({ id, (ticks - 1) / slots, std::move(f) });
+        _index[id] = { index, std::prev(bucket.end()) };
+
+        if (_index.size() == 1)
+            _cond.notify_all();
+        return id;
+    }
+
+    // 取消定时器，已触发或不存在的定时器将被忽略
+    void cancel(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto iter = _index.find(id);
+        if (iter == _index.end())
+            return;
+        _wheel[iter->second.first].erase(iter->second.second);
+        _index.erase(iter);
+    }
+
+private:
+    struct entry
+    {
+        uint64_t id;
+        uint64_t rounds;
+        callback f;
+    };
+
+    int64_t _tick_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(_tick).count();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto next = std::chrono::steady_clock::now();
+
+        while (!_stop)
+        {
+            // 没有定时器时休眠，避免空转
+            if (_index.empty())
+            {
+                _cond.wait(lock, [&] { return _stop || !_index.empty(); });
+                next = std::chrono::steady_clock::now();
+                continue;
+            }
+
+            next += _tick;
+            if (_cond.wait_until(lock, next, [&] { return _stop; }))
+                break;
+
+            _cursor = (_cursor + 1) % _wheel.size();
+
+            std::vector<callback> expired;
+            auto& bucket = _wheel[_cursor];
+            for (auto iter = bucket.begin(); iter != bucket.end(); )
+            {
+                if (iter->rounds > 0)
+                {
+                    --iter->rounds;
+                    ++iter;
+                    continue;
+                }
+
+                expired.push_back(std::move(iter->f));
+                _index.erase(iter->id);
+                iter = bucket.erase(iter);
+            }
+
+            if (expired.empty())
+                continue;
+
+            lock.unlock();
+            for (auto& f : expired)
+                f();
+            lock.lock();
+        }
+    }
+
+private:
+    std::chrono::milliseconds   _tick;
+    std::vector<std::list<entry>> _wheel;
+    std::unordered_map<uint64_t, 
+        std::pair<size_t, std::list<entry>::iterator>> _index;
+    size_t                      _cursor;
+    uint64_t                    _next_id;
+    bool                        _stop;
+    std::mutex                  _mutex;
+    std::condition_variable     _cond;
+    std::thread                 _thread;
+};
+
+#endif // pytimer_h__
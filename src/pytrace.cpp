@@ -0,0 +1,421 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#include "pyembed.h"
+#include "pytrace.hpp"
+#include "pyhistogram.hpp"
+#include "utility/config.h"
+
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <cinttypes>
+
+#if PY_VERSION_HEX < 0x03090000
+#   include <frameobject.h>
+#endif
+
+#if OS_WIN
+#   include <process.h>
+#else
+#   include <unistd.h>
+#   include <pthread.h>
+#endif
+
+std::atomic<uint32_t> pytrace::state{ 0 };
+
+namespace {
+
+using pyhistogram::now_ns;
+
+struct event
+{
+    const char* category = nullptr;
+    const char* name = nullptr;     // 为空时以描述作为区间名(Python函数)
+    int64_t     begin = 0;
+    int64_t     end = 0;
+    std::string detail;
+};
+
+// 缓冲区由固定大小的块串联，记录的线程只追加到尾块，写出的线程释放已写完的块
+struct chunk
+{
+    static const size_t capacity = 512;
+
+    event               events[capacity];
+    std::atomic<size_t> size{ 0 };
+    std::atomic<chunk*> next{ nullptr };
+};
+
+struct thread_buffer
+{
+    uint64_t          tid = 0;
+    chunk*            head = nullptr;       // 由写出的线程访问
+    size_t            flushed = 0;          // head 中已写出的区间数量
+    chunk*            tail = nullptr;       // 仅由记录的线程访问
+    std::atomic<bool> retired{ false };     // 线程已退出，写完后释放
+
+    ~thread_buffer()
+    {
+        while (head)
+        {
+            chunk* next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+        }
+    }
+};
+
+std::mutex                                  registry_mutex;
+std::vector<std::unique_ptr<thread_buffer>> buffers;
+
+// 每个线程的追踪状态
+struct thread_state
+{
+    thread_buffer*       buffer = nullptr;
+    uint32_t             generation = 0;    // 安装函数调用记录函数时的追踪代次
+    std::vector<int64_t> calls;             // 尚未返回的函数调用的开始时间
+
+    ~thread_state()
+    {
+        if (buffer)
+            buffer->retired.store(true, std::memory_order_release);
+        buffer = nullptr;
+    }
+
+    thread_buffer& current()
+    {
+        if (!buffer)
+        {
+            auto created = std::make_unique<thread_buffer>();
+#ifdef PY_HAVE_THREAD_NATIVE_ID
+            created->tid = PyThread_get_thread_native_id();
+#else
+            created->tid = PyThread_get_thread_ident();
+#endif
+            created->head = created->tail = new chunk;
+
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            buffer = created.get();
+            buffers.push_back(std::move(created));
+        }
+        return *buffer;
+    }
+};
+
+thread_local thread_state local;
+
+std::atomic<uint32_t> generation{ 0 };      // 记录函数调用的追踪代次，0表示不记录
+std::atomic<int64_t>  call_threshold{ 0 };  // 纳秒
+uint32_t              generations = 0;
+
+// 输出文件，以下由 file_mutex 保护
+std::mutex    file_mutex;
+std::ofstream file;
+bool          first = true;     // 尚未写出任何区间
+bool          forked = false;   // fork 出的子进程不写入父进程的文件
+int           pid = 0;
+
+// 描述取首行，过长时截断
+std::string_view summarize(std::string_view detail)
+{
+    detail = detail.substr(0, detail.find('\n'));
+    return detail.substr(0, 80);
+}
+
+void escape(std::string& out, std::string_view text)
+{
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", c);
+                out += code;
+            }
+            else
+                out += c;
+        }
+    }
+}
+
+// Chrome Trace Event 的完整事件("ph":"X")，时间单位为微秒
+void append(std::string& out, const event& item, uint64_t tid)
+{
+    char numbers[128];
+    snprintf(numbers, sizeof(numbers),
+        "\",\"ph\":\"X\",\"ts\":%" PRId64 ".%03d,\"dur\":%" PRId64 ".%03d,\"pid\":%d,\"tid\":%" PRIu64,
+        item.begin / 1000, int(item.begin % 1000),
+        (item.end - item.begin) / 1000, int((item.end - item.begin) % 1000),
+        pid, tid);
+
+    out += first ? "{\"name\":\"" : ",\n{\"name\":\"";
+    first = false;
+    escape(out, item.name ? std::string_view(item.name) : std::string_view(item.detail));
+    out += "\",\"cat\":\"";
+    escape(out, item.category);
+    out += numbers;
+    if (item.name && !item.detail.empty())
+    {
+        out += ",\"args\":{\"detail\":\"";
+        escape(out, item.detail);
+        out += "\"}";
+    }
+    out += "}";
+}
+
+// 取出各线程已记录的区间，write 为false时丢弃，调用方持有 file_mutex
+size_t drain(bool write)
+{
+    size_t count = 0;
+    std::string out;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto iter = buffers.begin(); iter != buffers.end();)
+    {
+        thread_buffer& buffer = **iter;
+
+        // 先于读取各块确认线程是否退出，此后不会再有新的区间
+        const bool retired = buffer.retired.load(std::memory_order_acquire);
+        for (;;)
+        {
+            chunk* head = buffer.head;
+            const size_t size = head->size.load(std::memory_order_acquire);
+            for (; buffer.flushed < size; ++buffer.flushed)
+            {
+                if (!write)
+                    continue;
+                append(out, head->events[buffer.flushed], buffer.tid);
+                ++count;
+            }
+
+            if (!out.empty())
+            {
+                file.write(out.data(), out.size());
+                out.clear();
+            }
+
+            chunk* next = size == chunk::capacity ? head->next.load(std::memory_order_acquire) : nullptr;
+            if (!next)
+                break;
+            buffer.head = next;
+            buffer.flushed = 0;
+            delete head;
+        }
+
+        if (retired)
+            iter = buffers.erase(iter);
+        else
+            ++iter;
+    }
+    return count;
+}
+
+std::string describe(PyFrameObject* frame)
+{
+#if PY_VERSION_HEX >= 0x03090000
+    PyCodeObject* code = PyFrame_GetCode(frame);
+#else
+    PyCodeObject* code = frame->f_code;
+    Py_INCREF(code);
+#endif
+
+    // 调用可能正在传播异常，读取名称期间保存异常状态
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+
+#if PY_VERSION_HEX >= 0x030B0000
+    const char* name = PyUnicode_AsUTF8(code->co_qualname);
+#else
+    const char* name = PyUnicode_AsUTF8(code->co_name);
+#endif
+    const char* filename = PyUnicode_AsUTF8(code->co_filename);
+
+    std::string text = name ? name : "?";
+    if (filename)
+    {
+        std::string_view path(filename);
+        text += " (";
+        text += path.substr(path.find_last_of("/\\") + 1);
+        text += ":" + std::to_string(code->co_firstlineno) + ")";
+    }
+
+    PyErr_Clear();
+    PyErr_Restore(type, value, traceback);
+    Py_DECREF(code);
+    return text;
+}
+
+int profile(PyObject*, PyFrameObject* frame, int what, PyObject*)
+{
+    if (what == PyTrace_CALL)
+    {
+        local.calls.push_back(now_ns());
+        return 0;
+    }
+
+    // 安装前已开始的调用没有开始时间，不予记录
+    if (what != PyTrace_RETURN || local.calls.empty())
+        return 0;
+
+    const int64_t begin = local.calls.back();
+    const int64_t end = now_ns();
+    local.calls.pop_back();
+
+    if (end - begin < call_threshold.load(std::memory_order_relaxed) ||
+        local.generation != generation.load(std::memory_order_relaxed))
+        return 0;
+
+    pytrace::record("python", nullptr, begin, end, describe(frame));
+    return 0;
+}
+
+#if OS_POSIX
+void after_fork_child()
+{
+    // 子进程中其他线程已不存在，file_mutex 可能处于锁定状态
+    pytrace::state.store(0, std::memory_order_relaxed);
+    generation.store(0, std::memory_order_relaxed);
+    forked = true;
+}
+#endif
+
+} // namespace
+
+void pytrace::record(const char* category, const char* name, int64_t begin, int64_t end, std::string_view detail)
+{
+    thread_buffer& buffer = local.current();
+    chunk* tail = buffer.tail;
+    size_t size = tail->size.load(std::memory_order_relaxed);
+    if (size == chunk::capacity)
+    {
+        chunk* fresh = new chunk;
+        tail->next.store(fresh, std::memory_order_release);
+        buffer.tail = tail = fresh;
+        size = 0;
+    }
+
+    event& item = tail->events[size];
+    item.category = category;
+    item.name = name;
+    item.begin = begin;
+    item.end = end;
+    item.detail.assign(name ? summarize(detail) : detail);
+    tail->size.store(size + 1, std::memory_order_release);
+}
+
+void pytrace::enter()
+{
+    const uint32_t current = generation.load(std::memory_order_relaxed);
+    if (local.generation == current)
+        return;
+
+    PyEval_SetProfile(current ? &profile : nullptr, nullptr);
+    local.generation = current;
+    local.calls.clear();
+    profiled = current != 0;
+}
+
+bool pyembed::start_tracing(const trace_options& options)
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (forked || (pytrace::flags() & pytrace::active))
+        return false;
+
+    file.open(options.path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        file.clear();
+        return false;
+    }
+
+#if OS_WIN
+    pid = _getpid();
+#else
+    static std::once_flag registered;
+    std::call_once(registered, [] { pthread_atfork(nullptr, nullptr, &after_fork_child); });
+    pid = getpid();
+#endif
+
+    // 丢弃上次停止时仍在记录的区间
+    drain(false);
+    first = true;
+    file << "[\n";
+
+    call_threshold.store(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(options.call_threshold).count(),
+        std::memory_order_relaxed);
+    generation.store(options.python_calls ? ++generations : 0, std::memory_order_relaxed);
+    pytrace::state.store(pytrace::active | (options.gil_waits ? uint32_t(pytrace::gil_waits) : 0u),
+        std::memory_order_relaxed);
+    return true;
+}
+
+size_t pyembed::flush_trace()
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (forked || !(pytrace::flags() & pytrace::active))
+        return 0;
+
+    const size_t count = drain(true);
+    file.flush();
+    return count;
+}
+
+void pyembed::stop_tracing()
+{
+    {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        if (forked || !(pytrace::flags() & pytrace::active))
+            return;
+
+        pytrace::state.store(0, std::memory_order_relaxed);
+        generation.store(0, std::memory_order_relaxed);
+        drain(true);
+        file << "\n]\n";
+        file.close();
+    }
+
+    // 其他线程在下次进入时移除记录函数
+    if (Py_IsInitialized() && PyGILState_Check())
+        pytrace::enter();
+}
+
+pyembed::trace_scope::trace_scope(const char* category, const char* name, const std::string* detail /*= nullptr*/)
+    : _category(category)
+    , _name(name)
+    , _detail(detail)
+    , _started((pytrace::flags() & pytrace::active) ? now_ns() : 0)
+{
+}
+
+pyembed::trace_scope::~trace_scope()
+{
+    if (_started)
+        pytrace::record(_category, _name, _started, now_ns(), _detail ? *_detail : std::string_view());
+}
@@ -0,0 +1,59 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#ifndef pytrace_h__
+#define pytrace_h__
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+//
+// 时间线追踪的内部接口，由 gil_acquire/gil_release 使用
+//
+namespace pytrace {
+
+enum : uint32_t
+{
+    active    = 1,  // 正在追踪
+    gil_waits = 2,  // 记录获取GIL的等待
+};
+
+extern std::atomic<uint32_t> state;
+
+// 本线程是否安装了函数调用的记录函数
+inline thread_local bool profiled = false;
+
+inline uint32_t flags()
+{
+    return state.load(std::memory_order_relaxed);
+}
+
+// 记录一个区间到本线程的缓冲区
+void record(const char* category, const char* name, int64_t begin, int64_t end, std::string_view detail);
+
+// 持有GIL时调用，按需为本线程安装或移除函数调用的记录函数
+void enter();
+
+} // namespace pytrace
+
+#endif // pytrace_h__
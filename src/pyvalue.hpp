@@ -0,0 +1,90 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#ifndef pyvalue_h__
+#define pyvalue_h__
+
+#include "pyembed.h"
+
+//
+// pyembed::pyvalue_type 与Python对象之间的转换
+//
+
+// 将第index个元素转换为Python对象(新引用)
+inline PyObject* to_python(pyembed::pyvalue_type type, const void* data, size_t stride, size_t index)
+{
+    const char* ptr = static_cast<const char*>(data) + stride * index;
+    switch (type)
+    {
+    case pyembed::pyvalue_type::int64:
+        return PyLong_FromLongLong(*reinterpret_cast<const int64_t*>(ptr));
+    case pyembed::pyvalue_type::float64:
+        return PyFloat_FromDouble(*reinterpret_cast<const double*>(ptr));
+    case pyembed::pyvalue_type::boolean:
+        return PyBool_FromLong(*reinterpret_cast<const bool*>(ptr));
+    case pyembed::pyvalue_type::string: {
+        auto& str = *reinterpret_cast<const std::string*>(ptr);
+        return PyUnicode_FromStringAndSize(str.data(), str.size());
+    }
+    }
+    return nullptr;
+}
+
+// 将结果写入输出缓冲区的第index个元素，失败时设置Python异常并返回false
+inline bool from_python(const pyembed::pyoutput& output, size_t index, PyObject* value)
+{
+    char* ptr = static_cast<char*>(output.data) + output.stride * index;
+    switch (output.type)
+    {
+    case pyembed::pyvalue_type::int64: {
+        long long result = PyLong_AsLongLong(value);
+        if (result == -1 && PyErr_Occurred())
+            return false;
+        *reinterpret_cast<int64_t*>(ptr) = result;
+        return true;
+    }
+    case pyembed::pyvalue_type::float64: {
+        double result = PyFloat_AsDouble(value);
+        if (result == -1.0 && PyErr_Occurred())
+            return false;
+        *reinterpret_cast<double*>(ptr) = result;
+        return true;
+    }
+    case pyembed::pyvalue_type::boolean: {
+        int result = PyObject_IsTrue(value);
+        if (result < 0)
+            return false;
+        *reinterpret_cast<bool*>(ptr) = result != 0;
+        return true;
+    }
+    case pyembed::pyvalue_type::string: {
+        Py_ssize_t size = 0;
+        const char* str = PyUnicode_AsUTF8AndSize(value, &size);
+        if (!str)
+            return false;
+        reinterpret_cast<std::string*>(ptr)->assign(str, size);
+        return true;
+    }
+    }
+    return false;
+}
+
+#endif // pyvalue_h__
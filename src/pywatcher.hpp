@@ -0,0 +1,219 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+#ifndef pywatcher_h__
+#define pywatcher_h__
+
+#include "utility/config.h"
+
+#include <map>
+#include <set>
+#include <cerrno>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+
+#if OS_LINUX
+#   include <poll.h>
+#   include <unistd.h>
+#   include <sys/inotify.h>
+#endif
+
+//
+// 文件变更监视器，由单个线程监视所有文件
+//
+// Linux下通过inotify监视文件所在的目录(编辑器通常以重命名的方式保存文件)，
+// 其他平台，以及inotify不可用(如达到 max_user_instances 的上限)时，则定期比较文件的修改时间。
+// 变更回调在监视线程上执行。
+//
+class pywatcher
+{
+public:
+    typedef std::function<void(const std::filesystem::path&)> callback;
+
+    explicit pywatcher(callback f)
+        : _callback(std::move(f))
+        , _stop(false)
+    {
+#if OS_LINUX
+        _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (_fd < 0)
+            _error = errno;
+#endif
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ~pywatcher()
+    {
+        _stop = true;
+        if (_thread.joinable())
+            _thread.join();
+#if OS_LINUX
+        if (_fd >= 0)
+            close(_fd);
+#endif
+    }
+
+    pywatcher(const pywatcher&) = delete;
+    pywatcher& operator=(const pywatcher&) = delete;
+
+    // 添加监视的文件(绝对路径)
+    // 无法通过inotify监视时返回false，此时改为比较修改时间，错误码由 error() 获取
+    bool add(const std::filesystem::path& file)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::error_code ecode;
+        _files[file] = std::filesystem::last_write_time(file, ecode);
+
+#if OS_LINUX
+        const auto folder = file.parent_path();
+        if (_folders.count(folder))
+            return true;
+        if (_fd < 0)
+            return false;
+
+        // 仅关注写入完成与重命名，避免读到写入中途的文件
+        int wd = inotify_add_watch(_fd, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd < 0)
+        {
+            _error = errno;
+            return false;
+        }
+        _folders[folder] = wd;
+        _watches[wd] = folder;
+#endif
+        return true;
+    }
+
+    // 移除监视的文件
+    void remove(const std::filesystem::path& file)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _files.erase(file);
+
+#if OS_LINUX
+        // 目录下没有其他监视的文件时，移除目录的监视
+        const auto folder = file.parent_path();
+        for (const auto& item : _files)
+        {
+            if (item.first.parent_path() == folder)
+                return;
+        }
+
+        auto iter = _folders.find(folder);
+        if (iter != _folders.end())
+        {
+            inotify_rm_watch(_fd, iter->second);
+            _watches.erase(iter->second);
+            _folders.erase(iter);
+        }
+#endif
+    }
+
+    // 最近一次无法使用inotify的错误码(errno)
+    int error() const { return _error; }
+
+private:
+    void run()
+    {
+        while (!_stop)
+        {
+            std::set<std::filesystem::path> changed;
+#if OS_LINUX
+            pollfd pfd = { _fd, POLLIN, 0 };
+            if (_fd < 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            else if (poll(&pfd, 1, 200) > 0)
+                read_events(changed);
+#else
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+#endif
+            compare_modified(changed);
+
+            for (const auto& file : changed)
+                _callback(file);
+        }
+    }
+
+#if OS_LINUX
+    void read_events(std::set<std::filesystem::path>& changed)
+    {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(_fd, buffer, sizeof(buffer))) > 0)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (char* ptr = buffer; ptr < buffer + length; )
+            {
+                auto event = reinterpret_cast<const inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+
+                auto iter = _watches.find(event->wd);
+                if (iter == _watches.end() || event->len == 0)
+                    continue;
+
+                auto file = iter->second / event->name;
+                if (_files.count(file))
+                    changed.insert(file);
+            }
+        }
+    }
+#endif
+
+    // 比较没有被inotify监视的文件的修改时间
+    void compare_modified(std::set<std::filesystem::path>& changed)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& item : _files)
+        {
+#if OS_LINUX
+            if (_folders.count(item.first.parent_path()))
+                continue;
+#endif
+            std::error_code ecode;
+            auto modified = std::filesystem::last_write_time(item.first, ecode);
+            if (!ecode && modified != item.second)
+            {
+                item.second = modified;
+                changed.insert(item.first);
+            }
+        }
+    }
+
+private:
+    callback          _callback;
+    std::atomic<bool> _stop;
+    std::atomic<int>  _error{ 0 };
+    std::mutex        _mutex;
+    std::thread       _thread;
+    std::map<std::filesystem::path, 
+        std::filesystem::file_time_type> _files;
+#if OS_LINUX
+    int                                         _fd;
+    std::map<std::filesystem::path, int>        _folders;
+    std::map<int, std::filesystem::path>        _watches;
+#endif
+};
+
+#endif // pywatcher_h__
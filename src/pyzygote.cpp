@@ -0,0 +1,582 @@
+// This file is part of the pyembed distribution.
+// Copyright (c) 2018-2023 Zero Kwok.
+// 
+// This is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation; either version 3 of
+// the License, or (at your option) any later version.
+// 
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public
+// License along with this software; 
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Zero Kwok
+// Contact: zero.kwok@foxmail.com 
+// 
+
+
+#include "pyembed_zygote.h"
+#include "pyfork.hpp"
+
+#include <map>
+#include <thread>
+#include <stdexcept>
+#include <boost/format.hpp>
+
+#if OS_POSIX
+#   include <poll.h>
+#   include <fcntl.h>
+#   include <errno.h>
+#   include <signal.h>
+#   include <string.h>
+#   include <unistd.h>
+#   include <sys/un.h>
+#   include <sys/wait.h>
+#   include <sys/socket.h>
+#endif
+
+namespace bp = boost::python;
+
+#if OS_POSIX
+namespace {
+
+// 连接上的帧：类型(1字节) + 长度(4字节，大端) + 内容
+enum frame_type : char
+{
+    frame_job    = 'J', //!< 客户端提交的作业：脚本与参数，以 '\0' 分隔
+    frame_stdout = 'O', //!< 子进程的标准输出
+    frame_stderr = 'E', //!< 子进程的错误输出
+    frame_result = 'R', //!< 脚本全局变量 result 的 str()
+    frame_error  = 'X', //!< 脚本抛出的异常
+    frame_exit   = 'Z', //!< zygote回收子进程后发送的退出状态：退出码与信号，各4字节
+};
+
+const size_t max_frame = 64 * 1024 * 1024;
+
+// 在子进程中替换 sys.stdout/sys.stderr，写入的内容以帧的形式发送
+const char* zygote_helpers = R"(
+import os, sys, struct
+
+class _zygote_stream:
+    encoding = 'utf-8'
+    errors = 'replace'
+
+    def __init__(self, fd, kind):
+        self._fd, self._kind = fd, kind
+
+    def write(self, text):
+        data = str(text).encode('utf-8', 'replace')
+        view = memoryview(struct.pack('!BI', self._kind, len(data)) + data)
+        while view:
+            view = view[os.write(self._fd, view):]
+        return len(text)
+
+    def writelines(self, lines):
+        for line in lines:
+            self.write(line)
+
+    def flush(self):
+        pass
+
+    def isatty(self):
+        return False
+
+def attach(fd):
+    sys.stdout = _zygote_stream(fd, ord('O'))
+    sys.stderr = _zygote_stream(fd, ord('E'))
+    sys.stdin = open(os.devnull)
+)";
+
+volatile sig_atomic_t stopping = 0;
+int wakeup[2] = { -1, -1 }; // 子进程退出时唤醒 poll() 的管道
+
+void on_stop(int)
+{
+    stopping = 1;
+}
+
+void on_child(int)
+{
+    int saved = errno;
+    char byte = 0;
+    (void)!::write(wakeup[1], &byte, 1);
+    errno = saved;
+}
+
+bool write_all(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::read(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool send_frame(int fd, char type, const std::string& payload)
+{
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    char header[5] = { type,
+        char(size >> 24), char(size >> 16), char(size >> 8), char(size) };
+    return write_all(fd, header, sizeof(header)) && write_all(fd, payload.data(), payload.size());
+}
+
+bool recv_frame(int fd, char& type, std::string& payload)
+{
+    unsigned char header[5];
+    if (!read_all(fd, reinterpret_cast<char*>(header), sizeof(header)))
+        return false;
+
+    uint32_t size = (uint32_t(header[1]) << 24) | (uint32_t(header[2]) << 16) |
+                    (uint32_t(header[3]) << 8)  |  uint32_t(header[4]);
+    if (size > max_frame)
+        return false;
+
+    type = static_cast<char>(header[0]);
+    payload.resize(size);
+    return read_all(fd, &payload[0], size);
+}
+
+std::string encode_int(int32_t value)
+{
+    uint32_t bits = static_cast<uint32_t>(value);
+    return { char(bits >> 24), char(bits >> 16), char(bits >> 8), char(bits) };
+}
+
+int32_t decode_int(const char* data)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    return static_cast<int32_t>((uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+                                (uint32_t(bytes[2]) << 8)  |  uint32_t(bytes[3]));
+}
+
+sockaddr_un socket_address(const std::filesystem::path& path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.native().size() >= sizeof(address.sun_path))
+        throw std::runtime_error("zygote socket path is too long: " + path.string());
+    strcpy(address.sun_path, path.c_str());
+    return address;
+}
+
+// 在fork出的子进程中执行作业，不返回
+[[noreturn]] void run_job(pyembed& embed, const bp::object& attach, int fd, const std::string& request)
+{
+    std::vector<std::string> fields;
+    for (size_t begin = 0; begin <= request.size(); )
+    {
+        size_t end = request.find('\0', begin);
+        if (end == std::string::npos)
+            end = request.size();
+        fields.emplace_back(request, begin, end - begin);
+        begin = end + 1;
+    }
+
+    int code = 0;
+    std::string error;
+    try
+    {
+        attach(fd);
+        embed.exec_file(fields.front(), { fields.begin() + 1, fields.end() },
+            [&](const pyembed::pyerror& pyerr) {
+                // sys.exit() 作为退出码，不视为错误
+                if (PyErr_GivenExceptionMatches(pyerr.pytype.ptr(), PyExc_SystemExit))
+                {
+                    bp::object status = pyerr.pyexception.attr("code");
+                    if (status.is_none())
+                        return true;
+                    bp::extract<int> number(status);
+                    if (number.check())
+                    {
+                        code = number();
+                        return true;
+                    }
+                }
+                code = 1;
+                error = pyerr.format_exception();
+                return true;
+            });
+
+        auto& space = embed.local();
+        if (code == 0 && space.has_key("result"))
+            send_frame(fd, frame_result, bp::extract<std::string>(bp::str(space["result"])));
+    }
+    catch (const std::exception& e)
+    {
+        code = 1;
+        error = e.what();
+    }
+    catch (const bp::error_already_set&)
+    {
+        code = 1;
+        error = "unexpected python error";
+        PyErr_Clear();
+    }
+
+    if (!error.empty())
+        send_frame(fd, frame_error, error);
+    _exit(code);
+}
+
+} // namespace
+#endif
+
+void pyembed_zygote::serve(pyembed& embed, const options& opts)
+{
+#if OS_POSIX
+    pyembed::gil_acquire gil("zygote");
+
+    bp::dict helpers;
+    helpers["__builtins__"] = bp::import("builtins");
+    bp::exec(zygote_helpers, helpers, helpers);
+    bp::object attach = helpers["attach"];
+
+    // 子进程共享zygote预热后的堆
+    pyfork::warm_up(embed, opts.preload, opts.prelude);
+
+    sockaddr_un address = socket_address(opts.socket_path);
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        throw std::runtime_error(std::string("zygote socket failed: ") + strerror(errno));
+    ::unlink(address.sun_path);
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, 64) != 0)
+    {
+        int error = errno;
+        ::close(listener);
+        throw std::runtime_error(boost::str(boost::format("zygote bind %1% failed: %2%")
+            % opts.socket_path.string() % strerror(error)));
+    }
+
+    if (::pipe(wakeup) != 0)
+        throw std::runtime_error(std::string("zygote pipe failed: ") + strerror(errno));
+    for (int fd : wakeup)
+    {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        ::fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+
+    struct sigaction action = {}, previous_term = {}, previous_int = {}, previous_chld = {};
+    action.sa_handler = on_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, &previous_term);
+    sigaction(SIGINT, &action, &previous_int);
+    action.sa_handler = on_child;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, &previous_chld);
+    signal(SIGPIPE, SIG_IGN);
+    stopping = 0;
+
+    std::map<pid_t, int> children; // 子进程 -> 连接
+    std::vector<pollfd> fds;
+    std::vector<pid_t> owners;
+
+    while (!stopping)
+    {
+        // 回收已退出的子进程，并向客户端发送退出状态
+        int status = 0;
+        pid_t pid;
+        while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            auto found = children.find(pid);
+            if (found == children.end())
+                continue;
+
+            int32_t code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            int32_t sig = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+            send_frame(found->second, frame_exit, encode_int(code) + encode_int(sig));
+            ::close(found->second);
+            children.erase(found);
+        }
+
+        fds.clear();
+        owners.clear();
+        fds.push_back({ wakeup[0], POLLIN, 0 });
+        owners.push_back(0);
+        for (const auto& item : children)
+        {
+            fds.push_back({ item.second, POLLIN, 0 });
+            owners.push_back(item.first);
+        }
+        if (children.size() < opts.max_children)
+            fds.push_back({ listener, POLLIN, 0 });
+
+        int ready = 0;
+        {
+            pyembed::gil_release unlock;
+            ready = ::poll(fds.data(), fds.size(), 100);
+        }
+        if (ready <= 0)
+            continue;
+
+        char drain[64];
+        while (::read(wakeup[0], drain, sizeof(drain)) > 0);
+
+        // 客户端关闭了连接(超时或退出)，终止对应的子进程
+        for (size_t i = 1; i < owners.size(); ++i)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            char buffer[256];
+            ssize_t n = ::recv(fds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+                ::kill(owners[i], SIGKILL);
+        }
+
+        if (fds.back().fd != listener || !(fds.back().revents & POLLIN))
+            continue;
+
+        int conn = ::accept(listener, nullptr, nullptr);
+        if (conn < 0)
+            continue;
+        ::fcntl(conn, F_SETFD, FD_CLOEXEC);
+
+        // 客户端连接后立即发送作业，避免无响应的客户端阻塞zygote
+        timeval wait = { 1, 0 };
+        ::setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+
+        char type = 0;
+        std::string request;
+        if (!recv_frame(conn, type, request) || type != frame_job || request.empty())
+        {
+            ::close(conn);
+            continue;
+        }
+
+        pid = pyfork::spawn([&]() -> int {
+            sigaction(SIGTERM, &previous_term, nullptr);
+            sigaction(SIGINT, &previous_int, nullptr);
+            sigaction(SIGCHLD, &previous_chld, nullptr);
+            ::close(listener);
+            ::close(wakeup[0]);
+            ::close(wakeup[1]);
+            for (const auto& item : children)
+                ::close(item.second);
+            run_job(embed, attach, conn, request);
+            }, SIGKILL);
+
+        if (pid < 0)
+        {
+            send_frame(conn, frame_error, std::string("fork failed: ") + strerror(errno));
+            send_frame(conn, frame_exit, encode_int(-1) + encode_int(0));
+            ::close(conn);
+            continue;
+        }
+        children[pid] = conn;
+    }
+
+    // 终止尚未完成的作业
+    for (const auto& item : children)
+    {
+        ::kill(item.first, SIGKILL);
+        ::waitpid(item.first, nullptr, 0);
+        ::close(item.second);
+    }
+    sigaction(SIGTERM, &previous_term, nullptr);
+    sigaction(SIGINT, &previous_int, nullptr);
+    sigaction(SIGCHLD, &previous_chld, nullptr);
+    ::close(wakeup[0]);
+    ::close(wakeup[1]);
+    ::close(listener);
+    ::unlink(address.sun_path);
+#else
+    (void)embed;
+    (void)opts;
+    throw std::runtime_error("pyembed_zygote is only supported on POSIX systems");
+#endif
+}
+
+pyembed_zygote::pyembed_zygote(pyembed& embed, const options& opts)
+    : _options(opts)
+    , _pid(-1)
+{
+#if OS_POSIX
+    {
+        pyembed::gil_acquire gil("zygote");
+        _pid = pyfork::spawn([&]() {
+            serve(embed, opts);
+            return 0;
+            }, SIGTERM);
+    }
+
+    if (_pid < 0)
+        throw std::runtime_error(std::string("zygote fork failed: ") + strerror(errno));
+
+    // 等待zygote完成预热并开始监听
+    sockaddr_un address = socket_address(opts.socket_path);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (true)
+    {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool connected = fd >= 0 &&
+            ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        if (fd >= 0)
+            ::close(fd);
+        if (connected)
+            break;
+
+        int status = 0;
+        if (::waitpid(_pid, &status, WNOHANG) == _pid || std::chrono::steady_clock::now() > deadline)
+        {
+            ::kill(_pid, SIGKILL);
+            ::waitpid(_pid, nullptr, 0);
+            throw std::runtime_error("zygote failed to start: " + opts.socket_path.string());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+#else
+    (void)embed;
+    throw std::runtime_error("pyembed_zygote is only supported on POSIX systems");
+#endif
+}
+
+pyembed_zygote::~pyembed_zygote()
+{
+#if OS_POSIX
+    if (_pid > 0)
+    {
+        ::kill(_pid, SIGTERM);
+        ::waitpid(_pid, nullptr, 0);
+    }
+#endif
+}
+
+pyembed_zygote::outcome pyembed_zygote::run(const job& task, const output_handler& on_output) const
+{
+    return run(_options.socket_path, task, on_output);
+}
+
+pyembed_zygote::outcome pyembed_zygote::run(
+    const std::filesystem::path& socket_path,
+    const job& task,
+    const output_handler& on_output /*= {} */)
+{
+#if OS_POSIX
+    // 不访问解释器，等待期间无需持有GIL
+    std::unique_ptr<pyembed::gil_release> unlock;
+    if (Py_IsInitialized() && PyGILState_Check())
+        unlock.reset(new pyembed::gil_release);
+
+    sockaddr_un address = socket_address(socket_path);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        int error = errno;
+        if (fd >= 0)
+            ::close(fd);
+        throw std::runtime_error(boost::str(boost::format("zygote connect %1% failed: %2%")
+            % socket_path.string() % strerror(error)));
+    }
+
+    std::string request = task.script.string();
+    for (const auto& arg : task.args)
+        request += '\0' + arg;
+
+#if OS_LINUX
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+    int nosignal = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nosignal, sizeof(nosignal));
+#endif
+    std::string frame = std::string(1, frame_job) + encode_int(int32_t(request.size())) + request;
+    if (::send(fd, frame.data(), frame.size(), flags) != ssize_t(frame.size()))
+    {
+        ::close(fd);
+        throw std::runtime_error("zygote rejected the job: " + socket_path.string());
+    }
+
+    outcome result;
+    auto deadline = std::chrono::steady_clock::now() + task.timeout;
+    bool finished = false;
+    while (!finished)
+    {
+        int wait = -1;
+        if (task.timeout.count() > 0)
+        {
+            auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            wait = static_cast<int>(std::max<int64_t>(remain, 0));
+        }
+
+        pollfd item = { fd, POLLIN, 0 };
+        int ready = ::poll(&item, 1, wait);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready == 0 && !result.timed_out)
+        {
+            // 超时：关闭写端，zygote随即终止子进程并发送退出状态
+            result.timed_out = true;
+            ::shutdown(fd, SHUT_WR);
+            deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            continue;
+        }
+
+        char type = 0;
+        std::string payload;
+        if (ready <= 0 || !recv_frame(fd, type, payload))
+            break;
+
+        switch (type)
+        {
+        case frame_stdout:
+        case frame_stderr:
+            (type == frame_stdout ? result.out : result.err) += payload;
+            if (on_output)
+                on_output(type == frame_stderr, payload);
+            break;
+        case frame_result:
+            result.result = std::move(payload);
+            break;
+        case frame_error:
+            result.error = std::move(payload);
+            break;
+        case frame_exit:
+            if (payload.size() == 8)
+            {
+                result.exit_code = decode_int(payload.data());
+                result.signal = decode_int(payload.data() + 4);
+            }
+            finished = true;
+            break;
+        }
+    }
+
+    ::close(fd);
+    return result;
+#else
+    (void)socket_path;
+    (void)task;
+    (void)on_output;
+    throw std::runtime_error("pyembed_zygote is only supported on POSIX systems");
+#endif
+}